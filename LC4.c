@@ -3,17 +3,9 @@
  */
 
 #include "LC4.h"
+#include "decode.h"
 #include <stdio.h>
 
-// instructions in sections
-#define INSN_OP(I) ((I) >> 12)// bits 12-15 - Opcode
-#define INSN_Rt(I) ((I) & 0x7) // bits 0-2: Rt
-#define INSN_Rs(I) (((I) >> 6) & 0x7)//bits 6-8: Rs
-#define INSN_Rd(I) (((I) >> 9) & 0x7)//bits 9-11 - Rd
-#define INSN_IMM6(I) ((I) & 0x3F)// bits 0-5: IMM6
-#define INSN_IMM9(I) ((I) & 0x1FF)// bits 0-8: IMM9
-#define INSN_IMM11(I) ((I) & 0x7FF)// bits 0-11: IMM11
-#define SEXT(val, bits) (((val) & (1 << ((bits)-1))) ? ((val) | (~((1 << (bits)) - 1))) : (val))
 
 /*
  * Reset the machine state as Pennsim would do
@@ -0,0 +1,47 @@
+/*
+ * aot.h: Interface between a program compiled by lc4aot and its driver, aotrun.c
+ */
+
+#ifndef AOT_H
+#define AOT_H
+
+#include "engine.h"
+#include <limits.h>
+
+/*
+ * Defined by the C file lc4aot writes. AotRun runs the compiled blocks from
+ * CPU->PC, jumping between them directly and through a switch on the PC
+ * for JMPR, JSRR and RTI, with the semantics of the block engine. It
+ * returns, with the machine state written back, when it reaches 0x80FF,
+ * an address that wasn't compiled, the limit (checked at the end of each
+ * block), or a store into compiled code; that last one sets *wrote_code and
+ * the compiled code can't be trusted again for this run. Pages stored to
+ * are marked in dirty. Returns the number of instructions executed.
+ */
+void AotLoadImage(MachineState* CPU);
+int AotTranslated(unsigned short address);
+unsigned long AotRun(MachineState* CPU, const RunLimit* limit, unsigned char* dirty, int* wrote_code);
+
+// for the generated code, which declares the locals these use
+#define AOT_SYNC() do { \
+        if (nzp != NZP_SYNCED) { \
+            psr = (psr & 0xFFF8) | (nzp > 0 ? 0x0001 : nzp == 0 ? 0x0002 : 0x0004); \
+            nzp = NZP_SYNCED; \
+        } \
+    } while (0)
+#define AOT_CHECK() do { if (count >= max || *stop) goto leave; } while (0)
+#define AOT_GOTO(target, label) do { pc = (target); AOT_CHECK(); goto label; } while (0)
+#define AOT_JUMP(target) do { pc = (target); AOT_CHECK(); goto dispatch; } while (0)
+#define AOT_LEAVE(target) do { pc = (target); goto leave; } while (0)
+#define AOT_STORE(address, value, next, n) do { \
+        unsigned short a_ = (address); \
+        M[a_] = (value); \
+        dirty[a_ >> PAGE_SHIFT] = 1; \
+        if (code_bits[a_ >> 3] & (1 << (a_ & 7))) { \
+            *wrote_code = 1; \
+            count += (n); \
+            AOT_LEAVE(next); \
+        } \
+    } while (0)
+
+#endif
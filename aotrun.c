@@ -0,0 +1,129 @@
+/*
+ * aotrun.c: main() for a program compiled by lc4aot, linked with the C file it wrote
+ */
+
+#include "loader.h"
+#include "aot.h"
+
+MachineState CPU_STATE;
+MachineState* CPU = &CPU_STATE;
+DecodeCache DECODE_CACHE;
+DecodeCache* DECODE = &DECODE_CACHE;
+
+/*
+ * Whether a compiled word no longer holds what it was compiled from, on a
+ * page stored to since the decode cache's dirty pages were cleared.
+ */
+static int CompiledCodeChanged(MachineState* image)
+{
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (!DECODE->dirty[page]) {
+            continue;
+        }
+        for (int a = page << PAGE_SHIFT; a < (page + 1) << PAGE_SHIFT; a++) {
+            if (AotTranslated(a) && image->memory[a] != CPU->memory[a]) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Run from the reset state like trace -n: compiled code wherever there is
+ * some, the threaded engine one straight-line stretch at a time wherever
+ * there isn't, and the threaded engine for the rest of the run once the
+ * program stores into compiled code, from either. image is the memory the
+ * code was compiled from.
+ */
+static unsigned long RunCompiled(MachineState* image, int compiled, unsigned long max_insns)
+{
+    unsigned long count = 0;
+    while (1) {
+        RunLimit limit = { .max_insns = max_insns != 0 ? max_insns - count : 0 };
+        if (compiled) {
+            unsigned char dirty[NUM_PAGES] = { 0 };
+            int wrote_code = 0;
+            count += AotRun(CPU, &limit, dirty, &wrote_code);
+            for (int page = 0; page < NUM_PAGES; page++) { // stores bypassed the decode cache
+                if (dirty[page]) {
+                    InvalidatePage(DECODE, page);
+                }
+            }
+            compiled = !wrote_code;
+            if ((count != 0 && CPU->PC == 0x80FF) || (max_insns != 0 && count >= max_insns)) {
+                break;
+            }
+            limit.max_insns = max_insns != 0 ? max_insns - count : 0;
+        }
+        if (compiled) {
+            limit.max_insns = 1; // up to the next control transfer, then try compiled code again
+            memset(DECODE->dirty, 0, sizeof(DECODE->dirty));
+        }
+        count += RunThreadedNoTrace(CPU, DECODE, NULL, &limit);
+        if (compiled && CompiledCodeChanged(image)) {
+            compiled = 0;
+        }
+        if (CPU->PC == 0x80FF || (max_insns != 0 && count >= max_insns)) {
+            break;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    unsigned long max_insns = 0; // -l: stop after about this many instructions
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+            max_insns = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (argc - arg < 1) {
+        printf("usage: %s [-l max_insns] output_file [obj...]\n", argv[0]);
+        printf("the obj files are loaded over the compiled image, as inputs\n");
+        return -1;
+    }
+
+    memset(CPU->memory, 0, sizeof(CPU->memory));
+    Reset(CPU);
+    AotLoadImage(CPU);
+    for (int i = arg + 1; i < argc; i++) {
+        if (ReadObjectFile(argv[i], CPU) != 0) {
+            printf("Error: Failed to read object file %s\n", argv[i]);
+            return -1;
+        }
+    }
+    ClearDecodeCache(DECODE);
+
+    // inputs that replace compiled instructions leave only the interpreter
+    MachineState* image = malloc(sizeof(MachineState));
+    if (image == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    AotLoadImage(image);
+    int compiled = 1;
+    for (int a = 0; a < 65536; a++) {
+        if (AotTranslated(a) && image->memory[a] != CPU->memory[a]) {
+            compiled = 0;
+            break;
+        }
+    }
+
+    FILE* output_file = fopen(argv[arg], "w");
+    if (output_file == NULL) {
+        printf("Error: Cannot create output file %s\n", argv[arg]);
+        return -1;
+    }
+    unsigned long count = RunCompiled(image, compiled, max_insns);
+    DumpMachineState(CPU, count, output_file);
+    fclose(output_file);
+    free(image);
+    return 0;
+}
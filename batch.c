@@ -0,0 +1,409 @@
+/*
+ * batch.c: main() for running a manifest of programs at once, one simulator per worker thread
+ */
+
+#include "loader.h"
+#include "engine.h"
+#include "snapshot.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 256
+#define MAX_JOB_FILES 32  // object files per job
+#define MANIFEST_LINE 4096
+
+// how a job ended
+enum {
+    JOB_OK = 0, // reached 0x80FF
+    JOB_LIMIT,  // hit its instruction limit
+    JOB_TIMEOUT,
+    JOB_FAILED  // couldn't load or create its output
+};
+static const char* status_names[] = { "ok", "limit", "timeout", "failed" };
+
+typedef struct {
+    char* output;
+    char* files[MAX_JOB_FILES];
+    int num_files;
+    unsigned long max_insns; // 0 for no limit
+    double timeout;          // seconds, 0 for none
+    int status;
+    unsigned long count;     // instructions executed
+    double seconds;
+} Job;
+
+/*
+ * Job indexes dealt to one worker. The owner takes from the tail and idle
+ * workers steal from the head, each side under the queue's lock.
+ */
+typedef struct {
+    int* jobs;
+    int head, tail;
+    pthread_mutex_t lock;
+} JobQueue;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    JobQueue queue;
+    MachineState* CPU;   // everything a run touches belongs to this worker
+    DecodeCache* cache;
+    TraceWriter* trace;
+    Snapshot* snap;      // machine as loaded for snap_job, reset to between jobs
+    Job* snap_job;       // NULL until something is loaded
+    int snap_files;      // how many of snap_job's files the snapshot holds
+    RunLimit limit;
+    double deadline;     // when the watchdog stops the current job, 0 for never
+} Worker;
+
+static Job* jobs;
+static int num_jobs;
+static Worker* workers;
+static int num_workers;
+static int engine = ENGINE_THREADED;
+static int no_trace = 0;
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER; // deadlines and workers_done
+static int workers_done = 0;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Next job for worker w: its own newest, else the oldest one it can steal.
+ * Returns -1 once every queue is empty.
+ */
+static int NextJob(Worker* w)
+{
+    int job = -1;
+    pthread_mutex_lock(&w->queue.lock);
+    if (w->queue.tail > w->queue.head) {
+        job = w->queue.jobs[--w->queue.tail];
+    }
+    pthread_mutex_unlock(&w->queue.lock);
+
+    for (int k = 1; k < num_workers && job < 0; k++) {
+        JobQueue* victim = &workers[(w->id + k) % num_workers].queue;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head) {
+            job = victim->jobs[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+/*
+ * Load files[from..to) of job on top of whatever is in memory.
+ */
+static int LoadFiles(MachineState* CPU, Job* job, int from, int to)
+{
+    for (int i = from; i < to; i++) {
+        if (ReadObjectFile(job->files[i], CPU) != 0) {
+            printf("Error: Failed to read object file %s\n", job->files[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Put job's program in w's machine. Of several files the last one is taken
+ * to be the job's input: the rest are loaded once and snapshotted, and a
+ * later job starting with the same files only resets the pages the last
+ * run dirtied before loading its own input.
+ */
+static int LoadJob(Worker* w, Job* job)
+{
+    int shared = (job->num_files > 1) ? job->num_files - 1 : 1;
+    int same = w->snap_job != NULL && w->snap_files == shared;
+    for (int i = 0; i < shared && same; i++) {
+        same = strcmp(w->snap_job->files[i], job->files[i]) == 0;
+    }
+
+    if (same) {
+        SnapshotRestore(w->snap, w->CPU, w->cache);
+    } else {
+        w->snap_job = NULL;
+        memset(w->CPU->memory, 0, sizeof(w->CPU->memory));
+        Reset(w->CPU);
+        if (LoadFiles(w->CPU, job, 0, shared) != 0) {
+            return -1;
+        }
+        ClearDecodeCache(w->cache);
+        SnapshotTake(w->snap, w->CPU, w->cache);
+        w->snap_job = job;
+        w->snap_files = shared;
+    }
+    if (shared < job->num_files) {
+        if (LoadFiles(w->CPU, job, shared, job->num_files) != 0) {
+            w->snap_job = NULL; // part of the file may be in memory, untracked
+            return -1;
+        }
+        SnapshotMarkChanged(w->snap, w->CPU, w->cache);
+    }
+    return 0;
+}
+
+/*
+ * Load and run one job on w's machine, writing its trace (or final state
+ * with -n) to the job's output file.
+ */
+static void RunJob(Worker* w, Job* job)
+{
+    MachineState* CPU = w->CPU;
+    double start = Now();
+
+    job->status = JOB_FAILED;
+    if (LoadJob(w, job) != 0) {
+        return;
+    }
+    FILE* output = fopen(job->output, "w");
+    if (output == NULL) {
+        printf("Error: Cannot create output file %s\n", job->output);
+        return;
+    }
+
+    w->limit.max_insns = job->max_insns;
+    w->limit.stop = 0;
+    pthread_mutex_lock(&watch_lock);
+    w->deadline = (job->timeout > 0) ? start + job->timeout : 0;
+    pthread_mutex_unlock(&watch_lock);
+
+    if (no_trace) {
+        job->count = RunProgram(engine, CPU, w->cache, NULL, NULL, &w->limit);
+        DumpMachineState(CPU, job->count, output);
+    } else {
+        TraceWriterInit(w->trace, output, TRACE_TEXT, 0);
+        job->count = RunProgram(engine, CPU, w->cache, w->trace, NULL, &w->limit);
+        TraceWriterClose(w->trace);
+    }
+    fclose(output);
+
+    pthread_mutex_lock(&watch_lock);
+    w->deadline = 0;
+    pthread_mutex_unlock(&watch_lock);
+
+    if (CPU->PC == 0x80FF) {
+        job->status = JOB_OK;
+    } else {
+        job->status = w->limit.stop ? JOB_TIMEOUT : JOB_LIMIT;
+    }
+    job->seconds = Now() - start;
+}
+
+static void* WorkerThread(void* arg)
+{
+    Worker* w = arg;
+    int job;
+    while ((job = NextJob(w)) >= 0) {
+        RunJob(w, &jobs[job]);
+    }
+    pthread_mutex_lock(&watch_lock);
+    workers_done++;
+    pthread_mutex_unlock(&watch_lock);
+    return NULL;
+}
+
+/*
+ * Read the manifest: one job per line, "[-l insns] [-t seconds] output obj...".
+ * Blank lines and lines starting with # are skipped. Returns -1 on a bad line.
+ */
+static int ReadManifest(const char* filename, unsigned long max_insns, double timeout)
+{
+    FILE* manifest = fopen(filename, "r");
+    if (manifest == NULL) {
+        printf("Error: Cannot open manifest %s\n", filename);
+        return -1;
+    }
+    char line[MANIFEST_LINE];
+    int capacity = 0;
+    int line_num = 0;
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        line_num++;
+        char* save;
+        char* word = strtok_r(line, " \t\r\n", &save);
+        if (word == NULL || word[0] == '#') {
+            continue;
+        }
+        if (num_jobs == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            Job* bigger = realloc(jobs, capacity * sizeof(Job));
+            if (bigger == NULL) {
+                printf("Error: out of memory reading the manifest\n");
+                fclose(manifest);
+                return -1;
+            }
+            jobs = bigger;
+        }
+        Job* job = &jobs[num_jobs];
+        memset(job, 0, sizeof(*job));
+        job->max_insns = max_insns;
+        job->timeout = timeout;
+
+        while (word != NULL && word[0] == '-') { // per-job overrides
+            char* value = strtok_r(NULL, " \t\r\n", &save);
+            if (value != NULL && strcmp(word, "-l") == 0) {
+                job->max_insns = strtoul(value, NULL, 0);
+            } else if (value != NULL && strcmp(word, "-t") == 0) {
+                job->timeout = atof(value);
+            } else {
+                printf("Error: manifest line %d: bad option %s\n", line_num, word);
+                fclose(manifest);
+                return -1;
+            }
+            word = strtok_r(NULL, " \t\r\n", &save);
+        }
+        if (word == NULL) {
+            printf("Error: manifest line %d: need output file and obj file\n", line_num);
+            fclose(manifest);
+            return -1;
+        }
+        job->output = strdup(word);
+        while ((word = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            if (job->num_files == MAX_JOB_FILES) {
+                printf("Error: manifest line %d: more than %d obj files\n", line_num, MAX_JOB_FILES);
+                fclose(manifest);
+                return -1;
+            }
+            job->files[job->num_files++] = strdup(word);
+        }
+        if (job->num_files == 0) {
+            printf("Error: manifest line %d: need output file and obj file\n", line_num);
+            fclose(manifest);
+            return -1;
+        }
+        num_jobs++;
+    }
+    fclose(manifest);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    unsigned long max_insns = 0; // -l: default instruction limit per job
+    double timeout = 0;          // -t: default seconds per job
+    num_workers = sysconf(_SC_NPROCESSORS_ONLN); // -j: worker threads
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            num_workers = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-e") == 0 && arg + 1 < argc) {
+            engine = ParseEngine(argv[arg + 1]);
+            if (engine < 0) {
+                printf("Error: unknown engine %s\n", argv[arg + 1]);
+                return -1;
+            }
+            arg += 2;
+        } else if (strcmp(argv[arg], "-n") == 0) {
+            no_trace = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+            max_insns = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            timeout = atof(argv[arg + 1]);
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (argc - arg != 1) {
+        printf("usage: %s [-j workers] [-e engine] [-n] [-l insns] [-t seconds] manifest\n", argv[0]);
+        return -1;
+    }
+    if (no_trace && engine != ENGINE_THREADED && engine != ENGINE_BLOCK && engine != ENGINE_JIT) {
+        printf("Error: -n only runs on the threaded, block and JIT engines\n");
+        return -1;
+    }
+    if ((engine == ENGINE_BLOCK || engine == ENGINE_JIT) && !no_trace) {
+        printf("Error: the %s engine needs -n\n", engine == ENGINE_JIT ? "JIT" : "block");
+        return -1;
+    }
+    if (ReadManifest(argv[arg], max_insns, timeout) != 0) {
+        return -1;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    } else if (num_workers > MAX_WORKERS) {
+        num_workers = MAX_WORKERS;
+    }
+    if (num_workers > num_jobs && num_jobs > 0) {
+        num_workers = num_jobs;
+    }
+
+    // deal the jobs out in runs of neighbours, which tend to share their
+    // program and so a snapshot; stealing evens out whatever that gets wrong
+    workers = calloc(num_workers, sizeof(Worker));
+    if (workers == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        Worker* w = &workers[i];
+        w->id = i;
+        w->queue.jobs = malloc((num_jobs / num_workers + 1) * sizeof(int));
+        pthread_mutex_init(&w->queue.lock, NULL);
+        w->CPU = malloc(sizeof(MachineState));
+        w->cache = malloc(sizeof(DecodeCache));
+        w->trace = no_trace ? NULL : malloc(sizeof(TraceWriter));
+        w->snap = malloc(sizeof(Snapshot));
+        if (w->queue.jobs == NULL || w->CPU == NULL || w->cache == NULL || w->snap == NULL || (!no_trace && w->trace == NULL)) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+    }
+    for (int j = 0; j < num_jobs; j++) {
+        JobQueue* queue = &workers[(long)j * num_workers / num_jobs].queue;
+        queue->jobs[queue->tail++] = j;
+    }
+
+    double start = Now();
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, WorkerThread, &workers[i]) != 0) {
+            printf("Error: Cannot start worker %d\n", i);
+            return -1;
+        }
+    }
+
+    // watchdog: stop any job that runs past its deadline
+    struct timespec tick = { 0, 5 * 1000 * 1000 };
+    while (1) {
+        nanosleep(&tick, NULL);
+        double now = Now();
+        pthread_mutex_lock(&watch_lock);
+        int done = workers_done == num_workers;
+        for (int i = 0; i < num_workers; i++) {
+            if (workers[i].deadline != 0 && now >= workers[i].deadline) {
+                workers[i].limit.stop = 1;
+            }
+        }
+        pthread_mutex_unlock(&watch_lock);
+        if (done) {
+            break;
+        }
+    }
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    double elapsed = Now() - start;
+
+    int by_status[4] = { 0 };
+    unsigned long total = 0;
+    for (int j = 0; j < num_jobs; j++) {
+        by_status[jobs[j].status]++;
+        total += jobs[j].count;
+        printf("%-7s %12lu insns %8.3fs  %s\n", status_names[jobs[j].status], jobs[j].count, jobs[j].seconds, jobs[j].output);
+    }
+    printf("jobs %d: ok %d, limit %d, timeout %d, failed %d\n", num_jobs, by_status[JOB_OK], by_status[JOB_LIMIT],
+           by_status[JOB_TIMEOUT], by_status[JOB_FAILED]);
+    printf("%d workers, %.3fs, %.1f jobs/s, %.1f MIPS\n", num_workers, elapsed,
+           elapsed > 0 ? num_jobs / elapsed : 0.0, elapsed > 0 ? total / elapsed / 1e6 : 0.0);
+    return by_status[JOB_OK] == num_jobs ? 0 : 1;
+}
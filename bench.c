@@ -0,0 +1,569 @@
+/*
+ * bench.c: main() for timing the engines, the loader and WriteOut on generated workloads
+ */
+
+#include "loader.h"
+#include "engine.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// instruction encodings for the generated programs
+#define OP(op, rest) ((unsigned short)(((op) << 12) | ((rest) & 0xFFF)))
+#define ADD(d, s, t) OP(1, ((d) << 9) | ((s) << 6) | (0 << 3) | (t))
+#define MUL(d, s, t) OP(1, ((d) << 9) | ((s) << 6) | (1 << 3) | (t))
+#define SUB(d, s, t) OP(1, ((d) << 9) | ((s) << 6) | (2 << 3) | (t))
+#define AND(d, s, t) OP(5, ((d) << 9) | ((s) << 6) | (0 << 3) | (t))
+#define XOR(d, s, t) OP(5, ((d) << 9) | ((s) << 6) | (3 << 3) | (t))
+#define SLL(d, s, n) OP(10, ((d) << 9) | ((s) << 6) | (0 << 4) | (n))
+#define SRL(d, s, n) OP(10, ((d) << 9) | ((s) << 6) | (2 << 4) | (n))
+#define LDR(d, s, off) OP(6, ((d) << 9) | ((s) << 6) | ((off) & 0x3F))
+#define STR(d, s, off) OP(7, ((d) << 9) | ((s) << 6) | ((off) & 0x3F))
+#define CONST(d, imm) OP(9, ((d) << 9) | ((imm) & 0x1FF))
+#define HICONST(d, imm) OP(13, ((d) << 9) | (1 << 8) | ((imm) & 0xFF))
+#define BR(nzp, off) OP(0, ((nzp) << 9) | ((off) & 0x1FF))
+#define JSR(off) OP(4, (off) & 0x7FF)
+#define RTI OP(8, 0)
+#define TRAP(v) OP(15, (v) & 0xFF)
+#define BR_P 1
+#define BR_Z 2
+
+#define CODE_START 0x8200
+#define TRAP_VECTOR 0x10 // handler of the trap workload, at 0x8000 | TRAP_VECTOR
+
+typedef struct {
+    unsigned short words[512];
+    int len;
+} Program;
+
+static void Emit(Program* p, unsigned short word)
+{
+    p->words[p->len++] = word;
+}
+
+// set register d to any 16-bit value
+static void SetReg(Program* p, int d, unsigned short value)
+{
+    Emit(p, CONST(d, value & 0xFF));
+    Emit(p, HICONST(d, value >> 8));
+}
+
+// branch back to target, which was p->len when the loop started
+static void LoopBack(Program* p, int nzp, int target)
+{
+    Emit(p, BR(nzp, target - (p->len + 1)));
+}
+
+/*
+ * Each workload keeps its loop counters in R5 (inner) and R3 (outer) and
+ * R4 = -1 for counting down. It runs its inner loop outer times and ends
+ * with TRAP xFF, which lands on 0x80FF.
+ */
+static void Prologue(Program* p, int outer)
+{
+    SetReg(p, 4, 0xFFFF);
+    SetReg(p, 3, outer);
+}
+
+static void Epilogue(Program* p, int outer_top)
+{
+    Emit(p, ADD(3, 3, 4));
+    LoopBack(p, BR_P, outer_top);
+    Emit(p, TRAP(0xFF));
+}
+
+// tight ALU loop: 16 arithmetic, logic and shift ops per iteration
+static void BuildAlu(Program* p, int outer)
+{
+    Prologue(p, outer);
+    int outer_top = p->len;
+    SetReg(p, 5, 1000);
+    int top = p->len;
+    Emit(p, ADD(0, 0, 1));
+    Emit(p, MUL(1, 1, 2));
+    Emit(p, XOR(2, 2, 0));
+    Emit(p, SUB(6, 0, 2));
+    Emit(p, SLL(7, 6, 3));
+    Emit(p, ADD(1, 7, 0));
+    Emit(p, AND(2, 1, 6));
+    Emit(p, SRL(0, 7, 2));
+    Emit(p, ADD(2, 2, 3));
+    Emit(p, MUL(6, 6, 1));
+    Emit(p, XOR(7, 7, 2));
+    Emit(p, ADD(0, 0, 6));
+    Emit(p, SUB(1, 1, 7));
+    Emit(p, SLL(2, 0, 1));
+    Emit(p, ADD(6, 6, 1));
+    Emit(p, XOR(0, 0, 7));
+    Emit(p, ADD(5, 5, 4));
+    LoopBack(p, BR_P, top);
+    Epilogue(p, outer_top);
+}
+
+// memory walk: read-modify-write of a 1024-word array, two words per iteration
+static void BuildMem(Program* p, int outer)
+{
+    Prologue(p, outer);
+    int outer_top = p->len;
+    SetReg(p, 1, 0x4000); // array
+    SetReg(p, 6, 2);      // stride
+    SetReg(p, 5, 512);
+    int top = p->len;
+    Emit(p, LDR(0, 1, 0));
+    Emit(p, LDR(2, 1, 1));
+    Emit(p, ADD(0, 0, 2));
+    Emit(p, STR(0, 1, 0));
+    Emit(p, XOR(2, 2, 0));
+    Emit(p, STR(2, 1, 1));
+    Emit(p, LDR(7, 1, 31)); // a word further on
+    Emit(p, STR(7, 1, -1));
+    Emit(p, ADD(1, 1, 6));
+    Emit(p, ADD(5, 5, 4));
+    LoopBack(p, BR_P, top);
+    Epilogue(p, outer_top);
+}
+
+// branch-heavy: a pseudo-random value picks which of four branches are taken
+static void BuildBranch(Program* p, int outer)
+{
+    Prologue(p, outer);
+    SetReg(p, 0, 0xACE1);
+    SetReg(p, 1, 25173); // LCG multiplier
+    SetReg(p, 2, 13849); // and increment
+    int outer_top = p->len;
+    SetReg(p, 5, 1000);
+    int top = p->len;
+    Emit(p, MUL(0, 0, 1));
+    Emit(p, ADD(0, 0, 2));
+    for (int bit = 0; bit < 4; bit++) { // test bits 8-11, each skipping one op when clear
+        Emit(p, SRL(6, 0, 8 + bit));
+        Emit(p, SLL(6, 6, 15));
+        Emit(p, BR(BR_Z, 1));
+        Emit(p, ADD(7, 7, 6));
+    }
+    Emit(p, ADD(5, 5, 4));
+    LoopBack(p, BR_P, top);
+    Epilogue(p, outer_top);
+}
+
+// call chain: 8 nested subroutines, each saving R7 on a stack and returning with RTI
+static void BuildCall(Program* p, int outer)
+{
+    const int depth = 8;
+    Prologue(p, outer);
+    SetReg(p, 6, 0x7000); // stack pointer, grows down
+    SetReg(p, 2, 1);
+    int outer_top = p->len;
+    SetReg(p, 5, 200);
+    int top = p->len;
+    int call = p->len;
+    Emit(p, 0); // JSR to the first subroutine, patched below
+    Emit(p, ADD(5, 5, 4));
+    LoopBack(p, BR_P, top);
+    Epilogue(p, outer_top);
+
+    int prev = call;
+    for (int i = 0; i < depth; i++) {
+        p->words[prev] = JSR(p->len - (prev + 1));
+        Emit(p, ADD(6, 6, 4)); // push R7
+        Emit(p, STR(7, 6, 0));
+        Emit(p, ADD(0, 0, 2));
+        prev = p->len;
+        if (i < depth - 1) {
+            Emit(p, 0); // call the next one
+        }
+        Emit(p, LDR(7, 6, 0)); // pop R7
+        Emit(p, ADD(6, 6, 2));
+        Emit(p, RTI);
+    }
+}
+
+// trap-heavy: a TRAP per iteration into a small handler that returns with RTI
+static void BuildTrap(Program* p, int outer)
+{
+    Prologue(p, outer);
+    SetReg(p, 1, 0x4000);
+    SetReg(p, 2, 1);
+    int outer_top = p->len;
+    SetReg(p, 5, 1000);
+    int top = p->len;
+    Emit(p, TRAP(TRAP_VECTOR));
+    Emit(p, ADD(5, 5, 4));
+    LoopBack(p, BR_P, top);
+    Epilogue(p, outer_top);
+}
+
+// the handler, as an OS routine writing a device register would
+static void BuildTrapHandler(Program* os)
+{
+    Emit(os, LDR(0, 1, 0));
+    Emit(os, ADD(0, 0, 2));
+    Emit(os, STR(0, 1, 0));
+    Emit(os, RTI);
+}
+
+typedef struct {
+    const char* name;
+    void (*build)(Program* p, int outer);
+    void (*build_os)(Program* os); // NULL if the workload needs no OS code
+    int outer;                     // outer iterations at scale 1
+} Workload;
+
+static const Workload workloads[] = {
+    { "alu", BuildAlu, NULL, 250 },
+    { "mem", BuildMem, NULL, 800 },
+    { "branch", BuildBranch, NULL, 250 },
+    { "call", BuildCall, NULL, 250 },
+    { "trap", BuildTrap, BuildTrapHandler, 1000 },
+};
+#define NUM_WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+// engines as RunProgram runs them; ref and decode print through WriteOut,
+// which is slow enough that they get shorter runs of the same workload
+typedef struct {
+    const char* name;
+    int engine;
+    int trace;   // 0 runs without a trace
+    int divisor; // outer iterations are divided by this
+} BenchEngine;
+
+static const BenchEngine engines[] = {
+    { "ref", ENGINE_REFERENCE, 1, 32 },
+    { "decode", ENGINE_DECODED, 1, 32 },
+    { "threaded", ENGINE_THREADED, 1, 1 },
+    { "threaded-n", ENGINE_THREADED, 0, 1 },
+    { "block", ENGINE_BLOCK, 0, 1 },
+    { "jit", ENGINE_JIT, 0, 1 },
+};
+#define NUM_ENGINES (int)(sizeof(engines) / sizeof(engines[0]))
+
+MachineState IMAGE;  // loaded workload, copied into CPU before each run
+MachineState CPU_STATE;
+MachineState* CPU = &CPU_STATE;
+DecodeCache DECODE_CACHE;
+DecodeCache* DECODE = &DECODE_CACHE;
+TraceWriter TRACE_WRITER;
+TraceWriter* TRACE = &TRACE_WRITER;
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int CompareDouble(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Summary of reps timings, sorted in place: median, fastest, and the median
+ * absolute deviation as a fraction of the median, which a noisy neighbour
+ * or a frequency change moves far less than the mean and standard deviation.
+ */
+typedef struct {
+    double median, min, spread;
+} Stats;
+
+static Stats Summarize(double* times, int reps)
+{
+    Stats s;
+    double dev[reps];
+    qsort(times, reps, sizeof(double), CompareDouble);
+    s.median = times[reps / 2];
+    s.min = times[0];
+    for (int i = 0; i < reps; i++) {
+        dev[i] = times[i] > s.median ? times[i] - s.median : s.median - times[i];
+    }
+    qsort(dev, reps, sizeof(double), CompareDouble);
+    s.spread = s.median > 0 ? dev[reps / 2] / s.median : 0;
+    return s;
+}
+
+/*
+ * Write sections to an object file: each as big-endian header, address,
+ * word count and words. Symbols and line numbers are added when labels
+ * is set, one per 16 words, for the loader benchmark.
+ */
+static int WriteObject(const char* path, Program** sections, unsigned short* addresses, int num_sections, int labels)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    for (int s = 0; s < num_sections; s++) {
+        Program* p = sections[s];
+        unsigned char head[6] = { 0xCA, 0xDE, addresses[s] >> 8, addresses[s] & 0xFF, p->len >> 8, p->len & 0xFF };
+        fwrite(head, 1, 6, f);
+        for (int i = 0; i < p->len; i++) {
+            putc(p->words[i] >> 8, f);
+            putc(p->words[i] & 0xFF, f);
+        }
+        for (int i = 0; labels && i < p->len; i += 16) {
+            unsigned short addr = addresses[s] + i;
+            char name[16];
+            int len = sprintf(name, "L%04X", addr);
+            unsigned char sym[6] = { 0xC3, 0xB7, addr >> 8, addr & 0xFF, 0, len };
+            fwrite(sym, 1, 6, f);
+            fwrite(name, 1, len, f);
+            unsigned char line[8] = { 0x71, 0x5E, addr >> 8, addr & 0xFF, 0, i / 16 + 1, 0, 0 };
+            fwrite(line, 1, 8, f);
+        }
+    }
+    if (labels) {
+        unsigned char file[4] = { 0xF1, 0x7E, 0, 9 };
+        fwrite(file, 1, 4, f);
+        fwrite("bench.asm", 1, 9, f);
+    }
+    return fclose(f);
+}
+
+/*
+ * Redirect stdout to /dev/null while the loader prints its section
+ * messages, so they cost what they cost without flooding the report.
+ */
+static int Silence(void)
+{
+    fflush(stdout);
+    int saved = dup(1);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    close(null_fd);
+    return saved;
+}
+
+static void Unsilence(int saved)
+{
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+}
+
+/*
+ * Generate a workload with the given outer loop count, write it out as an
+ * object file and load it into IMAGE the way trace would.
+ */
+static void LoadWorkload(const Workload* w, int outer, const char* path)
+{
+    Program main_code = { .len = 0 }, os_code = { .len = 0 };
+    w->build(&main_code, outer);
+    if (w->build_os != NULL) {
+        w->build_os(&os_code);
+    }
+    Program* sections[2] = { &main_code, &os_code };
+    unsigned short addresses[2] = { CODE_START, 0x8000 | TRAP_VECTOR };
+    if (WriteObject(path, sections, addresses, os_code.len > 0 ? 2 : 1, 0) != 0) {
+        printf("Error: Cannot create %s\n", path);
+        exit(-1);
+    }
+    memset(IMAGE.memory, 0, sizeof(IMAGE.memory));
+    Reset(&IMAGE);
+    int saved = Silence();
+    int result = ReadObjectFile((char*)path, &IMAGE);
+    Unsilence(saved);
+    if (result != 0) {
+        printf("Error: Failed to read object file %s\n", path);
+        exit(-1);
+    }
+}
+
+/*
+ * Time every engine on one workload, reps runs each after a warm-up run.
+ */
+static void BenchWorkload(const Workload* w, int scale, int reps, const char* path, int only_engine, FILE* null_output)
+{
+    for (int e = 0; e < NUM_ENGINES; e++) {
+        if (only_engine >= 0 && e != only_engine) {
+            continue;
+        }
+        int outer = w->outer * scale / engines[e].divisor;
+        LoadWorkload(w, outer > 0 ? outer : 1, path);
+        int saved;
+        double times[reps];
+        unsigned long count = 0;
+        for (int r = -1; r < reps; r++) { // r = -1 warms caches and page tables up
+            memcpy(CPU, &IMAGE, sizeof(MachineState));
+            ClearDecodeCache(DECODE);
+            double t = Now();
+            if (engines[e].trace) {
+                TraceWriterInit(TRACE, null_output, TRACE_TEXT, 0);
+                saved = Silence(); // the reference engines announce the exit on stdout
+                count = RunProgram(engines[e].engine, CPU, DECODE, TRACE, NULL, NULL);
+                Unsilence(saved);
+                TraceWriterClose(TRACE);
+            } else {
+                count = RunProgram(engines[e].engine, CPU, DECODE, NULL, NULL, NULL);
+            }
+            if (r >= 0) {
+                times[r] = Now() - t;
+            }
+        }
+        Stats s = Summarize(times, reps);
+        printf("%-8s %-11s %10lu %9.1f %9.2f %9.2f %6.1f%%\n", w->name, engines[e].name, count,
+               count / s.median / 1e6, s.median / count * 1e9, s.min * 1e3, s.spread * 100);
+    }
+}
+
+/*
+ * Time ReadObjectFile on a file filling all of memory in 64 code sections,
+ * with a label and a line number every 16 words.
+ */
+static void BenchLoader(int reps, const char* path)
+{
+    static Program chunks[64];
+    Program* sections[64];
+    unsigned short addresses[64];
+    unsigned int seed = 1;
+    for (int s = 0; s < 64; s++) {
+        chunks[s].len = 512;
+        for (int i = 0; i < 512; i++) {
+            seed = seed * 1103515245u + 12345u;
+            chunks[s].words[i] = seed >> 16;
+        }
+        sections[s] = &chunks[s];
+        addresses[s] = s * 1024;
+    }
+    if (WriteObject(path, sections, addresses, 64, 1) != 0) {
+        printf("Error: Cannot create %s\n", path);
+        exit(-1);
+    }
+    FILE* f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f);
+    fclose(f);
+
+    double times[reps];
+    for (int r = -1; r < reps; r++) {
+        memset(CPU->memory, 0, sizeof(CPU->memory));
+        int saved = Silence();
+        double t = Now();
+        int result = ReadObjectFile((char*)path, CPU);
+        double elapsed = Now() - t;
+        Unsilence(saved);
+        if (result != 0) {
+            printf("Error: Failed to read object file %s\n", path);
+            exit(-1);
+        }
+        if (r >= 0) {
+            times[r] = elapsed;
+        }
+    }
+    Stats s = Summarize(times, reps);
+    printf("ReadObjectFile  %ld bytes %9.1f MB/s %9.3f ms min %6.1f%%\n", bytes, bytes / s.median / 1e6, s.min * 1e3,
+           s.spread * 100);
+}
+
+/*
+ * Time WriteOut and TraceWriterLine on the same lines, to /dev/null.
+ */
+static void BenchWriteOut(int reps, FILE* null_output)
+{
+    const int lines = 200000;
+    double out_times[reps], writer_times[reps];
+    memset(CPU->memory, 0, sizeof(CPU->memory));
+    for (int i = 0; i < 256; i++) {
+        CPU->memory[CODE_START + i] = i * 0x0101;
+    }
+    for (int r = -1; r < reps; r++) {
+        double t = Now();
+        for (int i = 0; i < lines; i++) {
+            CPU->PC = CODE_START + (i & 0xFF);
+            CPU->regFile_WE = i & 1;
+            CPU->rdMux_CTL = i & 7;
+            CPU->regInputVal = i * 7;
+            CPU->NZP_WE = 1;
+            CPU->NZPVal = 1 << (i % 3);
+            WriteOut(CPU, null_output);
+        }
+        double mid = Now();
+        TraceWriterInit(TRACE, null_output, TRACE_TEXT, 0);
+        for (int i = 0; i < lines; i++) {
+            CPU->PC = CODE_START + (i & 0xFF);
+            CPU->regFile_WE = i & 1;
+            CPU->rdMux_CTL = i & 7;
+            CPU->regInputVal = i * 7;
+            CPU->NZP_WE = 1;
+            CPU->NZPVal = 1 << (i % 3);
+            TraceWriterLine(TRACE, CPU);
+        }
+        TraceWriterClose(TRACE);
+        if (r >= 0) {
+            out_times[r] = mid - t;
+            writer_times[r] = Now() - mid;
+        }
+    }
+    Stats s = Summarize(out_times, reps);
+    printf("WriteOut        %d lines %9.1f ns/line %9.3f ms min %6.1f%%\n", lines, s.median / lines * 1e9, s.min * 1e3,
+           s.spread * 100);
+    s = Summarize(writer_times, reps);
+    printf("TraceWriterLine %d lines %9.1f ns/line %9.3f ms min %6.1f%%\n", lines, s.median / lines * 1e9, s.min * 1e3,
+           s.spread * 100);
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    int reps = 5;              // -r: timed runs per measurement, after one warm-up
+    int scale = 1;             // -s: multiplies every workload's outer loop
+    int only_engine = -1;      // -e: one engine instead of all
+    const char* only_workload = NULL; // -w: one workload, or "load" / "writeout"
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            reps = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            scale = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-e") == 0 && arg + 1 < argc) {
+            for (only_engine = NUM_ENGINES - 1; only_engine >= 0; only_engine--) {
+                if (strcmp(engines[only_engine].name, argv[arg + 1]) == 0) {
+                    break;
+                }
+            }
+            if (only_engine < 0) {
+                printf("Error: unknown engine %s\n", argv[arg + 1]);
+                return -1;
+            }
+            arg += 2;
+        } else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc) {
+            only_workload = argv[arg + 1];
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (arg != argc || reps < 1 || scale < 1 || scale * 1000 > 0x7FFF) {
+        printf("usage: %s [-r reps] [-s scale (1-32)] [-e ref|decode|threaded|threaded-n|block|jit] [-w workload]\n", argv[0]);
+        return -1;
+    }
+
+    char path[64];
+    const char* dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/lc4bench.%d.obj", dir != NULL ? dir : "/tmp", (int)getpid());
+    FILE* null_output = fopen("/dev/null", "w");
+    if (null_output == NULL) {
+        printf("Error: Cannot open /dev/null\n");
+        return -1;
+    }
+
+    printf("%d runs each, median time\n", reps);
+    printf("%-8s %-11s %10s %9s %9s %9s %7s\n", "workload", "engine", "insns", "MIPS", "ns/insn", "min ms", "spread");
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        if (only_workload == NULL || strcmp(only_workload, workloads[i].name) == 0) {
+            BenchWorkload(&workloads[i], scale, reps, path, only_engine, null_output);
+        }
+    }
+    if (only_workload == NULL || strcmp(only_workload, "load") == 0) {
+        BenchLoader(reps, path);
+    }
+    if (only_workload == NULL || strcmp(only_workload, "writeout") == 0) {
+        BenchWriteOut(reps, null_output);
+    }
+    remove(path);
+    fclose(null_output);
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * bintrace.c: Packs trace lines into delta-compressed records and unpacks them
+ */
+
+#include "bintrace.h"
+#include <string.h>
+
+static const unsigned char nzp_code[5] = { 0, 1, 2, 0xFF, 3 }; // NZPVal -> 2-bit code
+static const unsigned char nzp_val[4] = { 0, 1, 2, 4 };       // 2-bit code -> NZPVal
+
+/*
+ * Forget all earlier records, e.g. before a new file.
+ */
+void BinTraceReset(BinTraceState* bt)
+{
+    bt->prev_pc = 0;
+    memset(bt->seen, 0, sizeof(bt->seen));
+}
+
+/*
+ * Fill in the BINTRACE_HEADER_SIZE bytes that start every binary trace.
+ */
+void BinTraceHeader(unsigned char* out)
+{
+    memcpy(out, BINTRACE_MAGIC, 4);
+    out[4] = BINTRACE_VERSION;
+    out[5] = out[6] = out[7] = 0;
+}
+
+/*
+ * Read and check the header, 0 if the file is a binary trace we understand.
+ */
+int BinTraceCheckHeader(FILE* input)
+{
+    unsigned char header[BINTRACE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), input) != sizeof(header)) {
+        return -1;
+    }
+    if (memcmp(header, BINTRACE_MAGIC, 4) != 0 || header[4] != BINTRACE_VERSION) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline unsigned char* Put16(unsigned char* p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    return p + 2;
+}
+
+static inline unsigned char* Put32(unsigned char* p, unsigned int v)
+{
+    p = Put16(p, v & 0xFFFF);
+    return Put16(p, v >> 16);
+}
+
+/*
+ * Encode the line WriteOut would print for this state into out.
+ * Returns the number of bytes written, at most BINTRACE_RECORD_MAX.
+ */
+int BinTraceEncode(BinTraceState* bt, MachineState* CPU, unsigned char* out)
+{
+    unsigned short pc = CPU->PC;
+    unsigned short instr = CPU->memory[pc];
+    unsigned int reg_val = CPU->regInputVal;
+    unsigned int dmem_addr = CPU->dmemAddr;
+    unsigned int dmem_val = CPU->dmemValue;
+    unsigned char* p = out + 1;
+    unsigned char flags = 0;
+
+    if ((unsigned int)CPU->regFile_WE > 1 || (unsigned int)CPU->NZP_WE > 1 ||
+        (unsigned int)CPU->DATA_WE > 1 || (unsigned int)CPU->rdMux_CTL > 7 ||
+        (unsigned int)CPU->NZPVal > 4 || nzp_code[CPU->NZPVal] == 0xFF ||
+        reg_val > 0xFFFF || dmem_addr > 0xFFFF || dmem_val > 0xFFFF) { // doesn't pack, store as is
+        out[0] = BT_RAW;
+        p = Put16(p, pc);
+        p = Put16(p, instr);
+        p = Put32(p, CPU->regFile_WE);
+        p = Put32(p, CPU->rdMux_CTL);
+        p = Put32(p, reg_val);
+        p = Put32(p, CPU->NZP_WE);
+        p = Put32(p, CPU->NZPVal);
+        p = Put32(p, CPU->DATA_WE);
+        p = Put32(p, dmem_addr);
+        p = Put32(p, dmem_val);
+        bt->prev_pc = pc;
+        bt->insn[pc] = instr;
+        bt->seen[pc >> 3] |= 1 << (pc & 7);
+        return p - out;
+    }
+
+    *p++ = CPU->regFile_WE | (CPU->NZP_WE << 1) | (CPU->DATA_WE << 2) |
+           (CPU->rdMux_CTL << 3) | (nzp_code[CPU->NZPVal] << 6);
+    if (pc == (unsigned short)(bt->prev_pc + 1)) {
+        flags |= BT_PCSEQ;
+    } else {
+        p = Put16(p, pc);
+    }
+    if (!(bt->seen[pc >> 3] & (1 << (pc & 7))) || bt->insn[pc] != instr) { // new or modified code
+        flags |= BT_INSN;
+        p = Put16(p, instr);
+        bt->insn[pc] = instr;
+        bt->seen[pc >> 3] |= 1 << (pc & 7);
+    }
+    if (reg_val != 0) {
+        flags |= BT_REGVAL;
+        p = Put16(p, reg_val);
+    }
+    if (dmem_addr != 0 || dmem_val != 0) {
+        flags |= BT_DMEM;
+        p = Put16(p, dmem_addr);
+        p = Put16(p, dmem_val);
+    }
+    out[0] = flags;
+    bt->prev_pc = pc;
+    return p - out;
+}
+
+static inline int Get16(FILE* input, unsigned int* v)
+{
+    int lo = getc(input);
+    int hi = getc(input);
+    if (lo == EOF || hi == EOF) {
+        return -1;
+    }
+    *v = lo | (hi << 8);
+    return 0;
+}
+
+static inline int Get32(FILE* input, unsigned int* v)
+{
+    unsigned int lo, hi;
+    if (Get16(input, &lo) != 0 || Get16(input, &hi) != 0) {
+        return -1;
+    }
+    *v = lo | (hi << 16);
+    return 0;
+}
+
+/*
+ * Read the next record and set PC, memory[PC] and the control signals in
+ * CPU so WriteOut would print the original line.
+ * Returns 1 for a record, 0 at the end of the file and -1 on a bad record.
+ */
+int BinTraceDecode(BinTraceState* bt, FILE* input, MachineState* CPU)
+{
+    int flags = getc(input);
+    unsigned int pc, instr, v[8];
+
+    if (flags == EOF) {
+        return 0;
+    }
+
+    if (flags & BT_RAW) {
+        if (Get16(input, &pc) != 0 || Get16(input, &instr) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < 8; i++) {
+            if (Get32(input, &v[i]) != 0) {
+                return -1;
+            }
+        }
+        CPU->regFile_WE = v[0];
+        CPU->rdMux_CTL = v[1];
+        CPU->regInputVal = v[2];
+        CPU->NZP_WE = v[3];
+        CPU->NZPVal = v[4];
+        CPU->DATA_WE = v[5];
+        CPU->dmemAddr = v[6];
+        CPU->dmemValue = v[7];
+    } else {
+        int sig = getc(input);
+        if (sig == EOF) {
+            return -1;
+        }
+        if (flags & BT_PCSEQ) {
+            pc = (unsigned short)(bt->prev_pc + 1);
+        } else if (Get16(input, &pc) != 0) {
+            return -1;
+        }
+        if (flags & BT_INSN) {
+            if (Get16(input, &instr) != 0) {
+                return -1;
+            }
+        } else if (bt->seen[pc >> 3] & (1 << (pc & 7))) {
+            instr = bt->insn[pc];
+        } else { // refers to code we were never told about
+            return -1;
+        }
+        v[0] = 0;
+        if ((flags & BT_REGVAL) && Get16(input, &v[0]) != 0) {
+            return -1;
+        }
+        v[1] = v[2] = 0;
+        if ((flags & BT_DMEM) && (Get16(input, &v[1]) != 0 || Get16(input, &v[2]) != 0)) {
+            return -1;
+        }
+        CPU->regFile_WE = sig & 1;
+        CPU->NZP_WE = (sig >> 1) & 1;
+        CPU->DATA_WE = (sig >> 2) & 1;
+        CPU->rdMux_CTL = (sig >> 3) & 7;
+        CPU->NZPVal = nzp_val[(sig >> 6) & 3];
+        CPU->regInputVal = v[0];
+        CPU->dmemAddr = v[1];
+        CPU->dmemValue = v[2];
+    }
+
+    CPU->PC = pc;
+    CPU->memory[pc] = instr;
+    bt->prev_pc = pc;
+    bt->insn[pc] = instr;
+    bt->seen[pc >> 3] |= 1 << (pc & 7);
+    return 1;
+}
@@ -0,0 +1,43 @@
+/*
+ * bintrace.h: Compact binary trace records and their conversion back to state
+ */
+
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include "LC4.h"
+#include <stdio.h>
+
+#define BINTRACE_MAGIC "LC4T"
+#define BINTRACE_VERSION 1
+#define BINTRACE_HEADER_SIZE 8 // magic, version, 3 reserved bytes
+#define BINTRACE_RECORD_MAX 40 // longest record, a raw one
+
+/*
+ * Record layout. The first byte holds the flags below. Unless BT_RAW is set,
+ * a signal byte follows: bits 0-2 regFile_WE/NZP_WE/DATA_WE, bits 3-5
+ * rdMux_CTL, bits 6-7 NZPVal as 0,1,2,4 -> 0-3. After that come only the
+ * optional little-endian words whose flags are set.
+ */
+#define BT_PCSEQ  0x01 // PC is the previous record's PC + 1, else 2 bytes
+#define BT_INSN   0x02 // instruction word follows, else it's the last one seen at this PC
+#define BT_REGVAL 0x04 // regInputVal follows, else 0
+#define BT_DMEM   0x08 // dmemAddr and dmemValue follow, else 0
+#define BT_RAW    0x80 // signal outside the packed ranges: PC, insn, then 8 4-byte fields
+
+/*
+ * What encoder and decoder both remember about earlier records.
+ */
+typedef struct {
+    unsigned short prev_pc;
+    unsigned short insn[65536];  // last instruction word recorded at each PC
+    unsigned char seen[65536 / 8]; // bit set once insn[PC] is valid
+} BinTraceState;
+
+void BinTraceReset(BinTraceState* bt);
+void BinTraceHeader(unsigned char* out);
+int BinTraceCheckHeader(FILE* input);
+int BinTraceEncode(BinTraceState* bt, MachineState* CPU, unsigned char* out);
+int BinTraceDecode(BinTraceState* bt, FILE* input, MachineState* CPU);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * block.c: Translates basic blocks once and runs them back to back without tracing
+ */
+
+#include "block.h"
+#include <string.h>
+
+static int EndsBlock(int form)
+{
+    switch (form) {
+        case FORM_BR: case FORM_BRA: case FORM_JSR: case FORM_JSRR:
+        case FORM_JMP: case FORM_JMPR: case FORM_RTI: case FORM_TRAP:
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Start over with no blocks.
+ */
+void BlockCacheInit(BlockCache* bc)
+{
+    memset(bc->map, 0, sizeof(bc->map));
+    memset(bc->covered, 0, sizeof(bc->covered));
+    memset(bc->dirty, 0, sizeof(bc->dirty));
+    bc->used = 0;
+    bc->translated = bc->invalidated = bc->flushes = 0;
+}
+
+/*
+ * Translate the block starting at pc, flushing everything if the pool is full.
+ */
+Block* BlockTranslate(BlockCache* bc, MachineState* CPU, unsigned short pc)
+{
+    if (bc->used == BLOCK_POOL) {
+        memset(bc->map, 0, sizeof(bc->map));
+        memset(bc->covered, 0, sizeof(bc->covered));
+        bc->used = 0;
+        bc->flushes++;
+    }
+    Block* b = &bc->pool[bc->used++];
+    b->start = pc;
+    b->length = 0;
+    b->next[0] = b->next[1] = NULL;
+
+    while (1) {
+        BlockOp* op = &b->ops[b->length++];
+        DecodeInstruction(CPU->memory[pc], &op->d);
+        op->pc = pc;
+        bc->covered[pc]++;
+        pc++;
+        if (EndsBlock(op->d.form) || pc == 0x80FF || b->length == BLOCK_MAX_OPS) {
+            break;
+        }
+    }
+    b->ops[b->length].d.form = FORM_UNDECODED; // fall-through marker
+    b->ops[b->length].pc = pc;
+
+    bc->map[b->start] = b;
+    bc->translated++;
+    return b;
+}
+
+/*
+ * A store hit translated code: drop every block containing address and any
+ * chain pointing at one of them. Rare, so a scan of the pool is fine.
+ */
+void BlockInvalidate(BlockCache* bc, unsigned short address)
+{
+    for (int i = 0; i < bc->used; i++) {
+        Block* b = &bc->pool[i];
+        if (b->length == 0 || (unsigned short)(address - b->start) >= b->length) {
+            continue;
+        }
+        for (int j = 0; j < b->length; j++) {
+            bc->covered[b->ops[j].pc]--;
+        }
+        if (bc->map[b->start] == b) {
+            bc->map[b->start] = NULL;
+        }
+        b->length = 0;
+        bc->invalidated++;
+    }
+    for (int i = 0; i < bc->used; i++) { // unchain from the dropped blocks
+        Block* b = &bc->pool[i];
+        for (int k = 0; k < 2; k++) {
+            if (b->next[k] != NULL && b->next[k]->length == 0) {
+                b->next[k] = NULL;
+            }
+        }
+    }
+}
+
+#define BLOCK_FN RunBlocks
+#define BLOCK_JIT 0
+#include "block_core.h"
+#undef BLOCK_FN
+#undef BLOCK_JIT
@@ -0,0 +1,45 @@
+/*
+ * block.h: Basic-block translation cache with chained blocks for no-trace runs
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "decode.h"
+#include "engine.h"
+
+#define BLOCK_MAX_OPS 64   // longest straight-line run translated into one block
+#define BLOCK_POOL 4096    // blocks held before the whole cache is flushed
+
+typedef struct {
+    DecodedInsn d;
+    unsigned short pc; // address the op was translated from
+} BlockOp;
+
+/*
+ * A translated basic block. It ends at a control transfer, right before
+ * 0x80FF or after BLOCK_MAX_OPS ops; a FORM_UNDECODED op after the last one
+ * means "fall through to start + length".
+ */
+typedef struct Block {
+    unsigned short start;
+    unsigned short length;     // 0 for a free or invalidated block
+    struct Block* next[2];     // chained successors, checked before the map
+    BlockOp ops[BLOCK_MAX_OPS + 1];
+} Block;
+
+typedef struct {
+    Block* map[65536];                 // block starting at each address, NULL if none
+    unsigned short covered[65536];     // number of live blocks containing each word
+    unsigned char dirty[NUM_PAGES];    // pages stored to, as in DecodeCache
+    Block pool[BLOCK_POOL];
+    int used;                          // pool entries handed out since the last flush
+    unsigned long translated, invalidated, flushes;
+} BlockCache;
+
+void BlockCacheInit(BlockCache* bc);
+Block* BlockTranslate(BlockCache* bc, MachineState* CPU, unsigned short pc);
+void BlockInvalidate(BlockCache* bc, unsigned short address);
+unsigned long RunBlocks(MachineState* CPU, BlockCache* bc, const RunLimit* limit);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * block_core.h: Body of the block engine, included once per variant. Before
+ * including, define:
+ *   BLOCK_FN   name of the function to generate
+ *   BLOCK_JIT  1 to take a JitCache and hand hot blocks to native code
+ *              (see jit.h), 0 to take a BlockCache and only interpret
+ */
+
+/*
+ * Run the program until PC reaches 0x80FF or limit stops it, a whole block
+ * at a time. Only PC, PSR, registers and memory are kept, as in RunThreadedNoTrace.
+ * Returns the number of instructions executed.
+ */
+#if BLOCK_JIT
+unsigned long BLOCK_FN(MachineState* CPU, JitCache* jit, const RunLimit* limit)
+#else
+unsigned long BLOCK_FN(MachineState* CPU, BlockCache* bc, const RunLimit* limit)
+#endif
+{
+    static void* const handlers[FORM_COUNT] = {
+        [FORM_UNDECODED] = &&fall_through,
+        [FORM_NOP] = &&op_nop,
+        [FORM_BR] = &&op_br,
+        [FORM_BRA] = &&op_bra,
+        [FORM_ADD] = &&op_add,
+        [FORM_MUL] = &&op_mul,
+        [FORM_SUB] = &&op_sub,
+        [FORM_DIV] = &&op_div,
+        [FORM_ZERO] = &&op_zero,
+        [FORM_CMP] = &&op_cmp,
+        [FORM_CMPU] = &&op_cmpu,
+        [FORM_CMPI] = &&op_cmpi,
+        [FORM_CMPIU] = &&op_cmpiu,
+        [FORM_JSR] = &&op_jsr,
+        [FORM_JSRR] = &&op_jsrr,
+        [FORM_AND] = &&op_and,
+        [FORM_NOT] = &&op_not,
+        [FORM_OR] = &&op_or,
+        [FORM_XOR] = &&op_xor,
+        [FORM_LDR] = &&op_ldr,
+        [FORM_STR] = &&op_str,
+        [FORM_RTI] = &&op_rti,
+        [FORM_CONST] = &&op_const,
+        [FORM_SLL] = &&op_sll,
+        [FORM_SRA] = &&op_sra,
+        [FORM_SRL] = &&op_srl,
+        [FORM_MOD] = &&op_mod,
+        [FORM_JMP] = &&op_jmp,
+        [FORM_JMPR] = &&op_jmpr,
+        [FORM_HICONST] = &&op_hiconst,
+        [FORM_TRAP] = &&op_trap,
+        [FORM_EXIT] = &&fall_through, // never translated
+    };
+    unsigned long count = 0;
+    Block* b;
+    Block* prev;
+    const BlockOp* op;
+    short return_val;
+    int nzp_last = NZP_SYNCED; // NZP is set lazily, see SyncNZP
+#if BLOCK_JIT
+    BlockCache* bc = jit->blocks;
+#endif
+
+#define NEXT_OP() do { op++; goto *handlers[op->d.form]; } while (0)
+#define END_BLOCK() do { count += op - b->ops + 1; goto block_end; } while (0)
+
+    // the first block runs without the exit check, as in UpdateMachineState
+    b = bc->map[CPU->PC];
+    if (b == NULL) {
+        b = BlockTranslate(bc, CPU, CPU->PC);
+    }
+
+run_block:
+    op = b->ops;
+    goto *handlers[op->d.form];
+
+fall_through:
+    CPU->PC = op->pc;
+    count += op - b->ops;
+    goto block_end;
+
+op_nop:
+    NEXT_OP();
+op_br:
+    SyncNZP(CPU, &nzp_last);
+    CPU->PC = ((CPU->PSR & op->d.rd) != 0) ? op->pc + 1 + op->d.imm : op->pc + 1;
+    END_BLOCK();
+op_bra:
+op_jmp:
+    CPU->PC = op->pc + 1 + op->d.imm;
+    END_BLOCK();
+
+// ALU ops writing Rd
+op_add:
+    return_val = CPU->R[op->d.rs] + CPU->R[op->d.rt];
+    goto write_rd;
+op_mul:
+    return_val = CPU->R[op->d.rs] * CPU->R[op->d.rt];
+    goto write_rd;
+op_sub:
+    return_val = CPU->R[op->d.rs] - CPU->R[op->d.rt];
+    goto write_rd;
+op_div:
+    return_val = (CPU->R[op->d.rt] != 0) ? CPU->R[op->d.rs] / CPU->R[op->d.rt] : 0;
+    goto write_rd;
+op_zero:
+    return_val = 0;
+    goto write_rd;
+op_and:
+    return_val = CPU->R[op->d.rs] & CPU->R[op->d.rt];
+    goto write_rd;
+op_not:
+    return_val = ~CPU->R[op->d.rs];
+    goto write_rd;
+op_or:
+    return_val = CPU->R[op->d.rs] | CPU->R[op->d.rt];
+    goto write_rd;
+op_xor:
+    return_val = CPU->R[op->d.rs] ^ CPU->R[op->d.rt];
+    goto write_rd;
+op_sll:
+    return_val = CPU->R[op->d.rs] << op->d.imm;
+    goto write_rd;
+op_sra:
+    return_val = CPU->R[op->d.rs] >> op->d.imm;
+    goto write_rd;
+op_srl:
+    return_val = (short)((unsigned short)CPU->R[op->d.rs] >> op->d.imm);
+    goto write_rd;
+op_mod:
+    return_val = (CPU->R[op->d.rt] != 0) ? CPU->R[op->d.rs] % CPU->R[op->d.rt] : 0;
+write_rd:
+    CPU->R[op->d.rd] = return_val;
+    nzp_last = return_val;
+    NEXT_OP();
+
+// compares only set NZP
+op_cmp:
+    return_val = CPU->R[op->d.rs] - CPU->R[op->d.rt];
+    goto write_nzp;
+op_cmpi:
+    return_val = CPU->R[op->d.rs] - op->d.imm;
+    goto write_nzp;
+op_cmpu:
+    return_val = (unsigned short)CPU->R[op->d.rs] - (unsigned short)CPU->R[op->d.rt];
+    goto write_nzp;
+op_cmpiu:
+    return_val = (unsigned short)CPU->R[op->d.rs] - (unsigned short)op->d.imm;
+write_nzp:
+    nzp_last = return_val;
+    NEXT_OP();
+
+op_jsr:
+op_jsrr:
+    CPU->R[7] = op->pc + 1;
+    nzp_last = (short)CPU->R[7];
+    if (op->d.form == FORM_JSR) {
+        CPU->PC = op->pc + 1 + op->d.imm;
+    } else {
+        CPU->PC = CPU->R[op->d.rs] + op->d.imm; // reads R7 after the link write, like JSROp
+    }
+    END_BLOCK();
+op_ldr:
+    CPU->R[op->d.rd] = CPU->memory[(unsigned short)(CPU->R[op->d.rs] + op->d.imm)];
+    nzp_last = (short)CPU->R[op->d.rd];
+    NEXT_OP();
+op_str:
+{
+    unsigned short addr = CPU->R[op->d.rs] + op->d.imm;
+    CPU->memory[addr] = CPU->R[op->d.rd];
+    bc->dirty[addr >> PAGE_SHIFT] = 1;
+    if (bc->covered[addr] != 0) { // wrote into translated code, this block may be stale too
+        BlockInvalidate(bc, addr);
+#if BLOCK_JIT
+        JitInvalidate(jit, addr);
+#endif
+        CPU->PC = op->pc + 1;
+        END_BLOCK();
+    }
+    NEXT_OP();
+}
+op_rti:
+    nzp_last = NZP_SYNCED; // the whole PSR is overwritten
+    CPU->PSR = 0;
+    CPU->PC = CPU->R[7];
+    END_BLOCK();
+op_const:
+    CPU->R[op->d.rd] = op->d.imm;
+    nzp_last = (short)CPU->R[op->d.rd];
+    NEXT_OP();
+op_jmpr:
+    CPU->PC = CPU->R[op->d.rs] + op->d.imm;
+    END_BLOCK();
+op_hiconst:
+    CPU->R[op->d.rd] = (CPU->R[op->d.rd] & 0x00FF) | (op->d.imm << 8); // keep low 8 bits, set high 8 bits
+    nzp_last = (short)CPU->R[op->d.rd];
+    NEXT_OP();
+op_trap:
+    if (limit != NULL && limit->traps != NULL && limit->traps->service[op->d.imm] != NULL) { // TRAP through RTI on the host
+        TrapTable* traps = limit->traps;
+        nzp_last = NZP_SYNCED; // RTI overwrites the whole PSR
+        TrapCall(traps, CPU, op->pc, op->d.imm);
+        if (traps->wrote) { // the service stored to memory, maybe into translated code
+            for (int page = 0; page < NUM_PAGES; page++) {
+                if (!traps->dirty[page]) {
+                    continue;
+                }
+                traps->dirty[page] = 0;
+                bc->dirty[page] = 1;
+                for (int a = page << PAGE_SHIFT; a < (page + 1) << PAGE_SHIFT; a++) {
+                    if (bc->covered[a] != 0) {
+                        BlockInvalidate(bc, a);
+#if BLOCK_JIT
+                        JitInvalidate(jit, a);
+#endif
+                    }
+                }
+            }
+            traps->wrote = 0;
+        }
+        END_BLOCK();
+    }
+    CPU->PSR = 1; // enter OS mode
+    CPU->R[7] = op->pc + 1;
+    nzp_last = (short)CPU->R[7];
+    CPU->PC = 0x8000 | op->d.imm; // jump to trap vector
+    END_BLOCK();
+
+block_end:
+    if (CPU->PC == 0x80FF || LimitReached(limit, count)) { // blocks never run into 0x80FF, so only their exits are checked
+        SyncNZP(CPU, &nzp_last);
+        return count;
+    }
+#if BLOCK_JIT
+    // hot code runs natively until it leaves compiled code, then the blocks take over again
+    while (jit->native[CPU->PC] != NULL || (++jit->hits[CPU->PC] == JIT_HOT && JitCompile(jit, CPU->PC))) {
+        SyncNZP(CPU, &nzp_last);
+        if (!JitRun(jit, CPU, limit, &count)) {
+            break;
+        }
+        if (CPU->PC == 0x80FF || LimitReached(limit, count)) {
+            return count;
+        }
+        b = NULL; // nothing to chain from
+    }
+    prev = (b != NULL && b->length != 0) ? b : NULL;
+#else
+    prev = (b->length != 0) ? b : NULL; // a block that just invalidated itself can't chain
+#endif
+    if (prev != NULL && prev->next[0] != NULL && prev->next[0]->start == CPU->PC) {
+        b = prev->next[0];
+        goto run_block;
+    }
+    if (prev != NULL && prev->next[1] != NULL && prev->next[1]->start == CPU->PC) {
+        b = prev->next[1];
+        goto run_block;
+    }
+    b = bc->map[CPU->PC];
+    if (b == NULL) {
+        unsigned long flushes = bc->flushes;
+        b = BlockTranslate(bc, CPU, CPU->PC);
+        if (bc->flushes != flushes) { // prev went away with the flush
+            prev = NULL;
+        }
+    }
+    if (prev != NULL) { // chain it for next time, keeping the first successor
+        prev->next[prev->next[0] == NULL ? 0 : 1] = b;
+    }
+    goto run_block;
+
+#undef NEXT_OP
+#undef END_BLOCK
+}
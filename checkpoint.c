@@ -0,0 +1,231 @@
+/*
+ * checkpoint.c: Writes and reads checkpoint files
+ */
+
+#include "checkpoint.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * File layout, all little-endian: magic, version, the trace format + 1 and
+ * 2 reserved bytes; count and trace_offset as 8 bytes each; PC, PSR and R[]
+ * as 2 bytes each; the control signals as 4 bytes each; the number of
+ * memory extents, then each extent as start address, length - 1 and its
+ * words; last an FNV-1a checksum of everything before it. Memory not in an
+ * extent is zero.
+ */
+#define CHECKPOINT_HEADER_SIZE 8
+#define CHECKPOINT_GAP 2 // zero words kept inside an extent, cheaper than a new extent
+#define CHECKPOINT_MAX_SIZE (128 + 65536 * 2 + 32768 * 4) // fixed fields, every word, most extents possible
+
+static inline unsigned char* Put16(unsigned char* p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    return p + 2;
+}
+
+static inline unsigned char* Put32(unsigned char* p, unsigned int v)
+{
+    p = Put16(p, v & 0xFFFF);
+    return Put16(p, v >> 16);
+}
+
+static inline unsigned int Get16(const unsigned char** p)
+{
+    unsigned int v = (*p)[0] | ((*p)[1] << 8);
+    *p += 2;
+    return v;
+}
+
+static inline unsigned int Get32(const unsigned char** p)
+{
+    unsigned int lo = Get16(p);
+    return lo | (Get16(p) << 16);
+}
+
+static unsigned int Checksum(const unsigned char* data, size_t len)
+{
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Find the first extent at or after *addr: a stretch of memory starting and
+ * ending with a non-zero word, with no more than CHECKPOINT_GAP zeros in a
+ * row inside it. Sets *addr to its start and returns its length, or 0 if
+ * the rest of memory is zero.
+ */
+static int NextExtent(const unsigned short* memory, int* addr)
+{
+    int start = *addr;
+    while (start < 65536 && memory[start] == 0) {
+        start++;
+    }
+    if (start == 65536) {
+        return 0;
+    }
+    int last = start; // last non-zero word seen
+    for (int i = start + 1; i < 65536 && i - last <= CHECKPOINT_GAP + 1; i++) {
+        if (memory[i] != 0) {
+            last = i;
+        }
+    }
+    *addr = start;
+    return last + 1 - start;
+}
+
+/*
+ * Save CPU and info to path. Only the non-zero parts of memory are written,
+ * so a typical checkpoint is a few KB and takes well under a millisecond.
+ * The file is written under a temporary name and renamed over path, so a
+ * run killed while saving leaves the previous checkpoint intact.
+ * Returns 0, or -1 if the file can't be written.
+ */
+int CheckpointSave(const char* path, MachineState* CPU, const CheckpointInfo* info)
+{
+    unsigned char* buf = malloc(CHECKPOINT_MAX_SIZE);
+    char* tmp_path = malloc(strlen(path) + 5);
+    if (buf == NULL || tmp_path == NULL) {
+        free(buf);
+        free(tmp_path);
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+
+    unsigned char* p = buf;
+    memcpy(p, CHECKPOINT_MAGIC, 4);
+    p[4] = CHECKPOINT_VERSION;
+    p[5] = info->trace_format + 1;
+    p[6] = p[7] = 0;
+    p += CHECKPOINT_HEADER_SIZE;
+    p = Put32(p, info->count & 0xFFFFFFFF);
+    p = Put32(p, (unsigned long long)info->count >> 32);
+    p = Put32(p, info->trace_offset & 0xFFFFFFFF);
+    p = Put32(p, (unsigned long long)info->trace_offset >> 32);
+    p = Put16(p, CPU->PC);
+    p = Put16(p, CPU->PSR);
+    for (int i = 0; i < 8; i++) {
+        p = Put16(p, CPU->R[i]);
+    }
+    p = Put32(p, CPU->rsMux_CTL);
+    p = Put32(p, CPU->rtMux_CTL);
+    p = Put32(p, CPU->rdMux_CTL);
+    p = Put32(p, CPU->regFile_WE);
+    p = Put32(p, CPU->NZP_WE);
+    p = Put32(p, CPU->DATA_WE);
+    p = Put32(p, CPU->regInputVal);
+    p = Put32(p, CPU->NZPVal);
+    p = Put32(p, CPU->dmemAddr);
+    p = Put32(p, CPU->dmemValue);
+
+    unsigned char* num_extents = p; // filled in once they're counted
+    unsigned int extents = 0;
+    p += 4;
+    int addr = 0;
+    int len;
+    while ((len = NextExtent(CPU->memory, &addr)) > 0) {
+        p = Put16(p, addr);
+        p = Put16(p, len - 1);
+        for (int i = 0; i < len; i++) {
+            p = Put16(p, CPU->memory[addr + i]);
+        }
+        addr += len;
+        extents++;
+    }
+    Put32(num_extents, extents);
+    p = Put32(p, Checksum(buf, p - buf));
+
+    int result = -1;
+    FILE* output = fopen(tmp_path, "wb");
+    if (output != NULL) {
+        size_t written = fwrite(buf, 1, p - buf, output);
+        if (fclose(output) == 0 && written == (size_t)(p - buf) && rename(tmp_path, path) == 0) {
+            result = 0;
+        } else {
+            remove(tmp_path);
+        }
+    }
+    free(buf);
+    free(tmp_path);
+    return result;
+}
+
+/*
+ * Load a checkpoint written by CheckpointSave into CPU and info. All of
+ * memory is replaced. Returns 0, or -1 if the file can't be read or is
+ * truncated, corrupt or from another version, in which case CPU may be
+ * partly overwritten.
+ */
+int CheckpointLoad(const char* path, MachineState* CPU, CheckpointInfo* info)
+{
+    FILE* input = fopen(path, "rb");
+    if (input == NULL) {
+        return -1;
+    }
+    unsigned char* buf = malloc(CHECKPOINT_MAX_SIZE + 1);
+    if (buf == NULL) {
+        fclose(input);
+        return -1;
+    }
+    size_t size = fread(buf, 1, CHECKPOINT_MAX_SIZE + 1, input);
+    fclose(input);
+
+    const unsigned char* p = buf + CHECKPOINT_HEADER_SIZE;
+    const unsigned char* end = buf + size - 4; // checksum
+    const size_t fixed = CHECKPOINT_HEADER_SIZE + 16 + 20 + 40 + 4;
+    if (size < fixed + 4 || size > CHECKPOINT_MAX_SIZE ||
+        memcmp(buf, CHECKPOINT_MAGIC, 4) != 0 || buf[4] != CHECKPOINT_VERSION) {
+        free(buf);
+        return -1;
+    }
+    const unsigned char* sum = end;
+    if (Get32(&sum) != Checksum(buf, end - buf)) {
+        free(buf);
+        return -1;
+    }
+
+    info->trace_format = (int)buf[5] - 1;
+    unsigned long long lo = Get32(&p);
+    info->count = lo | ((unsigned long long)Get32(&p) << 32);
+    lo = Get32(&p);
+    info->trace_offset = lo | ((unsigned long long)Get32(&p) << 32);
+    CPU->PC = Get16(&p);
+    CPU->PSR = Get16(&p);
+    for (int i = 0; i < 8; i++) {
+        CPU->R[i] = Get16(&p);
+    }
+    CPU->rsMux_CTL = Get32(&p);
+    CPU->rtMux_CTL = Get32(&p);
+    CPU->rdMux_CTL = Get32(&p);
+    CPU->regFile_WE = Get32(&p);
+    CPU->NZP_WE = Get32(&p);
+    CPU->DATA_WE = Get32(&p);
+    CPU->regInputVal = Get32(&p);
+    CPU->NZPVal = Get32(&p);
+    CPU->dmemAddr = Get32(&p);
+    CPU->dmemValue = Get32(&p);
+
+    memset(CPU->memory, 0, sizeof(CPU->memory));
+    unsigned int extents = Get32(&p);
+    for (unsigned int e = 0; e < extents; e++) {
+        if (end - p < 4) {
+            free(buf);
+            return -1;
+        }
+        unsigned int addr = Get16(&p);
+        unsigned int len = Get16(&p) + 1;
+        if (addr + len > 65536 || (size_t)(end - p) < len * 2) {
+            free(buf);
+            return -1;
+        }
+        for (unsigned int i = 0; i < len; i++) {
+            CPU->memory[addr + i] = Get16(&p);
+        }
+    }
+    free(buf);
+    return p == end ? 0 : -1;
+}
@@ -0,0 +1,26 @@
+/*
+ * checkpoint.h: Saves a running machine to a compact file and loads it back to resume
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "LC4.h"
+
+#define CHECKPOINT_MAGIC "LC4K"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_NO_TRACE -1 // trace_format of a run without a trace
+
+/*
+ * Where the run was when the checkpoint was taken, besides the machine.
+ */
+typedef struct {
+    unsigned long count; // instructions executed so far
+    int trace_format;    // TRACE_TEXT, TRACE_BINARY or CHECKPOINT_NO_TRACE
+    long trace_offset;   // bytes of trace written so far, the next line goes here
+} CheckpointInfo;
+
+int CheckpointSave(const char* path, MachineState* CPU, const CheckpointInfo* info);
+int CheckpointLoad(const char* path, MachineState* CPU, CheckpointInfo* info);
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ * cosim.c: main() for running a candidate engine against the reference one and fuzzing them
+ */
+
+#include "loader.h"
+#include "engine.h"
+#include "jit.h"
+#include "disasm.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// engines that can be checked, picked with -e
+enum {
+    CAND_DECODE = 0, // UpdateMachineStateDecoded, compared after every instruction
+    CAND_THREADED,   // RunThreaded with a trace, compared at checkpoints
+    CAND_THREADED_N, // RunThreadedNoTrace
+    CAND_BLOCK,      // RunBlocks
+    CAND_JIT         // RunJit
+};
+static const char* candidate_names[] = { "decode", "threaded", "threaded-n", "block", "jit" };
+
+#define PATH_LEN 16 // oracle PCs remembered for the report
+
+MachineState ORACLE_STATE;    // runs UpdateMachineState, or the decoded engine with -o decode
+MachineState* ORACLE = &ORACLE_STATE;
+MachineState CANDIDATE_STATE;
+MachineState* CANDIDATE = &CANDIDATE_STATE;
+MachineState GOOD_STATE;      // both machines at the last checkpoint where they agreed
+DecodeCache ORACLE_CACHE;
+DecodeCache CANDIDATE_CACHE;
+TraceWriter TRACE_WRITER;     // thrown-away trace of the threaded candidate
+BlockCache* BLOCKS;
+JitCache* JIT;                // over BLOCKS
+
+int candidate = CAND_THREADED_N;
+int oracle_decoded = 0;           // -o decode
+unsigned long chunk = 1000;       // -k: instructions between checkpoints
+int radius = 6;                   // -w: words shown each side of a divergence
+FILE* null_output;
+FILE* report;                     // the real stdout; the engines' own messages go to /dev/null
+unsigned char oracle_written[NUM_PAGES]; // pages the oracle stored to since the last checkpoint
+unsigned short path[PATH_LEN];    // last PCs the oracle executed
+unsigned long path_len;
+
+/*
+ * One oracle instruction. Returns 1 once it reaches 0x80FF.
+ */
+static int OracleStep(void)
+{
+    path[path_len++ % PATH_LEN] = ORACLE->PC;
+    int done = oracle_decoded ? UpdateMachineStateDecoded(ORACLE, &ORACLE_CACHE, NULL)
+                              : UpdateMachineState(ORACLE, null_output);
+    if (ORACLE->DATA_WE) {
+        oracle_written[ORACLE->dmemAddr >> PAGE_SHIFT] = 1;
+    }
+    return done;
+}
+
+/*
+ * Run the candidate for about max_insns instructions; the checkpointed
+ * engines stop at the first control transfer past it. Returns the number
+ * executed.
+ */
+static unsigned long CandidateRun(unsigned long max_insns)
+{
+    RunLimit limit = { .max_insns = max_insns };
+    switch (candidate) {
+        case CAND_THREADED:
+            return RunThreaded(CANDIDATE, &CANDIDATE_CACHE, &TRACE_WRITER, &limit);
+        case CAND_THREADED_N:
+            return RunThreadedNoTrace(CANDIDATE, &CANDIDATE_CACHE, NULL, &limit);
+        case CAND_BLOCK:
+            return RunBlocks(CANDIDATE, BLOCKS, &limit);
+        case CAND_JIT:
+            return RunJit(CANDIDATE, JIT, &limit);
+        default:
+            UpdateMachineStateDecoded(CANDIDATE, &CANDIDATE_CACHE, NULL);
+            return 1;
+    }
+}
+
+static unsigned char* CandidateDirty(void)
+{
+    return candidate >= CAND_BLOCK ? BLOCKS->dirty : CANDIDATE_CACHE.dirty;
+}
+
+/*
+ * Put both machines in the same state and forget everything cached about
+ * the old one.
+ */
+static void StartFrom(MachineState* state)
+{
+    memcpy(ORACLE, state, sizeof(MachineState));
+    memcpy(CANDIDATE, state, sizeof(MachineState));
+    ClearDecodeCache(&ORACLE_CACHE);
+    ClearDecodeCache(&CANDIDATE_CACHE);
+    BlockCacheInit(BLOCKS);
+    JitCacheClear(JIT);
+    memset(oracle_written, 0, sizeof(oracle_written));
+    path_len = 0;
+}
+
+/*
+ * Compare the machines: PC, PSR, registers and every page either one
+ * stored to since the last checkpoint. With signals set the traced control
+ * signals are compared too, for engines that produce them. Prints each
+ * difference when out isn't NULL. Returns the number of differences.
+ */
+static int Compare(int signals, FILE* out)
+{
+    int diffs = 0;
+#define FIELD(name, a, b) \
+    if ((a) != (b)) { \
+        diffs++; \
+        if (out != NULL) { \
+            fprintf(out, "  %-11s oracle %04X candidate %04X\n", name, (unsigned)(unsigned short)(a), (unsigned)(unsigned short)(b)); \
+        } \
+    }
+    FIELD("PC", ORACLE->PC, CANDIDATE->PC);
+    FIELD("PSR", ORACLE->PSR, CANDIDATE->PSR);
+    for (int i = 0; i < 8; i++) {
+        char name[4] = { 'R', '0' + i, 0 };
+        FIELD(name, ORACLE->R[i], CANDIDATE->R[i]);
+    }
+    if (signals) {
+        FIELD("regFile_WE", ORACLE->regFile_WE, CANDIDATE->regFile_WE);
+        FIELD("rdMux_CTL", ORACLE->rdMux_CTL, CANDIDATE->rdMux_CTL);
+        FIELD("regInputVal", ORACLE->regInputVal, CANDIDATE->regInputVal);
+        FIELD("NZP_WE", ORACLE->NZP_WE, CANDIDATE->NZP_WE);
+        FIELD("NZPVal", ORACLE->NZPVal, CANDIDATE->NZPVal);
+        FIELD("DATA_WE", ORACLE->DATA_WE, CANDIDATE->DATA_WE);
+        FIELD("dmemAddr", ORACLE->dmemAddr, CANDIDATE->dmemAddr);
+        FIELD("dmemValue", ORACLE->dmemValue, CANDIDATE->dmemValue);
+    }
+#undef FIELD
+    unsigned char* dirty = CandidateDirty();
+    for (int page = 0; page < NUM_PAGES; page++) {
+        int first = page << PAGE_SHIFT;
+        if (!(oracle_written[page] || dirty[page]) ||
+            memcmp(&ORACLE->memory[first], &CANDIDATE->memory[first], PAGE_WORDS * sizeof(ORACLE->memory[0])) == 0) {
+            continue;
+        }
+        for (int a = first; a < first + PAGE_WORDS; a++) {
+            if (ORACLE->memory[a] != CANDIDATE->memory[a]) {
+                diffs++;
+                if (out != NULL) {
+                    fprintf(out, "  memory %04X oracle %04X candidate %04X\n", a, ORACLE->memory[a], CANDIDATE->memory[a]);
+                }
+            }
+        }
+    }
+    return diffs;
+}
+
+static void ClearWriteSets(void)
+{
+    memset(oracle_written, 0, sizeof(oracle_written));
+    memset(CandidateDirty(), 0, NUM_PAGES);
+}
+
+/*
+ * Print where the machines went apart: the instructions involved, what
+ * differs, the oracle's recent path and the code around the stretch.
+ */
+static void Report(unsigned long first, unsigned long last, unsigned short start_pc)
+{
+    if (first + 1 == last) {
+        fprintf(report, "divergence at instruction %lu, PC %04X\n", first, start_pc);
+    } else {
+        fprintf(report, "divergence in instructions %lu-%lu, straight-line stretch from PC %04X\n", first, last - 1, start_pc);
+    }
+    Compare(candidate == CAND_DECODE, report);
+    fprintf(report, "oracle path:");
+    for (unsigned long i = path_len > PATH_LEN ? path_len - PATH_LEN : 0; i < path_len; i++) {
+        fprintf(report, " %04X", path[i % PATH_LEN]);
+    }
+    fprintf(report, "\n");
+    DisassembleWindow(ORACLE, start_pc, radius, report);
+    if ((unsigned short)(ORACLE->PC - start_pc + radius) > 2 * radius) { // ended up elsewhere
+        fprintf(report, "oracle stopped at:\n");
+        DisassembleWindow(ORACLE, ORACLE->PC, radius, report);
+    }
+}
+
+/*
+ * Rerun from the last good checkpoint one straight-line stretch (or one
+ * instruction) at a time until the machines disagree, and report it.
+ */
+static void Narrow(unsigned long count)
+{
+    StartFrom(&GOOD_STATE);
+    while (1) {
+        unsigned short start_pc = ORACLE->PC;
+        unsigned long n = CandidateRun(1);
+        int oracle_done = 0;
+        for (unsigned long i = 0; i < n && !oracle_done; i++) {
+            oracle_done = OracleStep();
+        }
+        if (Compare(candidate == CAND_DECODE, NULL) != 0 || (oracle_done && ORACLE->PC != CANDIDATE->PC)) {
+            Report(count, count + n, start_pc);
+            return;
+        }
+        count += n;
+        ClearWriteSets();
+        if (ORACLE->PC == 0x80FF) { // ran past where the checkpoints disagreed, shouldn't happen
+            fprintf(report, "divergence did not reproduce from instruction %lu\n", count);
+            return;
+        }
+    }
+}
+
+/*
+ * Co-simulate from state until the program exits or max_insns (0 for no
+ * limit) have run. Returns the instructions executed, or 0 on divergence
+ * after reporting it.
+ */
+static unsigned long Cosim(MachineState* state, unsigned long max_insns)
+{
+    unsigned long count = 0;
+    StartFrom(state);
+    while (1) {
+        unsigned long want = chunk;
+        if (max_insns != 0 && max_insns - count < want) {
+            want = max_insns - count;
+        }
+        memcpy(&GOOD_STATE, ORACLE, sizeof(MachineState));
+        unsigned long n = candidate == CAND_DECODE ? 1 : CandidateRun(want);
+        if (candidate == CAND_DECODE) {
+            CandidateRun(1);
+        }
+        int oracle_done = 0;
+        unsigned long i;
+        for (i = 0; i < n && !oracle_done; i++) {
+            oracle_done = OracleStep();
+        }
+        if (i < n || Compare(candidate == CAND_DECODE, NULL) != 0) {
+            if (candidate == CAND_DECODE) {
+                Report(count, count + 1, GOOD_STATE.PC);
+            } else {
+                Narrow(count);
+            }
+            return 0;
+        }
+        count += n;
+        ClearWriteSets();
+        if (ORACLE->PC == 0x80FF || (max_insns != 0 && count >= max_insns)) {
+            return count;
+        }
+    }
+}
+
+static unsigned int Random(unsigned int* state)
+{
+    unsigned int x = *state; // xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * Fill state with a random program for seed: random registers and data at
+ * 0x4000, code at 0x8200 biased towards instructions that stay near it,
+ * with a share of completely random words for the odd encodings. The rest
+ * of memory is TRAP xFF so wild jumps end the run instead of sliding
+ * through 64K words of NOPs. R5, R6 and R7 start out pointing at code,
+ * data and code, so stores can hit code and returns land in it.
+ */
+static void Generate(unsigned int seed, MachineState* state)
+{
+    unsigned int r = seed * 2654435761u + 1;
+    int len = 32 + Random(&r) % 224;
+    for (int a = 0; a < 65536; a++) {
+        state->memory[a] = 0xF0FF;
+    }
+    Reset(state);
+    for (int i = 0; i < 8; i++) {
+        state->R[i] = Random(&r);
+    }
+    state->R[5] = 0x8200 + Random(&r) % len;
+    state->R[6] = 0x4000 + Random(&r) % 192;
+    state->R[7] = 0x8200 + Random(&r) % len;
+    for (int a = 0x4000; a < 0x4100; a++) {
+        state->memory[a] = Random(&r);
+    }
+    for (int a = 0x8200; a < 0x8200 + len; a++) {
+        unsigned int x = Random(&r);
+        unsigned short low = x >> 8;      // operand bits
+        int reg = (x >> 20) & 7;
+        int offset = (int)((x >> 23) % 17) - 8; // short PC-relative hops
+        unsigned short word;
+        switch (x & 15) {
+            case 0:
+                word = x >> 12; // anything at all
+                break;
+            case 1:
+            case 2:
+                word = (1 << 12) | (low & 0xFFF); // ARTH, any sub-op
+                break;
+            case 3:
+                word = (5 << 12) | (low & 0xFFF); // LOG
+                break;
+            case 4:
+                word = (10 << 12) | (low & 0xFFF); // shifts and MOD
+                break;
+            case 5:
+                word = (2 << 12) | (low & 0xFFF); // compares
+                break;
+            case 6:
+                word = ((x & 16) ? 9 : 13) << 12 | (low & 0xFFF); // CONST or HICONST
+                break;
+            case 7:
+                word = (6 << 12) | (reg << 9) | (6 << 6) | (low & 0x3F); // LDR from data
+                break;
+            case 8:
+                word = (7 << 12) | (reg << 9) | (((x & 16) ? 5 : 6) << 6) | (low & 0x3F); // STR to data or code
+                break;
+            case 9:
+            case 10:
+                word = ((low & 7) << 9) | (offset & 0x1FF); // BR
+                break;
+            case 11:
+                word = (4 << 12) | (offset & 0x7FF); // JSR
+                break;
+            case 12:
+                word = (x & 16) ? ((12 << 12) | (1 << 11) | (7 << 6)) : ((4 << 12) | (1 << 11) | (5 << 6)); // JMPR R7, JSRR R5
+                break;
+            case 13:
+                word = (x & 16) ? (8 << 12) : ((12 << 12) | (offset & 0x7FF)); // RTI or JMP
+                break;
+            case 14:
+                word = (x & 0x30) == 0 ? ((15 << 12) | (low & 0xFF)) : ((1 << 12) | (low & 0xFC7)); // rare TRAP, else ADD/MUL
+                break;
+            default:
+                word = (9 << 12) | (reg << 9) | (offset & 0x1FF); // small CONST
+                break;
+        }
+        state->memory[a] = word;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    unsigned long max_insns = 0; // -l: stop each run after this many instructions
+    unsigned long cases = 0;     // -f: fuzz this many random programs instead of loading obj files
+    unsigned int seed = 1;       // -s: seed of the first random program
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-e") == 0 && arg + 1 < argc) {
+            for (candidate = CAND_JIT; candidate >= 0; candidate--) {
+                if (strcmp(candidate_names[candidate], argv[arg + 1]) == 0) {
+                    break;
+                }
+            }
+            if (candidate < 0) {
+                printf("Error: unknown engine %s\n", argv[arg + 1]);
+                return -1;
+            }
+            arg += 2;
+        } else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            oracle_decoded = strcmp(argv[arg + 1], "decode") == 0;
+            if (!oracle_decoded && strcmp(argv[arg + 1], "ref") != 0) {
+                printf("Error: the oracle is ref or decode, not %s\n", argv[arg + 1]);
+                return -1;
+            }
+            arg += 2;
+        } else if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc) {
+            chunk = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+            max_insns = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc) {
+            radius = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-f") == 0 && arg + 1 < argc) {
+            cases = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            seed = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if ((cases == 0 && argc - arg < 1) || chunk == 0) {
+        printf("usage: %s [-e decode|threaded|threaded-n|block|jit] [-o ref|decode] [-k chunk] [-l max_insns] [-w radius] obj...\n", argv[0]);
+        printf("       %s -f cases [-s seed] [options]   fuzz with random programs\n", argv[0]);
+        return -1;
+    }
+
+    BLOCKS = malloc(sizeof(BlockCache));
+    JIT = malloc(sizeof(JitCache));
+    null_output = fopen("/dev/null", "w");
+    if (BLOCKS == NULL || JIT == NULL || null_output == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    JitCacheInit(JIT, BLOCKS);
+    fflush(stdout);
+    report = fdopen(dup(1), "w");
+    dup2(fileno(null_output), 1); // loader and engines print as they go
+    TraceWriterInit(&TRACE_WRITER, null_output, TRACE_TEXT, 0);
+
+    static MachineState start;
+    if (cases == 0) {
+        memset(start.memory, 0, sizeof(start.memory));
+        Reset(&start);
+        for (int i = arg; i < argc; i++) {
+            if (ReadObjectFile(argv[i], &start) != 0) {
+                fprintf(report, "Error: Failed to read object file %s\n", argv[i]);
+                return -1;
+            }
+        }
+        unsigned long count = Cosim(&start, max_insns);
+        if (count == 0) {
+            return 1;
+        }
+        fprintf(report, "%s matches the %s engine over %lu instructions\n", candidate_names[candidate],
+                oracle_decoded ? "decoded" : "reference", count);
+        return 0;
+    }
+
+    unsigned long total = 0;
+    for (unsigned long i = 0; i < cases; i++, seed++) {
+        Generate(seed, &start);
+        unsigned long count = Cosim(&start, max_insns != 0 ? max_insns : 10000);
+        if (count == 0) {
+            fprintf(report, "random program %u diverged, rerun with -f 1 -s %u\n", seed, seed);
+            return 1;
+        }
+        total += count;
+    }
+    fprintf(report, "%s matches the %s engine on %lu random programs, %lu instructions\n", candidate_names[candidate],
+            oracle_decoded ? "decoded" : "reference", cases, total);
+    return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * debuginfo.c: Builds and searches the address and name indexes of the debug info
+ */
+
+#include "debuginfo.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Start with an empty table.
+ */
+void DebugInfoInit(DebugInfo* di)
+{
+    memset(di, 0, sizeof(*di));
+}
+
+/*
+ * Release everything the table allocated and leave it empty.
+ */
+void DebugInfoFree(DebugInfo* di)
+{
+    free(di->symbols);
+    free(di->lines);
+    free(di->files);
+    free(di->strings);
+    free(di->name_hash);
+    DebugInfoInit(di);
+}
+
+/*
+ * Called before each object file: its line records count files from here.
+ */
+void DebugInfoBeginObject(DebugInfo* di)
+{
+    di->file_base = di->num_files;
+}
+
+/*
+ * Make room for one more element of size bytes in *array. Returns -1 if out of memory.
+ */
+static int Grow(void** array, int count, int* cap, size_t size)
+{
+    if (count < *cap) {
+        return 0;
+    }
+    int new_cap = *cap ? 2 * *cap : 64;
+    void* bigger = realloc(*array, new_cap * size);
+    if (bigger == NULL) {
+        return -1;
+    }
+    *array = bigger;
+    *cap = new_cap;
+    return 0;
+}
+
+/*
+ * Copy a length-counted name into the string pool, returning its offset or -1.
+ */
+static long AddString(DebugInfo* di, const char* name, unsigned int len)
+{
+    if (di->strings_len + len + 1 > di->strings_cap) {
+        unsigned int new_cap = di->strings_cap ? di->strings_cap : 1024;
+        while (di->strings_len + len + 1 > new_cap) {
+            new_cap *= 2;
+        }
+        char* bigger = realloc(di->strings, new_cap);
+        if (bigger == NULL) {
+            return -1;
+        }
+        di->strings = bigger;
+        di->strings_cap = new_cap;
+    }
+    unsigned int offset = di->strings_len;
+    memcpy(di->strings + offset, name, len);
+    di->strings[offset + len] = '\0';
+    di->strings_len += len + 1;
+    return offset;
+}
+
+int DebugInfoAddSymbol(DebugInfo* di, unsigned short address, const char* name, unsigned int len)
+{
+    long offset = AddString(di, name, len);
+    if (offset < 0 || Grow((void**)&di->symbols, di->num_symbols, &di->symbols_cap, sizeof(DebugSymbol)) != 0) {
+        return -1;
+    }
+    di->symbols[di->num_symbols].address = address;
+    di->symbols[di->num_symbols].name = offset;
+    di->num_symbols++;
+    return 0;
+}
+
+int DebugInfoAddFile(DebugInfo* di, const char* name, unsigned int len)
+{
+    long offset = AddString(di, name, len);
+    if (offset < 0 || Grow((void**)&di->files, di->num_files, &di->files_cap, sizeof(unsigned int)) != 0) {
+        return -1;
+    }
+    di->files[di->num_files++] = offset;
+    return 0;
+}
+
+int DebugInfoAddLine(DebugInfo* di, unsigned short address, unsigned short line, unsigned short file_index)
+{
+    if (Grow((void**)&di->lines, di->num_lines, &di->lines_cap, sizeof(DebugLine)) != 0) {
+        return -1;
+    }
+    di->lines[di->num_lines].address = address;
+    di->lines[di->num_lines].line = line;
+    di->lines[di->num_lines].file = di->file_base + file_index;
+    di->num_lines++;
+    return 0;
+}
+
+static int CompareSymbols(const void* a, const void* b)
+{
+    const DebugSymbol* x = a;
+    const DebugSymbol* y = b;
+    return (x->address != y->address) ? x->address - y->address : (int)x->name - (int)y->name;
+}
+
+static int CompareLines(const void* a, const void* b)
+{
+    const DebugLine* x = a;
+    const DebugLine* y = b;
+    return x->address - y->address;
+}
+
+/*
+ * FNV-1a over a NUL-terminated name.
+ */
+static unsigned int HashName(const char* name)
+{
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Sort the address indexes and build the name hash once loading is done.
+ * Returns -1 if out of memory.
+ */
+int DebugInfoFinish(DebugInfo* di)
+{
+    qsort(di->symbols, di->num_symbols, sizeof(DebugSymbol), CompareSymbols);
+    qsort(di->lines, di->num_lines, sizeof(DebugLine), CompareLines);
+
+    free(di->name_hash);
+    di->hash_size = 16;
+    while (di->hash_size < 2 * (unsigned int)di->num_symbols) { // keep it at most half full
+        di->hash_size *= 2;
+    }
+    di->name_hash = malloc(di->hash_size * sizeof(int));
+    if (di->name_hash == NULL) {
+        di->hash_size = 0;
+        return -1;
+    }
+    memset(di->name_hash, 0xFF, di->hash_size * sizeof(int)); // all -1
+    for (int i = 0; i < di->num_symbols; i++) {
+        unsigned int slot = HashName(di->strings + di->symbols[i].name) & (di->hash_size - 1);
+        while (di->name_hash[slot] >= 0) {
+            slot = (slot + 1) & (di->hash_size - 1);
+        }
+        di->name_hash[slot] = i;
+    }
+    return 0;
+}
+
+/*
+ * Name of the closest symbol at or below address, NULL if there is none.
+ * The distance from that symbol goes to *offset when offset isn't NULL.
+ */
+const char* DebugSymbolAt(DebugInfo* di, unsigned short address, unsigned short* offset)
+{
+    int lo = 0, hi = di->num_symbols - 1, found = -1;
+    while (lo <= hi) { // last symbol with symbol address <= address
+        int mid = (lo + hi) / 2;
+        if (di->symbols[mid].address <= address) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (found < 0) {
+        return NULL;
+    }
+    if (offset != NULL) {
+        *offset = address - di->symbols[found].address;
+    }
+    return di->strings + di->symbols[found].name;
+}
+
+/*
+ * Source file and line of the closest line record at or below address.
+ * Returns 0 when found, -1 otherwise.
+ */
+int DebugLineAt(DebugInfo* di, unsigned short address, const char** file, int* line)
+{
+    int lo = 0, hi = di->num_lines - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (di->lines[mid].address <= address) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (found < 0) {
+        return -1;
+    }
+    unsigned int f = di->lines[found].file;
+    *file = (f < (unsigned int)di->num_files) ? di->strings + di->files[f] : "?";
+    *line = di->lines[found].line;
+    return 0;
+}
+
+/*
+ * Address of the symbol called name. Returns 0 when found, -1 otherwise.
+ */
+int DebugLookupName(DebugInfo* di, const char* name, unsigned short* address)
+{
+    if (di->hash_size == 0) {
+        return -1;
+    }
+    unsigned int slot = HashName(name) & (di->hash_size - 1);
+    while (di->name_hash[slot] >= 0) {
+        DebugSymbol* sym = &di->symbols[di->name_hash[slot]];
+        if (strcmp(di->strings + sym->name, name) == 0) {
+            *address = sym->address;
+            return 0;
+        }
+        slot = (slot + 1) & (di->hash_size - 1);
+    }
+    return -1;
+}
+
+/*
+ * Address of the first symbol after address, for the extent of a
+ * subroutine. Returns 0 when there is one, -1 otherwise.
+ */
+int DebugNextSymbol(DebugInfo* di, unsigned short address, unsigned short* next)
+{
+    int lo = 0, hi = di->num_symbols;
+    while (lo < hi) { // first symbol with symbol address > address
+        int mid = (lo + hi) / 2;
+        if (di->symbols[mid].address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == di->num_symbols) {
+        return -1;
+    }
+    *next = di->symbols[lo].address;
+    return 0;
+}
+
+/*
+ * Parse an address from the command line: hex with an x or 0x in front,
+ * the name of a symbol, or bare hex. Symbols come before bare hex, so
+ * labels that read as hex (ADD, BEEF, a) name the label. Returns 0, or -1
+ * if it is none of these.
+ */
+int DebugParseAddress(DebugInfo* di, const char* text, unsigned short* address)
+{
+    const char* digits = text;
+    if (digits[0] == 'x' || digits[0] == 'X') {
+        digits++;
+    }
+    int prefixed = digits != text || (text[0] == '0' && (text[1] == 'x' || text[1] == 'X'));
+    char* end;
+    unsigned long value = strtoul(digits, &end, 16);
+    int hex = end != digits && *end == '\0' && value <= 0xFFFF;
+    if (hex && prefixed) {
+        *address = value;
+        return 0;
+    }
+    if (DebugLookupName(di, text, address) == 0) {
+        return 0;
+    }
+    if (hex) {
+        *address = value;
+        return 0;
+    }
+    return -1;
+}
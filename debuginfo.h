@@ -0,0 +1,55 @@
+/*
+ * debuginfo.h: Symbols, file names and line numbers kept from the object files
+ */
+
+#ifndef DEBUGINFO_H
+#define DEBUGINFO_H
+
+#include "LC4.h"
+
+typedef struct {
+    unsigned short address;
+    unsigned int name; // offset into strings
+} DebugSymbol;
+
+typedef struct {
+    unsigned short address;
+    unsigned short line;
+    unsigned int file; // index into files
+} DebugLine;
+
+/*
+ * Sorted by address once DebugInfoFinish runs, so lookups are binary searches.
+ * Memory grows with the number of entries, not with the address space.
+ */
+typedef struct {
+    DebugSymbol* symbols;
+    int num_symbols, symbols_cap;
+    DebugLine* lines;
+    int num_lines, lines_cap;
+    unsigned int* files;      // offset into strings of each file name
+    int num_files, files_cap;
+    int file_base;            // index of the first file of the object being loaded
+    char* strings;            // NUL-terminated names back to back
+    unsigned int strings_len, strings_cap;
+    int* name_hash;           // symbol index or -1, open addressing
+    unsigned int hash_size;   // power of 2
+} DebugInfo;
+
+void DebugInfoInit(DebugInfo* di);
+void DebugInfoFree(DebugInfo* di);
+void DebugInfoBeginObject(DebugInfo* di);
+int DebugInfoAddSymbol(DebugInfo* di, unsigned short address, const char* name, unsigned int len);
+int DebugInfoAddFile(DebugInfo* di, const char* name, unsigned int len);
+int DebugInfoAddLine(DebugInfo* di, unsigned short address, unsigned short line, unsigned short file_index);
+int DebugInfoFinish(DebugInfo* di);
+
+const char* DebugSymbolAt(DebugInfo* di, unsigned short address, unsigned short* offset);
+int DebugLineAt(DebugInfo* di, unsigned short address, const char** file, int* line);
+int DebugLookupName(DebugInfo* di, const char* name, unsigned short* address);
+int DebugNextSymbol(DebugInfo* di, unsigned short address, unsigned short* next);
+int DebugParseAddress(DebugInfo* di, const char* text, unsigned short* address);
+
+int ReadObjectFileDebug(char* filename, MachineState* CPU, DebugInfo* debug);
+
+#endif
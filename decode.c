@@ -0,0 +1,316 @@
+/*
+ * decode.c: Builds the predecoded instruction table and executes from it
+ */
+
+#include "decode.h"
+#include <string.h>
+
+/*
+ * Decode a single instruction word into its handler form and operands.
+ * Mirrors the opcode/sub-op parsing done by the helpers in LC4.c.
+ */
+void DecodeInstruction(unsigned short instr, DecodedInsn* d)
+{
+    d->insn = instr;
+    d->rd = INSN_Rd(instr);
+    d->rs = INSN_Rs(instr);
+    d->rt = INSN_Rt(instr);
+    d->imm = 0;
+
+    switch (INSN_OP(instr)) {
+        case 0: // BRN
+        {
+            unsigned short subop = (instr >> 9) & 0x7; // NZP condition bits
+            d->imm = SEXT(INSN_IMM9(instr), 9);
+            if (subop == 0) {
+                d->form = FORM_NOP;
+            } else if (subop == 7) {
+                d->form = FORM_BRA;
+            } else {
+                d->form = FORM_BR;
+                d->rd = subop; // mask against the PSR NZP bits
+            }
+            break;
+        }
+        case 1: // ARTH, bits 3-5 (bit 5 included) pick the sub-op
+        {
+            static const unsigned char arith[8] = { FORM_ADD, FORM_MUL, FORM_SUB, FORM_DIV,
+                                                    FORM_ZERO, FORM_ZERO, FORM_ZERO, FORM_ZERO };
+            d->form = arith[(instr >> 3) & 0x7];
+            break;
+        }
+        case 2: // CMPR
+        {
+            unsigned short subop = (instr >> 7) & 0x3;
+            if (subop == 0) {
+                d->form = (instr & 0x20) ? FORM_CMPI : FORM_CMP; // CMP with bit 5 set compares signed imm6
+            } else if (subop == 1) {
+                d->form = (instr & 0x20) ? FORM_CMPIU : FORM_CMPU;
+            } else {
+                d->form = (subop == 2) ? FORM_CMPI : FORM_CMPIU;
+            }
+            d->imm = (d->form == FORM_CMPI) ? SEXT(INSN_IMM6(instr), 6) : INSN_IMM6(instr);
+            break;
+        }
+        case 4: // JSR/JSRR
+            if ((instr >> 11) & 0x1) {
+                d->form = FORM_JSRR;
+                d->imm = SEXT(INSN_IMM6(instr), 6);
+            } else {
+                d->form = FORM_JSR;
+                d->imm = SEXT(INSN_IMM11(instr), 11);
+            }
+            break;
+        case 5: // LOG
+        {
+            static const unsigned char logic[8] = { FORM_AND, FORM_NOT, FORM_OR, FORM_XOR,
+                                                    FORM_ZERO, FORM_ZERO, FORM_ZERO, FORM_ZERO };
+            d->form = logic[(instr >> 3) & 0x7];
+            break;
+        }
+        case 6: // LDR
+            d->form = FORM_LDR;
+            d->imm = SEXT(INSN_IMM6(instr), 6);
+            break;
+        case 7: // STR
+            d->form = FORM_STR;
+            d->imm = SEXT(INSN_IMM6(instr), 6);
+            break;
+        case 8: // RTI
+            d->form = FORM_RTI;
+            break;
+        case 9: // CONST
+            d->form = FORM_CONST;
+            d->imm = SEXT(INSN_IMM9(instr), 9);
+            break;
+        case 10: // SLL/SRA/SRL/MOD
+        {
+            static const unsigned char shift[4] = { FORM_SLL, FORM_SRA, FORM_SRL, FORM_MOD };
+            d->form = shift[(instr >> 4) & 0x3];
+            d->imm = instr & 0xF; // shift amount
+            break;
+        }
+        case 12: // JMP/JMPR
+            if ((instr >> 11) & 0x1) {
+                d->form = FORM_JMPR;
+                d->imm = SEXT(INSN_IMM6(instr), 6);
+            } else {
+                d->form = FORM_JMP;
+                d->imm = SEXT(INSN_IMM11(instr), 11);
+            }
+            break;
+        case 13: // HICONST
+            d->form = FORM_HICONST;
+            d->imm = instr & 0x00FF;
+            break;
+        case 15: // TRAP
+            d->form = FORM_TRAP;
+            d->imm = instr & 0x00FF;
+            break;
+        default: // unused opcodes just advance the PC
+            d->form = FORM_NOP;
+            break;
+    }
+}
+
+/*
+ * Mark every entry undecoded, e.g. after memory was reloaded.
+ */
+void ClearDecodeCache(DecodeCache* cache)
+{
+    memset(cache->insn, 0, sizeof(cache->insn));
+    memset(cache->dirty, 0, sizeof(cache->dirty));
+}
+
+/*
+ * Drop a whole page of entries and mark it dirty, for memory that changed
+ * without going through InvalidateDecoded.
+ */
+void InvalidatePage(DecodeCache* cache, int page)
+{
+    memset(&cache->insn[page << PAGE_SHIFT], 0, PAGE_WORDS * sizeof(DecodedInsn));
+    cache->dirty[page] = 1;
+}
+
+/*
+ * Execute one datapath cycle from the decoded table. Produces exactly the
+ * same machine state and trace line as UpdateMachineState; a NULL output
+ * runs quietly, without the trace line or the exit message.
+ */
+int UpdateMachineStateDecoded(MachineState* CPU, DecodeCache* cache, FILE* output)
+{
+    ClearSignals(CPU); // reset signals
+    const DecodedInsn* d = FetchDecoded(cache, CPU, CPU->PC);
+    short return_val;
+
+    switch (d->form) {
+        case FORM_NOP:
+            CPU->PC++;
+            break;
+        case FORM_BR:
+            if ((CPU->PSR & d->rd) != 0) {
+                CPU->PC = CPU->PC + 1 + d->imm;
+            } else {
+                CPU->PC++;
+            }
+            break;
+        case FORM_BRA:
+            CPU->PC = CPU->PC + 1 + d->imm;
+            break;
+
+        // ALU ops writing Rd, with the same C expressions as LC4.c
+        case FORM_ADD:
+            return_val = CPU->R[d->rs] + CPU->R[d->rt];
+            goto write_rd;
+        case FORM_MUL:
+            return_val = CPU->R[d->rs] * CPU->R[d->rt];
+            goto write_rd;
+        case FORM_SUB:
+            return_val = CPU->R[d->rs] - CPU->R[d->rt];
+            goto write_rd;
+        case FORM_DIV:
+            return_val = (CPU->R[d->rt] != 0) ? CPU->R[d->rs] / CPU->R[d->rt] : 0;
+            goto write_rd;
+        case FORM_ZERO:
+            return_val = 0;
+            goto write_rd;
+        case FORM_AND:
+            return_val = CPU->R[d->rs] & CPU->R[d->rt];
+            goto write_rd;
+        case FORM_NOT:
+            return_val = ~CPU->R[d->rs];
+            goto write_rd;
+        case FORM_OR:
+            return_val = CPU->R[d->rs] | CPU->R[d->rt];
+            goto write_rd;
+        case FORM_XOR:
+            return_val = CPU->R[d->rs] ^ CPU->R[d->rt];
+            goto write_rd;
+        case FORM_SLL:
+            return_val = CPU->R[d->rs] << d->imm;
+            goto write_rd;
+        case FORM_SRA:
+            return_val = CPU->R[d->rs] >> d->imm;
+            goto write_rd;
+        case FORM_SRL:
+            return_val = (short)((unsigned short)CPU->R[d->rs] >> d->imm);
+            goto write_rd;
+        case FORM_MOD:
+            return_val = (CPU->R[d->rt] != 0) ? CPU->R[d->rs] % CPU->R[d->rt] : 0;
+        write_rd:
+            CPU->rdMux_CTL = d->rd;
+            CPU->regFile_WE = 1;
+            CPU->NZP_WE = 1;
+            CPU->regInputVal = return_val;
+            CPU->R[d->rd] = return_val;
+            SetNZP(CPU, return_val);
+            CPU->PC++;
+            break;
+
+        // compares only set NZP
+        case FORM_CMP:
+            return_val = CPU->R[d->rs] - CPU->R[d->rt];
+            goto write_nzp;
+        case FORM_CMPI:
+            return_val = CPU->R[d->rs] - d->imm;
+            goto write_nzp;
+        case FORM_CMPU:
+            return_val = (unsigned short)CPU->R[d->rs] - (unsigned short)CPU->R[d->rt];
+            goto write_nzp;
+        case FORM_CMPIU:
+            return_val = (unsigned short)CPU->R[d->rs] - (unsigned short)d->imm;
+        write_nzp:
+            CPU->NZP_WE = 1;
+            SetNZP(CPU, return_val);
+            CPU->PC++;
+            break;
+
+        case FORM_JSR:
+        case FORM_JSRR:
+            CPU->regFile_WE = 1;
+            CPU->rdMux_CTL = 7; // always write to R7
+            CPU->regInputVal = CPU->PC + 1;
+            CPU->R[7] = CPU->regInputVal;
+            CPU->NZP_WE = 1;
+            SetNZP(CPU, CPU->regInputVal);
+            if (d->form == FORM_JSR) {
+                CPU->PC = CPU->PC + 1 + d->imm;
+            } else {
+                CPU->PC = CPU->R[d->rs] + d->imm; // reads R7 after the link write, like JSROp
+            }
+            break;
+        case FORM_LDR:
+        {
+            unsigned short addr = CPU->R[d->rs] + d->imm;
+            CPU->regFile_WE = 1;
+            CPU->rdMux_CTL = d->rd;
+            CPU->regInputVal = CPU->memory[addr];
+            CPU->R[d->rd] = CPU->regInputVal;
+            CPU->NZP_WE = 1;
+            SetNZP(CPU, CPU->regInputVal);
+            CPU->PC++;
+            break;
+        }
+        case FORM_STR:
+        {
+            unsigned short addr = CPU->R[d->rs] + d->imm;
+            CPU->DATA_WE = 1;
+            CPU->dmemAddr = addr;
+            CPU->dmemValue = CPU->R[d->rd];
+            CPU->memory[addr] = CPU->dmemValue;
+            InvalidateDecoded(cache, addr); // the word may be code
+            CPU->PC++;
+            break;
+        }
+        case FORM_RTI:
+            CPU->PSR = 0;
+            CPU->PC = CPU->R[7];
+            break;
+        case FORM_CONST:
+            CPU->regFile_WE = 1;
+            CPU->rdMux_CTL = d->rd;
+            CPU->regInputVal = d->imm;
+            CPU->R[d->rd] = CPU->regInputVal;
+            CPU->NZP_WE = 1;
+            SetNZP(CPU, CPU->regInputVal);
+            CPU->PC++;
+            break;
+        case FORM_JMP:
+            CPU->PC = CPU->PC + 1 + d->imm;
+            break;
+        case FORM_JMPR:
+            CPU->PC = CPU->R[d->rs] + d->imm;
+            break;
+        case FORM_HICONST:
+            CPU->regFile_WE = 1;
+            CPU->NZP_WE = 1;
+            CPU->rdMux_CTL = d->rd;
+            CPU->regInputVal = (CPU->R[d->rd] & 0x00FF) | (d->imm << 8); // keep low 8 bits, set high 8 bits
+            CPU->R[d->rd] = CPU->regInputVal;
+            SetNZP(CPU, CPU->regInputVal);
+            CPU->PC++;
+            break;
+        case FORM_TRAP:
+            CPU->PSR = 1; // enter OS mode
+            CPU->regFile_WE = 1;
+            CPU->NZP_WE = 1;
+            CPU->regInputVal = CPU->PC + 1; // return address
+            CPU->rdMux_CTL = 7;
+            SetNZP(CPU, CPU->regInputVal);
+            CPU->R[7] = CPU->PC + 1;
+            CPU->PC = 0x8000 | d->imm; // jump to trap vector
+            break;
+    }
+
+    if (CPU->PC == 0x80FF) { // exit the program
+        if (output != NULL) {
+            printf("reached PC == 0x80FF so we leave the program");
+        }
+        return 1;
+    }
+    if (output != NULL) {
+        WriteOut(CPU, output); // current state
+    }
+
+    return 0; // Continue execution
+}
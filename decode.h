@@ -0,0 +1,127 @@
+/*
+ * decode.h: Predecoded instruction cache sitting in front of the datapath
+ */
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "LC4.h"
+
+// instructions in sections
+#define INSN_OP(I) ((I) >> 12)// bits 12-15 - Opcode
+#define INSN_Rt(I) ((I) & 0x7) // bits 0-2: Rt
+#define INSN_Rs(I) (((I) >> 6) & 0x7)//bits 6-8: Rs
+#define INSN_Rd(I) (((I) >> 9) & 0x7)//bits 9-11 - Rd
+#define INSN_IMM6(I) ((I) & 0x3F)// bits 0-5: IMM6
+#define INSN_IMM9(I) ((I) & 0x1FF)// bits 0-8: IMM9
+#define INSN_IMM11(I) ((I) & 0x7FF)// bits 0-11: IMM11
+#define SEXT(val, bits) (((val) & (1 << ((bits)-1))) ? ((val) | (~((1 << (bits)) - 1))) : (val))
+
+// fully decoded instruction forms, one per distinct datapath behaviour
+enum {
+    FORM_UNDECODED = 0, // entry has to be (re)decoded from memory
+    FORM_NOP,       // BR with no condition and unused opcodes: PC = PC + 1
+    FORM_BR,        // conditional branch, rd holds the NZP mask
+    FORM_BRA,       // BRnzp, always taken
+    FORM_ADD,
+    FORM_MUL,
+    FORM_SUB,
+    FORM_DIV,
+    FORM_ZERO,      // ARTH/LOG sub-ops 4-7: Rd = 0
+    FORM_CMP,
+    FORM_CMPU,
+    FORM_CMPI,
+    FORM_CMPIU,
+    FORM_JSR,
+    FORM_JSRR,
+    FORM_AND,
+    FORM_NOT,
+    FORM_OR,
+    FORM_XOR,
+    FORM_LDR,
+    FORM_STR,
+    FORM_RTI,
+    FORM_CONST,
+    FORM_SLL,
+    FORM_SRA,
+    FORM_SRL,
+    FORM_MOD,
+    FORM_JMP,
+    FORM_JMPR,
+    FORM_HICONST,
+    FORM_TRAP,
+    FORM_EXIT,      // threaded engine only: marks 0x80FF so reaching it ends the run
+    FORM_COUNT
+};
+
+/*
+ * One predecoded memory word. imm is already sign-extended where the
+ * datapath sign-extends it (shift amount, HICONST byte and trap vector are not).
+ */
+typedef struct {
+    unsigned char form; // FORM_* handler index
+    unsigned char rd;   // Rd, or the NZP mask for FORM_BR
+    unsigned char rs;
+    unsigned char rt;
+    short imm;
+    unsigned short insn; // raw instruction word
+} DecodedInsn;
+
+#define PAGE_SHIFT 8                  // 256-word pages for dirty tracking
+#define PAGE_WORDS (1 << PAGE_SHIFT)
+#define NUM_PAGES (65536 >> PAGE_SHIFT)
+
+typedef struct {
+    DecodedInsn insn[65536];        // one entry per memory word
+    unsigned char dirty[NUM_PAGES]; // pages stored to since the last clear or snapshot
+} DecodeCache;
+
+void DecodeInstruction(unsigned short instr, DecodedInsn* d);
+void ClearDecodeCache(DecodeCache* cache);
+void InvalidatePage(DecodeCache* cache, int page);
+int UpdateMachineStateDecoded(MachineState* CPU, DecodeCache* cache, FILE* output);
+
+/*
+ * Get the decoded entry for address, decoding it from memory on a miss.
+ */
+static inline const DecodedInsn* FetchDecoded(DecodeCache* cache, MachineState* CPU, unsigned short address)
+{
+    DecodedInsn* d = &cache->insn[address];
+    if (d->form == FORM_UNDECODED) {
+        DecodeInstruction(CPU->memory[address], d);
+    }
+    return d;
+}
+
+/*
+ * Update only the NZP bits of the PSR, for runs that keep no NZPVal signal.
+ */
+static inline void SetPSRNZP(MachineState* CPU, short result)
+{
+    CPU->PSR = (CPU->PSR & 0xFFF8) | ((result > 0) ? 0x0001 : (result == 0) ? 0x0002 : 0x0004);
+}
+
+#define NZP_SYNCED 0x10000 // lazy NZP: no result pending, the PSR bits are current
+
+/*
+ * The no-trace engines set NZP lazily: an op only leaves its result in
+ * *last, and the PSR bits are worked out here once something reads them.
+ */
+static inline void SyncNZP(MachineState* CPU, int* last)
+{
+    if (*last != NZP_SYNCED) {
+        SetPSRNZP(CPU, *last);
+        *last = NZP_SYNCED;
+    }
+}
+
+/*
+ * Drop the decoded entry for a memory word that was just written.
+ */
+static inline void InvalidateDecoded(DecodeCache* cache, unsigned short address)
+{
+    cache->insn[address].form = FORM_UNDECODED;
+    cache->dirty[address >> PAGE_SHIFT] = 1;
+}
+
+#endif
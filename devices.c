@@ -0,0 +1,201 @@
+/*
+ * devices.c: Keyboard from a script, buffered console and dirty-row video frames
+ */
+
+#include "devices.h"
+#include <string.h>
+
+#define PPM_HEADER "P6\n128 124\n255\n"
+#define PPM_ROW_BYTES (VIDEO_COLS * 3)
+
+/*
+ * How path names frames: 0 for one file rewritten in place, 1 for a new
+ * file per frame numbered through its one %d (a 0 flag and a width are
+ * fine), -1 for any other % in it.
+ */
+int DeviceVideoPath(const char* path)
+{
+    const char* percent = strchr(path, '%');
+    if (percent == NULL) {
+        return 0;
+    }
+    const char* conversion = percent + 1;
+    if (*conversion == '0') {
+        conversion++;
+    }
+    for (int width = 0; width < 2 && *conversion >= '1' && *conversion <= '9'; width++) {
+        conversion++;
+    }
+    return *conversion == 'd' && strchr(conversion, '%') == NULL ? 1 : -1;
+}
+
+/*
+ * Set up the devices: console output goes to console, keys come from the
+ * bytes of keyboard_path (none if NULL) and frames go to video_path (none
+ * if NULL), which DeviceVideoPath has to accept. Returns 0, or -1 if one
+ * of the files can't be opened.
+ */
+int DevicesInit(Devices* dev, FILE* console, const char* keyboard_path, const char* video_path)
+{
+    memset(dev, 0, sizeof(*dev));
+    dev->console = console;
+    dev->key = -1;
+    dev->video_path = video_path;
+    dev->pages[DEVICE_KBSR >> PAGE_SHIFT] = DEVICE_LOAD | DEVICE_STORE;
+    for (int page = VIDEO_BASE >> PAGE_SHIFT; page < (VIDEO_BASE + VIDEO_ROWS * VIDEO_COLS) >> PAGE_SHIFT; page++) {
+        dev->pages[page] = DEVICE_STORE;
+    }
+    memset(dev->video_dirty, 0xFF, sizeof(dev->video_dirty)); // the first frame has everything
+
+    if (keyboard_path != NULL) {
+        dev->keyboard = fopen(keyboard_path, "rb");
+        if (dev->keyboard == NULL) {
+            return -1;
+        }
+        dev->key = fgetc(dev->keyboard);
+    }
+    if (video_path != NULL && DeviceVideoPath(video_path) == 0) {
+        dev->screen = fopen(video_path, "wb");
+        if (dev->screen == NULL) {
+            return -1;
+        }
+        fputs(PPM_HEADER, dev->screen);
+    }
+    return 0;
+}
+
+void DevicesClose(Devices* dev)
+{
+    DeviceFlush(dev);
+    if (dev->keyboard != NULL) {
+        fclose(dev->keyboard);
+    }
+    if (dev->screen != NULL) {
+        fclose(dev->screen);
+    }
+}
+
+/*
+ * A load from a page with device registers: the status registers say
+ * whether a key is waiting and that the console is ready, and reading the
+ * key takes it. Everything else on the page is plain memory.
+ */
+unsigned short DeviceLoad(Devices* dev, MachineState* CPU, unsigned short address)
+{
+    switch (address) {
+        case DEVICE_KBSR:
+            return dev->key >= 0 ? 0x8000 : 0;
+        case DEVICE_KBDR:
+            return DeviceGetc(dev);
+        case DEVICE_ADSR:
+            return 0x8000;
+        default:
+            return CPU->memory[address];
+    }
+}
+
+/*
+ * A store that just went to memory on a device page: a character for the
+ * console, or a pixel whose row now needs redrawing.
+ */
+void DeviceStore(Devices* dev, MachineState* CPU, unsigned short address)
+{
+    if (address == DEVICE_ADDR) {
+        DevicePutc(dev, CPU->memory[address] & 0xFF);
+    } else if (address >= VIDEO_BASE && address < VIDEO_BASE + VIDEO_ROWS * VIDEO_COLS) {
+        int row = (address - VIDEO_BASE) / VIDEO_COLS;
+        dev->video_dirty[row / 64] |= 1ULL << (row % 64);
+    }
+}
+
+void DevicePutc(Devices* dev, int c)
+{
+    if (dev->console_used == DEVICE_CONSOLE_BYTES) {
+        DeviceFlush(dev);
+    }
+    dev->console_buffer[dev->console_used++] = c;
+}
+
+/*
+ * Take the waiting key, 0 if the script has run out.
+ */
+int DeviceGetc(Devices* dev)
+{
+    if (dev->key < 0) {
+        return 0;
+    }
+    int c = dev->key;
+    dev->key = fgetc(dev->keyboard);
+    return c;
+}
+
+/*
+ * Write out the console output held back so far.
+ */
+void DeviceFlush(Devices* dev)
+{
+    if (dev->console_used != 0) {
+        fwrite(dev->console_buffer, 1, dev->console_used, dev->console);
+        dev->console_used = 0;
+    }
+    fflush(dev->console);
+}
+
+// one row of the screen as PPM pixels, each 5-bit channel widened to 8 bits
+static void VideoRow(MachineState* CPU, int row, unsigned char* out)
+{
+    for (int col = 0; col < VIDEO_COLS; col++) {
+        unsigned short pixel = CPU->memory[VIDEO_BASE + row * VIDEO_COLS + col];
+        int channels[3] = { (pixel >> 10) & 0x1F, (pixel >> 5) & 0x1F, pixel & 0x1F };
+        for (int i = 0; i < 3; i++) {
+            *out++ = (channels[i] << 3) | (channels[i] >> 2);
+        }
+    }
+}
+
+/*
+ * Take a frame of the screen if any row changed since the last one: a new
+ * numbered PPM with the whole screen, or the changed rows rewritten in
+ * place in the one screen file. Returns 1 if a frame was written, 0 if
+ * nothing changed or there is no video output, -1 on a write error.
+ */
+int DeviceFrame(Devices* dev, MachineState* CPU)
+{
+    int dirty = 0;
+    for (int i = 0; i < (int)(sizeof(dev->video_dirty) / sizeof(dev->video_dirty[0])); i++) {
+        dirty |= dev->video_dirty[i] != 0;
+    }
+    if (!dirty || dev->video_path == NULL) {
+        memset(dev->video_dirty, 0, sizeof(dev->video_dirty));
+        return 0;
+    }
+
+    unsigned char row_pixels[PPM_ROW_BYTES];
+    int failed = 0;
+    if (dev->screen != NULL) {
+        for (int row = 0; row < VIDEO_ROWS; row++) {
+            if (dev->video_dirty[row / 64] & (1ULL << (row % 64))) {
+                VideoRow(CPU, row, row_pixels);
+                fseek(dev->screen, (long)strlen(PPM_HEADER) + (long)row * PPM_ROW_BYTES, SEEK_SET);
+                failed |= fwrite(row_pixels, 1, PPM_ROW_BYTES, dev->screen) != PPM_ROW_BYTES;
+            }
+        }
+        failed |= fflush(dev->screen) != 0;
+    } else {
+        char path[1024];
+        snprintf(path, sizeof(path), dev->video_path, dev->frames);
+        FILE* frame = fopen(path, "wb");
+        if (frame == NULL) {
+            return -1;
+        }
+        fputs(PPM_HEADER, frame);
+        for (int row = 0; row < VIDEO_ROWS; row++) {
+            VideoRow(CPU, row, row_pixels);
+            failed |= fwrite(row_pixels, 1, PPM_ROW_BYTES, frame) != PPM_ROW_BYTES;
+        }
+        failed |= fclose(frame) != 0;
+    }
+    memset(dev->video_dirty, 0, sizeof(dev->video_dirty));
+    dev->frames++;
+    return failed ? -1 : 1;
+}
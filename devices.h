@@ -0,0 +1,78 @@
+/*
+ * devices.h: Memory-mapped keyboard, console and video of the LC4 board
+ */
+
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "decode.h"
+#include <stdio.h>
+
+// device registers, all in the page at xFE00
+#define DEVICE_KBSR 0xFE00 // bit 15 set while a key is waiting
+#define DEVICE_KBDR 0xFE02 // the waiting key, reading it takes it
+#define DEVICE_ADSR 0xFE04 // bit 15 set when the console takes a character, which is always
+#define DEVICE_ADDR 0xFE06 // the low byte of what is stored here goes to the console
+
+// the screen: 128 columns by 124 rows from xC000, a word of 5-bit red, green and blue per pixel
+#define VIDEO_BASE 0xC000
+#define VIDEO_COLS 128
+#define VIDEO_ROWS 124
+
+// what a page needs from the devices
+#define DEVICE_LOAD  1 // loads go through DeviceLoad
+#define DEVICE_STORE 2 // stores go through DeviceStore after the memory write
+
+#define DEVICE_CONSOLE_BYTES 4096 // console output held back before one write to the host
+
+/*
+ * The devices of one run. The engine only looks at pages for each LDR and
+ * STR, so memory outside the device pages costs one table lookup. Video
+ * memory is plain memory that also marks its row dirty on a store; frames
+ * only write the rows changed since the last one.
+ */
+typedef struct {
+    unsigned char pages[NUM_PAGES];           // DEVICE_* flags per page
+    FILE* console;
+    char console_buffer[DEVICE_CONSOLE_BYTES];
+    int console_used;
+    FILE* keyboard;                           // scripted keys, NULL for none
+    int key;                                  // the waiting key, -1 if there is none left
+    unsigned long long video_dirty[(VIDEO_ROWS + 63) / 64]; // rows stored to since the last frame
+    const char* video_path;                   // PPM frames, numbered if it holds a %d, NULL for none
+    FILE* screen;                             // the one PPM kept up to date when video_path isn't numbered
+    int frames;                               // frames written
+} Devices;
+
+int DeviceVideoPath(const char* path);
+int DevicesInit(Devices* dev, FILE* console, const char* keyboard_path, const char* video_path);
+void DevicesClose(Devices* dev);
+unsigned short DeviceLoad(Devices* dev, MachineState* CPU, unsigned short address);
+void DeviceStore(Devices* dev, MachineState* CPU, unsigned short address);
+void DevicePutc(Devices* dev, int c);
+int DeviceGetc(Devices* dev);
+void DeviceFlush(Devices* dev);
+int DeviceFrame(Devices* dev, MachineState* CPU);
+
+/*
+ * Load from address, through the devices if its page has one.
+ */
+static inline unsigned short DeviceRead(Devices* dev, MachineState* CPU, unsigned short address)
+{
+    if (dev != NULL && (dev->pages[address >> PAGE_SHIFT] & DEVICE_LOAD)) {
+        return DeviceLoad(dev, CPU, address);
+    }
+    return CPU->memory[address];
+}
+
+/*
+ * Tell the devices about a store to address that already went to memory.
+ */
+static inline void DeviceWrite(Devices* dev, MachineState* CPU, unsigned short address)
+{
+    if (dev != NULL && (dev->pages[address >> PAGE_SHIFT] & DEVICE_STORE)) {
+        DeviceStore(dev, CPU, address);
+    }
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * disasm.c: Disassembles instruction words the way the simulator decodes them
+ */
+
+#include "disasm.h"
+
+/*
+ * Write the assembly for insn at pc into out, at most DISASM_MAX bytes.
+ * It goes by DecodeInstruction, so the text says what this simulator does
+ * with the word: immediate ADD/AND forms are flagged as writing 0 and CMP
+ * variants are named after the sub-op the overlapping bits select.
+ * Returns the length written.
+ */
+int Disassemble(unsigned short pc, unsigned short insn, char* out)
+{
+    static const char* names[FORM_COUNT] = {
+        [FORM_NOP] = "NOP", [FORM_ADD] = "ADD", [FORM_MUL] = "MUL", [FORM_SUB] = "SUB", [FORM_DIV] = "DIV",
+        [FORM_CMP] = "CMP", [FORM_CMPU] = "CMPU", [FORM_CMPI] = "CMPI", [FORM_CMPIU] = "CMPIU",
+        [FORM_JSR] = "JSR", [FORM_JSRR] = "JSRR", [FORM_AND] = "AND", [FORM_NOT] = "NOT", [FORM_OR] = "OR",
+        [FORM_XOR] = "XOR", [FORM_LDR] = "LDR", [FORM_STR] = "STR", [FORM_RTI] = "RTI", [FORM_CONST] = "CONST",
+        [FORM_SLL] = "SLL", [FORM_SRA] = "SRA", [FORM_SRL] = "SRL", [FORM_MOD] = "MOD", [FORM_JMP] = "JMP",
+        [FORM_JMPR] = "JMPR", [FORM_HICONST] = "HICONST", [FORM_TRAP] = "TRAP",
+    };
+    DecodedInsn d;
+    DecodeInstruction(insn, &d);
+    unsigned short target = pc + 1 + d.imm; // PC-relative forms
+
+    switch (d.form) {
+        case FORM_BR:
+            return snprintf(out, DISASM_MAX, "BR%s%s%s x%04X", (d.rd & 4) ? "n" : "", (d.rd & 2) ? "z" : "",
+                            (d.rd & 1) ? "p" : "", target);
+        case FORM_BRA:
+            return snprintf(out, DISASM_MAX, "BRnzp x%04X", target);
+        case FORM_ADD:
+        case FORM_MUL:
+        case FORM_SUB:
+        case FORM_DIV:
+        case FORM_AND:
+        case FORM_OR:
+        case FORM_XOR:
+        case FORM_MOD:
+            return snprintf(out, DISASM_MAX, "%s R%d, R%d, R%d", names[d.form], d.rd, d.rs, d.rt);
+        case FORM_ZERO:
+            return snprintf(out, DISASM_MAX, "%s R%d, R%d, #%d ; writes 0", INSN_OP(insn) == 1 ? "ADD" : "AND", d.rd,
+                            d.rs, SEXT(insn & 0x1F, 5));
+        case FORM_NOT:
+            return snprintf(out, DISASM_MAX, "NOT R%d, R%d", d.rd, d.rs);
+        case FORM_CMP:
+        case FORM_CMPU:
+            return snprintf(out, DISASM_MAX, "%s R%d, R%d", names[d.form], d.rs, d.rt);
+        case FORM_CMPI:
+        case FORM_CMPIU:
+            return snprintf(out, DISASM_MAX, "%s R%d, #%d", names[d.form], d.rs, d.imm);
+        case FORM_JSR:
+        case FORM_JMP:
+            return snprintf(out, DISASM_MAX, "%s x%04X", names[d.form], target);
+        case FORM_JSRR:
+        case FORM_JMPR:
+            if (d.imm != 0) {
+                return snprintf(out, DISASM_MAX, "%s R%d, #%d", names[d.form], d.rs, d.imm);
+            }
+            return snprintf(out, DISASM_MAX, "%s R%d", names[d.form], d.rs);
+        case FORM_LDR:
+        case FORM_STR:
+            return snprintf(out, DISASM_MAX, "%s R%d, R%d, #%d", names[d.form], d.rd, d.rs, d.imm);
+        case FORM_CONST:
+            return snprintf(out, DISASM_MAX, "CONST R%d, #%d", d.rd, d.imm);
+        case FORM_HICONST:
+            return snprintf(out, DISASM_MAX, "HICONST R%d, x%02X", d.rd, d.imm);
+        case FORM_SLL:
+        case FORM_SRA:
+        case FORM_SRL:
+            return snprintf(out, DISASM_MAX, "%s R%d, R%d, #%d", names[d.form], d.rd, d.rs, d.imm);
+        case FORM_TRAP:
+            return snprintf(out, DISASM_MAX, "TRAP x%02X", d.imm);
+        case FORM_NOP:
+            if (insn != 0) {
+                return snprintf(out, DISASM_MAX, "NOP ; x%04X", insn); // unused opcode
+            }
+            return snprintf(out, DISASM_MAX, "NOP");
+        default: // FORM_RTI
+            return snprintf(out, DISASM_MAX, "%s", names[d.form]);
+    }
+}
+
+/*
+ * Print the words from center - radius to center + radius with their
+ * disassembly, marking center.
+ */
+void DisassembleWindow(MachineState* CPU, unsigned short center, int radius, FILE* output)
+{
+    char text[DISASM_MAX];
+    for (int i = -radius; i <= radius; i++) {
+        unsigned short pc = center + i;
+        Disassemble(pc, CPU->memory[pc], text);
+        fprintf(output, "%s %04X %04X  %s\n", i == 0 ? "=>" : "  ", pc, CPU->memory[pc], text);
+    }
+}
@@ -0,0 +1,15 @@
+/*
+ * disasm.h: Turns instruction words back into LC4 assembly
+ */
+
+#ifndef DISASM_H
+#define DISASM_H
+
+#include "decode.h"
+
+#define DISASM_MAX 64 // longest line Disassemble writes, with the NUL
+
+int Disassemble(unsigned short pc, unsigned short insn, char* out);
+void DisassembleWindow(MachineState* CPU, unsigned short center, int radius, FILE* output);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * engine.c: Direct-threaded execution engine and engine selection
+ */
+
+#include "engine.h"
+#include "jit.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Map an engine name from the command line to its ENGINE_* value, -1 if unknown.
+ */
+int ParseEngine(const char* name)
+{
+    if (strcmp(name, "ref") == 0) {
+        return ENGINE_REFERENCE;
+    } else if (strcmp(name, "decode") == 0) {
+        return ENGINE_DECODED;
+    } else if (strcmp(name, "threaded") == 0) {
+        return ENGINE_THREADED;
+    } else if (strcmp(name, "block") == 0) {
+        return ENGINE_BLOCK;
+    } else if (strcmp(name, "jit") == 0) {
+        return ENGINE_JIT;
+    }
+    return -1;
+}
+
+// tracing engine, same output as UpdateMachineState
+#define ENGINE_FN RunThreaded
+#define ENGINE_TRACE 1
+#define ENGINE_PROFILE 0
+#define ENGINE_WATCH 0
+#include "engine_core.h"
+#undef ENGINE_FN
+#undef ENGINE_TRACE
+#undef ENGINE_PROFILE
+#undef ENGINE_WATCH
+
+// no-trace engine, architectural state only
+#define ENGINE_FN RunThreadedNoTrace
+#define ENGINE_TRACE 0
+#define ENGINE_PROFILE 0
+#define ENGINE_WATCH 0
+#include "engine_core.h"
+#undef ENGINE_FN
+#undef ENGINE_TRACE
+#undef ENGINE_PROFILE
+#undef ENGINE_WATCH
+
+// the same two with profiling counters
+#define ENGINE_FN RunThreadedProfile
+#define ENGINE_TRACE 1
+#define ENGINE_PROFILE 1
+#define ENGINE_WATCH 0
+#include "engine_core.h"
+#undef ENGINE_FN
+#undef ENGINE_TRACE
+#undef ENGINE_PROFILE
+#undef ENGINE_WATCH
+
+#define ENGINE_FN RunThreadedNoTraceProfile
+#define ENGINE_TRACE 0
+#define ENGINE_PROFILE 1
+#define ENGINE_WATCH 0
+#include "engine_core.h"
+#undef ENGINE_FN
+#undef ENGINE_TRACE
+#undef ENGINE_PROFILE
+#undef ENGINE_WATCH
+
+// and the two with breakpoints and watchpoints, only used while something is watched
+#define ENGINE_FN RunThreadedWatch
+#define ENGINE_TRACE 1
+#define ENGINE_PROFILE 0
+#define ENGINE_WATCH 1
+#include "engine_core.h"
+#undef ENGINE_FN
+#undef ENGINE_TRACE
+#undef ENGINE_PROFILE
+#undef ENGINE_WATCH
+
+#define ENGINE_FN RunThreadedNoTraceWatch
+#define ENGINE_TRACE 0
+#define ENGINE_PROFILE 0
+#define ENGINE_WATCH 1
+#include "engine_core.h"
+#undef ENGINE_FN
+#undef ENGINE_TRACE
+#undef ENGINE_PROFILE
+#undef ENGINE_WATCH
+
+/*
+ * Step the reference or decoded engine while something is watched:
+ * breakpoints are looked at before every instruction but the first, loads
+ * and stores after it. Returns the number of instructions executed.
+ */
+static unsigned long RunWatched(int engine, MachineState* CPU, DecodeCache* cache, FILE* output, const RunLimit* limit)
+{
+    WatchSet* watch = limit->watch;
+    unsigned long count = 0;
+    int done;
+    watch->hit = 0;
+    do {
+        if (count > 0 && (watch->pages[CPU->PC >> PAGE_SHIFT] & WATCH_STOP_PC) && WatchBreakpoint(watch, CPU)) {
+            break;
+        }
+        unsigned short pc = CPU->PC;
+        unsigned short insn = CPU->memory[pc];
+        unsigned short load = CPU->R[INSN_Rs(insn)] + SEXT(INSN_IMM6(insn), 6); // only used for LDR
+        if (engine == ENGINE_REFERENCE) {
+            done = UpdateMachineState(CPU, output);
+        } else {
+            done = UpdateMachineStateDecoded(CPU, cache, output);
+        }
+        count++;
+        if (INSN_OP(insn) == 6) {
+            WatchAccess(watch, pc, load, WATCH_READ);
+        } else if (CPU->DATA_WE) {
+            WatchAccess(watch, pc, CPU->dmemAddr, WATCH_WRITE);
+        }
+    } while (done == 0 && watch->hit == 0 && !LimitReached(limit, count));
+    return count;
+}
+
+/*
+ * Step the decoded engine with every retired instruction going through the
+ * timing model, which needs the instruction, where it went and the word it
+ * accessed. Runs without a timing model never come here. Returns the
+ * number of instructions executed.
+ */
+static unsigned long RunTimed(MachineState* CPU, DecodeCache* cache, FILE* output, const RunLimit* limit)
+{
+    unsigned long count = 0;
+    int done;
+    do {
+        unsigned short pc = CPU->PC;
+        DecodedInsn d = *FetchDecoded(cache, CPU, pc); // a copy, the instruction may store over itself
+        unsigned short address = CPU->R[d.rs] + d.imm; // only used for LDR and STR
+        done = UpdateMachineStateDecoded(CPU, cache, output);
+        count++;
+        TimingRetire(limit->timing, &d, pc, CPU->PC, address);
+    } while (done == 0 && !LimitReached(limit, count));
+    return count;
+}
+
+/*
+ * Run the loaded program to completion on the chosen engine. The reference
+ * and decoded engines print through WriteOut straight to the trace file.
+ * A NULL trace runs without tracing and a non-NULL prof collects a profile;
+ * both only work on the threaded engine, and the block and JIT engines only
+ * run without tracing or profiling. A non-NULL limit can stop the run early.
+ * While limit has a watch set or devices the run goes through the
+ * watching variants instead, without profiling; the block and JIT engines
+ * leave it to the threaded one. The reference and decoded engines don't
+ * know about devices. A timing model in limit takes the run to the decoded
+ * engine whatever engine was picked, and leaves out the rest of limit
+ * but its bounds.
+ * Returns the number of instructions executed.
+ */
+unsigned long RunProgram(int engine, MachineState* CPU, DecodeCache* cache, TraceWriter* trace, Profile* prof, const RunLimit* limit)
+{
+    unsigned long count = 0;
+
+    if (limit != NULL && limit->timing != NULL) {
+        return RunTimed(CPU, cache, trace != NULL ? trace->output : NULL, limit);
+    }
+    if (Watching(limit) || HasDevices(limit)) {
+        if (trace == NULL || engine == ENGINE_BLOCK || engine == ENGINE_JIT) {
+            return RunThreadedNoTraceWatch(CPU, cache, trace, limit);
+        } else if (engine == ENGINE_THREADED) {
+            return RunThreadedWatch(CPU, cache, trace, limit);
+        }
+        count = RunWatched(engine, CPU, cache, trace->output, limit);
+        if (engine == ENGINE_REFERENCE) {
+            for (int page = 0; page < NUM_PAGES; page++) {
+                InvalidatePage(cache, page);
+            }
+        }
+        return count;
+    }
+
+    if (engine == ENGINE_BLOCK || engine == ENGINE_JIT) {
+        BlockCache* blocks = malloc(sizeof(BlockCache));
+        JitCache* jit = engine == ENGINE_JIT ? malloc(sizeof(JitCache)) : NULL;
+        if (blocks == NULL || (engine == ENGINE_JIT && jit == NULL)) { // no room for the caches, run threaded instead
+            free(blocks);
+            free(jit);
+            return RunThreadedNoTrace(CPU, cache, NULL, limit);
+        }
+        BlockCacheInit(blocks);
+        if (jit != NULL) {
+            JitCacheInit(jit, blocks);
+            count = RunJit(CPU, jit, limit);
+            JitCacheFree(jit);
+            free(jit);
+        } else {
+            count = RunBlocks(CPU, blocks, limit);
+        }
+        for (int page = 0; page < NUM_PAGES; page++) { // stores bypassed the decode cache
+            if (blocks->dirty[page]) {
+                InvalidatePage(cache, page);
+            }
+        }
+        free(blocks);
+        return count;
+    }
+    if (trace == NULL) {
+        return prof ? RunThreadedNoTraceProfile(CPU, cache, trace, limit, prof) : RunThreadedNoTrace(CPU, cache, trace, limit);
+    }
+    switch (engine) {
+        case ENGINE_REFERENCE:
+            do {
+                count++;
+            } while (UpdateMachineState(CPU, trace->output) == 0 && !LimitReached(limit, count));
+            for (int page = 0; page < NUM_PAGES; page++) { // no idea what it stored to
+                InvalidatePage(cache, page);
+            }
+            break;
+        case ENGINE_DECODED:
+            do {
+                count++;
+            } while (UpdateMachineStateDecoded(CPU, cache, trace->output) == 0 && !LimitReached(limit, count));
+            break;
+        default:
+            count = prof ? RunThreadedProfile(CPU, cache, trace, limit, prof) : RunThreaded(CPU, cache, trace, limit);
+            break;
+    }
+    return count;
+}
+
+/*
+ * Write the architectural state left by a run: PC, PSR, registers, the
+ * instruction count and every non-zero memory word.
+ */
+void DumpMachineState(MachineState* CPU, unsigned long count, FILE* output)
+{
+    fprintf(output, "PC %04X\n", CPU->PC);
+    fprintf(output, "PSR %04X\n", CPU->PSR);
+    for (int i = 0; i < 8; i++) {
+        fprintf(output, "R%d %04X\n", i, (unsigned short)CPU->R[i]);
+    }
+    fprintf(output, "INSNS %lu\n", count);
+    for (int i = 0; i < 65536; i++) {
+        if (CPU->memory[i] != 0) {
+            fprintf(output, "%04X %04X\n", i, CPU->memory[i]); // address and contents
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * engine.h: Selectable execution engines for running a loaded program
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "decode.h"
+#include "tracewriter.h"
+#include "profile.h"
+#include "watch.h"
+#include "traps.h"
+#include "devices.h"
+#include "timing.h"
+
+// engines that can be picked with -e on the command line
+enum {
+    ENGINE_REFERENCE = 0, // UpdateMachineState, kept as the reference
+    ENGINE_DECODED,       // UpdateMachineStateDecoded, one switch per cycle
+    ENGINE_THREADED,      // RunThreaded, direct-threaded over the decode cache
+    ENGINE_BLOCK,         // RunBlocks, chained basic blocks, no-trace runs only
+    ENGINE_JIT            // RunJit, the block engine with hot blocks compiled to x86-64, no-trace only
+};
+
+/*
+ * Bounds on one run. The threaded engines only look at it on control
+ * transfers and the block and JIT engines between blocks, so a stopped run can go
+ * past max_insns by one straight-line stretch. A stopped run returns with
+ * PC somewhere other than 0x80FF. Breakpoints and watchpoints stop exactly,
+ * on every engine; runs without a watch set go through engines that never
+ * look for one. Host trap services only run on the no-trace engines.
+ * Devices need a watch set, even an empty one: like breakpoints they
+ * send the run through the watching variants of the threaded engine.
+ */
+typedef struct {
+    unsigned long max_insns; // 0 for no limit
+    volatile int stop;       // set by another thread to end the run early
+    WatchSet* watch;         // NULL or empty for none, the hit is recorded in it
+    TrapTable* traps;        // NULL, or TRAP vectors served on the host instead of by the OS
+    Devices* devices;        // NULL for plain memory everywhere
+    Timing* timing;          // NULL, or the pipeline model every instruction is timed on
+} RunLimit;
+
+/*
+ * Whether a run that has executed count instructions has to stop.
+ */
+static inline int LimitReached(const RunLimit* limit, unsigned long count)
+{
+    return limit != NULL && ((limit->max_insns != 0 && count >= limit->max_insns) || limit->stop);
+}
+
+/*
+ * Whether a run has breakpoints or watchpoints to look for.
+ */
+static inline int Watching(const RunLimit* limit)
+{
+    return limit != NULL && limit->watch != NULL && limit->watch->active != 0;
+}
+
+/*
+ * Whether a run has memory-mapped devices for its loads and stores.
+ */
+static inline int HasDevices(const RunLimit* limit)
+{
+    return limit != NULL && limit->devices != NULL;
+}
+
+int ParseEngine(const char* name);
+unsigned long RunThreaded(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit);
+unsigned long RunThreadedNoTrace(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit);
+unsigned long RunThreadedProfile(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit, Profile* prof);
+unsigned long RunThreadedNoTraceProfile(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit, Profile* prof);
+unsigned long RunThreadedWatch(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit);
+unsigned long RunThreadedNoTraceWatch(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit);
+unsigned long RunProgram(int engine, MachineState* CPU, DecodeCache* cache, TraceWriter* trace, Profile* prof, const RunLimit* limit);
+void DumpMachineState(MachineState* CPU, unsigned long count, FILE* output);
+
+#endif
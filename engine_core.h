@@ -0,0 +1,347 @@
+/*
+ * engine_core.h: Body of the direct-threaded engine, included by engine.c
+ * once per variant. Before including, define:
+ *   ENGINE_FN     name of the function to generate
+ *   ENGINE_TRACE  1 to keep the control signals and write a trace line per
+ *                 cycle through the TraceWriter, 0 to only update PC, PSR,
+ *                 registers and memory, with the NZP bits set lazily
+ *   ENGINE_PROFILE 1 to count every instruction, branch outcome and call in
+ *                 the Profile passed as an extra argument
+ *   ENGINE_WATCH  1 to stop at the breakpoints and watchpoints in
+ *                 limit->watch, which must not be NULL, and to send loads
+ *                 and stores on device pages to limit->devices
+ */
+
+/*
+ * Run the program until PC reaches 0x80FF, jumping straight from one
+ * handler to the next through a label table indexed by the decoded form
+ * (needs the GNU computed goto extension, which clang and gcc both have).
+ * Returns the number of instructions executed.
+ */
+#if ENGINE_PROFILE
+unsigned long ENGINE_FN(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit, Profile* prof)
+#else
+unsigned long ENGINE_FN(MachineState* CPU, DecodeCache* cache, TraceWriter* trace, const RunLimit* limit)
+#endif
+{
+    static void* const handlers[FORM_COUNT] = {
+        [FORM_UNDECODED] = &&undecoded,
+        [FORM_NOP] = &&op_nop,
+        [FORM_BR] = &&op_br,
+        [FORM_BRA] = &&op_bra,
+        [FORM_ADD] = &&op_add,
+        [FORM_MUL] = &&op_mul,
+        [FORM_SUB] = &&op_sub,
+        [FORM_DIV] = &&op_div,
+        [FORM_ZERO] = &&op_zero,
+        [FORM_CMP] = &&op_cmp,
+        [FORM_CMPU] = &&op_cmpu,
+        [FORM_CMPI] = &&op_cmpi,
+        [FORM_CMPIU] = &&op_cmpiu,
+        [FORM_JSR] = &&op_jsr,
+        [FORM_JSRR] = &&op_jsrr,
+        [FORM_AND] = &&op_and,
+        [FORM_NOT] = &&op_not,
+        [FORM_OR] = &&op_or,
+        [FORM_XOR] = &&op_xor,
+        [FORM_LDR] = &&op_ldr,
+        [FORM_STR] = &&op_str,
+        [FORM_RTI] = &&op_rti,
+        [FORM_CONST] = &&op_const,
+        [FORM_SLL] = &&op_sll,
+        [FORM_SRA] = &&op_sra,
+        [FORM_SRL] = &&op_srl,
+        [FORM_MOD] = &&op_mod,
+        [FORM_JMP] = &&op_jmp,
+        [FORM_JMPR] = &&op_jmpr,
+        [FORM_HICONST] = &&op_hiconst,
+        [FORM_TRAP] = &&op_trap,
+        [FORM_EXIT] = &&done,
+    };
+    unsigned long count = 0;
+    DecodedInsn first;
+    const DecodedInsn* d;
+    short return_val;
+
+#if ENGINE_PROFILE
+#define PROF(stmt) stmt
+#else
+#define PROF(stmt)
+#endif
+
+#if ENGINE_WATCH
+// loads and stores record a hit, which ends the run once the instruction has
+// retired; a breakpoint stops before the instruction, looked at per page first
+WatchSet* watch = limit->watch;
+watch->hit = 0;
+#define WATCH() \
+        if (watch->hit != 0 || ((watch->pages[CPU->PC >> PAGE_SHIFT] & WATCH_STOP_PC) && WatchBreakpoint(watch, CPU))) goto stopped
+#define WATCH_MEM(addr, kind) WatchAccess(watch, CPU->PC, addr, kind)
+Devices* devices = limit->devices;
+#define LOAD(addr) DeviceRead(devices, CPU, addr)
+#define STORED(addr) DeviceWrite(devices, CPU, addr)
+#else
+#define WATCH()
+#define WATCH_MEM(addr, kind)
+#define LOAD(addr) CPU->memory[addr]
+#define STORED(addr)
+#endif
+
+#if ENGINE_TRACE
+// control signal writes only exist in the tracing variant
+#define SIG(stmt) stmt
+#define NZP(val) SetNZP(CPU, val)
+#define SYNC_NZP()
+#define DROP_NZP()
+// retire the instruction just executed, trace it and jump to the next handler;
+// control transfers pass LIMIT() as check, every other op passes nothing
+#define NEXT_CHECKED(check) do { \
+        count++; \
+        if (CPU->PC == 0x80FF) goto done; \
+        TraceWriterLine(trace, CPU); \
+        ClearSignals(CPU); \
+        check; \
+        WATCH(); \
+        d = &cache->insn[CPU->PC]; \
+        PROF(prof->pc_count[CPU->PC]++); \
+        goto *handlers[d->form]; \
+    } while (0)
+#else
+#define SIG(stmt)
+// keep only the last result, the PSR bits follow when a branch or the exit needs them
+#define NZP(val) (nzp_last = (short)(val))
+#define SYNC_NZP() SyncNZP(CPU, &nzp_last)
+#define DROP_NZP() (nzp_last = NZP_SYNCED)
+// 0x80FF decodes to FORM_EXIT, so the exit needs no check of its own
+#define NEXT_CHECKED(check) do { \
+        count++; \
+        check; \
+        WATCH(); \
+        d = &cache->insn[CPU->PC]; \
+        PROF(prof->pc_count[CPU->PC]++); \
+        goto *handlers[d->form]; \
+    } while (0)
+    int nzp_last = NZP_SYNCED;
+    cache->insn[0x80FF].form = FORM_UNDECODED; // make sure the exit entry gets marked
+#endif
+
+#define NEXT() NEXT_CHECKED((void)0)
+#define LIMIT() if (LimitReached(limit, count)) goto stopped
+#define JUMP() NEXT_CHECKED(LIMIT()) // any endless loop runs through one of these
+
+    // the first instruction runs without the exit check, as in UpdateMachineState
+    SIG(ClearSignals(CPU));
+    DecodeInstruction(CPU->memory[CPU->PC], &first);
+    d = &first;
+    PROF(prof->pc_count[CPU->PC]++);
+    goto *handlers[d->form];
+
+undecoded:
+    if (CPU->PC == 0x80FF) { // remember the exit so later visits skip decoding
+        cache->insn[CPU->PC].form = FORM_EXIT;
+        goto done;
+    }
+    DecodeInstruction(CPU->memory[CPU->PC], &cache->insn[CPU->PC]);
+    goto *handlers[d->form];
+
+op_nop:
+    CPU->PC++;
+    NEXT();
+op_br:
+    SYNC_NZP();
+    if ((CPU->PSR & d->rd) != 0) {
+        PROF(prof->taken[CPU->PC]++);
+        CPU->PC = CPU->PC + 1 + d->imm;
+    } else {
+        CPU->PC++;
+    }
+    JUMP();
+op_bra:
+    CPU->PC = CPU->PC + 1 + d->imm;
+    JUMP();
+
+// ALU ops writing Rd
+op_add:
+    return_val = CPU->R[d->rs] + CPU->R[d->rt];
+    goto write_rd;
+op_mul:
+    return_val = CPU->R[d->rs] * CPU->R[d->rt];
+    goto write_rd;
+op_sub:
+    return_val = CPU->R[d->rs] - CPU->R[d->rt];
+    goto write_rd;
+op_div:
+    return_val = (CPU->R[d->rt] != 0) ? CPU->R[d->rs] / CPU->R[d->rt] : 0;
+    goto write_rd;
+op_zero:
+    return_val = 0;
+    goto write_rd;
+op_and:
+    return_val = CPU->R[d->rs] & CPU->R[d->rt];
+    goto write_rd;
+op_not:
+    return_val = ~CPU->R[d->rs];
+    goto write_rd;
+op_or:
+    return_val = CPU->R[d->rs] | CPU->R[d->rt];
+    goto write_rd;
+op_xor:
+    return_val = CPU->R[d->rs] ^ CPU->R[d->rt];
+    goto write_rd;
+op_sll:
+    return_val = CPU->R[d->rs] << d->imm;
+    goto write_rd;
+op_sra:
+    return_val = CPU->R[d->rs] >> d->imm;
+    goto write_rd;
+op_srl:
+    return_val = (short)((unsigned short)CPU->R[d->rs] >> d->imm);
+    goto write_rd;
+op_mod:
+    return_val = (CPU->R[d->rt] != 0) ? CPU->R[d->rs] % CPU->R[d->rt] : 0;
+write_rd:
+    SIG(CPU->rdMux_CTL = d->rd);
+    SIG(CPU->regFile_WE = 1);
+    SIG(CPU->NZP_WE = 1);
+    SIG(CPU->regInputVal = return_val);
+    CPU->R[d->rd] = return_val;
+    NZP(return_val);
+    CPU->PC++;
+    NEXT();
+
+// compares only set NZP
+op_cmp:
+    return_val = CPU->R[d->rs] - CPU->R[d->rt];
+    goto write_nzp;
+op_cmpi:
+    return_val = CPU->R[d->rs] - d->imm;
+    goto write_nzp;
+op_cmpu:
+    return_val = (unsigned short)CPU->R[d->rs] - (unsigned short)CPU->R[d->rt];
+    goto write_nzp;
+op_cmpiu:
+    return_val = (unsigned short)CPU->R[d->rs] - (unsigned short)d->imm;
+write_nzp:
+    SIG(CPU->NZP_WE = 1);
+    NZP(return_val);
+    CPU->PC++;
+    NEXT();
+
+op_jsr:
+op_jsrr:
+{
+    PROF(unsigned short site = CPU->PC);
+    SIG(CPU->regFile_WE = 1);
+    SIG(CPU->rdMux_CTL = 7); // always write to R7
+    SIG(CPU->regInputVal = CPU->PC + 1);
+    CPU->R[7] = CPU->PC + 1;
+    SIG(CPU->NZP_WE = 1);
+    NZP(CPU->R[7]);
+    if (d->form == FORM_JSR) {
+        CPU->PC = CPU->PC + 1 + d->imm;
+    } else {
+        CPU->PC = CPU->R[d->rs] + d->imm; // reads R7 after the link write, like JSROp
+    }
+    PROF(ProfileCall(prof, site, CPU->PC));
+    JUMP();
+}
+op_ldr:
+    SIG(CPU->regFile_WE = 1);
+    SIG(CPU->rdMux_CTL = d->rd);
+    WATCH_MEM(CPU->R[d->rs] + d->imm, WATCH_READ);
+    CPU->R[d->rd] = LOAD((unsigned short)(CPU->R[d->rs] + d->imm));
+    SIG(CPU->regInputVal = CPU->R[d->rd]);
+    SIG(CPU->NZP_WE = 1);
+    NZP(CPU->R[d->rd]);
+    CPU->PC++;
+    NEXT();
+op_str:
+{
+    unsigned short addr = CPU->R[d->rs] + d->imm;
+    SIG(CPU->DATA_WE = 1);
+    SIG(CPU->dmemAddr = addr);
+    SIG(CPU->dmemValue = CPU->R[d->rd]);
+    CPU->memory[addr] = CPU->R[d->rd];
+    STORED(addr);
+    InvalidateDecoded(cache, addr); // the word may be code
+    WATCH_MEM(addr, WATCH_WRITE);
+    CPU->PC++;
+    NEXT();
+}
+op_rti:
+    PROF(ProfileReturn(prof, CPU->PC, CPU->R[7]));
+    DROP_NZP(); // the whole PSR is overwritten
+    CPU->PSR = 0;
+    CPU->PC = CPU->R[7];
+    JUMP();
+op_const:
+    SIG(CPU->regFile_WE = 1);
+    SIG(CPU->rdMux_CTL = d->rd);
+    SIG(CPU->regInputVal = d->imm);
+    CPU->R[d->rd] = d->imm;
+    SIG(CPU->NZP_WE = 1);
+    NZP(CPU->R[d->rd]);
+    CPU->PC++;
+    NEXT();
+op_jmp:
+    CPU->PC = CPU->PC + 1 + d->imm;
+    JUMP();
+op_jmpr:
+    PROF(if (d->rs == 7) ProfileReturn(prof, CPU->PC, CPU->R[7] + d->imm));
+    CPU->PC = CPU->R[d->rs] + d->imm;
+    JUMP();
+op_hiconst:
+    SIG(CPU->regFile_WE = 1);
+    SIG(CPU->NZP_WE = 1);
+    SIG(CPU->rdMux_CTL = d->rd);
+    CPU->R[d->rd] = (CPU->R[d->rd] & 0x00FF) | (d->imm << 8); // keep low 8 bits, set high 8 bits
+    SIG(CPU->regInputVal = CPU->R[d->rd]);
+    NZP(CPU->R[d->rd]);
+    CPU->PC++;
+    NEXT();
+op_trap:
+#if !ENGINE_TRACE
+    if (limit != NULL && limit->traps != NULL && limit->traps->service[d->imm] != NULL) { // TRAP through RTI on the host
+        DROP_NZP(); // RTI overwrites the whole PSR
+        TrapCall(limit->traps, CPU, CPU->PC, d->imm);
+        if (limit->traps->wrote) {
+            TrapInvalidate(limit->traps, cache);
+        }
+        JUMP();
+    }
+#endif
+    CPU->PSR = 1; // enter OS mode
+    SIG(CPU->regFile_WE = 1);
+    SIG(CPU->NZP_WE = 1);
+    SIG(CPU->regInputVal = CPU->PC + 1); // return address
+    SIG(CPU->rdMux_CTL = 7);
+    CPU->R[7] = CPU->PC + 1;
+    NZP(CPU->R[7]);
+    PROF(ProfileCall(prof, CPU->PC, 0x8000 | d->imm));
+    CPU->PC = 0x8000 | d->imm; // jump to trap vector
+    JUMP();
+
+done:
+#if ENGINE_PROFILE && !ENGINE_TRACE
+    prof->pc_count[0x80FF]--; // counted on the way to the exit entry, never executed
+#endif
+#if ENGINE_TRACE
+    printf("reached PC == 0x80FF so we leave the program");
+#endif
+stopped:
+    SYNC_NZP();
+#undef SIG
+#undef NZP
+#undef SYNC_NZP
+#undef DROP_NZP
+#undef NEXT
+#undef NEXT_CHECKED
+#undef LIMIT
+#undef JUMP
+#undef PROF
+#undef WATCH
+#undef WATCH_MEM
+#undef LOAD
+#undef STORED
+    return count;
+}
@@ -0,0 +1,634 @@
+/*
+ * jit.c: Turns hot blocks into x86-64 code and runs it between interpreted blocks
+ */
+
+#include "jit.h"
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * What native code is handed on entry; rbp points here the whole time.
+ */
+typedef struct {
+    const volatile int* stop;  // limit->stop, or a zero
+    int nzp;                   // last NZP result, sign-extended; -1, 0 or 1 from the PSR on entry
+    int store;                 // address of a store into translated code that ended the run, -1 if none
+    unsigned long count;       // instructions executed, updated on return
+    unsigned long max;         // return once count reaches this
+    unsigned short* covered;   // BlockCache covered and dirty
+    unsigned char* dirty;
+    void** native;             // JitCache native
+} JitFrame;
+
+// whether the engines' CPU->R arithmetic is signed, which decides DIV, MOD and SRA
+#define REGS_SIGNED ((__typeof__(((MachineState*)0)->R[0]))-1 < 0)
+
+#if defined(__x86_64__)
+
+// host registers
+enum { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// LC4 R0-R7, zero-extended to 32 bits; ecx holds the last NZP result, rbx the
+// MachineState, rbp the JitFrame, r14 the count and r15 the limit on it
+static const int host[8] = { RSI, RDI, R8, R9, R10, R11, R12, R13 };
+
+// operand size flags for Op and OpMem
+#define OP16 1
+#define OP64 2
+
+// opcodes, 0x0Fxx for the two-byte ones
+#define ADD_RM_R 0x01
+#define OR_RM_R 0x09
+#define AND_RM_R 0x21
+#define SUB_RM_R 0x29
+#define XOR_RM_R 0x31
+#define GROUP_IMM32 0x81 // /0 add, /1 or, /4 and, /5 sub, /7 cmp
+#define GROUP_IMM8 0x83
+#define TEST_RM_R 0x85
+#define CMP_RM_R 0x39
+#define MOV_RM_R 0x89
+#define MOV_R_RM 0x8B
+#define SHIFT_IMM8 0xC1  // /4 shl, /5 shr, /7 sar
+#define MOV_RM_IMM8 0xC6
+#define GROUP_F7 0xF7    // /2 not, /6 div, /7 idiv
+#define GROUP_FF 0xFF    // /4 jmp
+#define IMUL_R_RM 0x0FAF
+#define MOVZX16 0x0FB7
+#define MOVSX16 0x0FBF
+
+// condition codes for Jcc
+enum { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+typedef struct {
+    unsigned char* p; // next byte to write
+} Asm;
+
+static void Emit8(Asm* a, int byte)
+{
+    *a->p++ = byte;
+}
+
+static void Emit32(Asm* a, unsigned int value)
+{
+    memcpy(a->p, &value, 4);
+    a->p += 4;
+}
+
+static void EmitOpcode(Asm* a, int size, int rex, int op)
+{
+    if (size & OP16) {
+        Emit8(a, 0x66);
+    }
+    rex |= (size & OP64) ? 8 : 0;
+    if (rex != 0) {
+        Emit8(a, 0x40 | rex);
+    }
+    if (op > 0xFF) {
+        Emit8(a, op >> 8);
+    }
+    Emit8(a, op & 0xFF);
+}
+
+/*
+ * op with two registers, or a register and an opcode extension in reg.
+ */
+static void Op(Asm* a, int size, int op, int reg, int rm)
+{
+    EmitOpcode(a, size, ((reg & 8) >> 1) | ((rm & 8) >> 3), op);
+    Emit8(a, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/*
+ * op with a memory operand [base + index * 2^scale + disp]; index -1 for none.
+ */
+static void OpMem(Asm* a, int size, int op, int reg, int base, int index, int scale, int disp)
+{
+    EmitOpcode(a, size, ((reg & 8) >> 1) | (index >= 0 ? (index & 8) >> 2 : 0) | ((base & 8) >> 3), op);
+    if (index >= 0 || (base & 7) == RSP) {
+        Emit8(a, 0x80 | (reg & 7) << 3 | 4);
+        Emit8(a, scale << 6 | ((index >= 0 ? index : RSP) & 7) << 3 | (base & 7));
+    } else {
+        Emit8(a, 0x80 | (reg & 7) << 3 | (base & 7));
+    }
+    Emit32(a, disp);
+}
+
+static void MovImm(Asm* a, int reg, unsigned int value)
+{
+    if (reg & 8) {
+        Emit8(a, 0x41);
+    }
+    Emit8(a, 0xB8 + (reg & 7));
+    Emit32(a, value);
+}
+
+static void Push(Asm* a, int reg)
+{
+    if (reg & 8) {
+        Emit8(a, 0x41);
+    }
+    Emit8(a, 0x50 + (reg & 7));
+}
+
+static void Pop(Asm* a, int reg)
+{
+    if (reg & 8) {
+        Emit8(a, 0x41);
+    }
+    Emit8(a, 0x58 + (reg & 7));
+}
+
+static void Jump(Asm* a, const unsigned char* target)
+{
+    Emit8(a, 0xE9);
+    Emit32(a, target - (a->p + 4));
+}
+
+static void JumpIf(Asm* a, int cc, const unsigned char* target)
+{
+    Emit8(a, 0x0F);
+    Emit8(a, 0x80 | cc);
+    Emit32(a, target - (a->p + 4));
+}
+
+/*
+ * A short forward Jcc to be pointed with Land once the target is known.
+ */
+static unsigned char* JumpForward(Asm* a, int cc)
+{
+    Emit8(a, 0x70 | cc);
+    Emit8(a, 0);
+    return a->p;
+}
+
+static void Land(Asm* a, unsigned char* after_jump)
+{
+    after_jump[-1] = a->p - after_jump;
+}
+
+/*
+ * The code every block shares: enter (a C function that loads the host
+ * registers and jumps to the block it is given), dispatch and exit.
+ */
+static void EmitStubs(JitCache* jit, Asm* a)
+{
+    static const int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+    int r_off = offsetof(MachineState, R);
+
+    jit->enter = (void (*)(MachineState*, void*, void*))a->p;
+    for (int i = 0; i < 6; i++) {
+        Push(a, saved[i]);
+    }
+    Op(a, OP64, MOV_RM_R, RDI, RBX);
+    Op(a, OP64, MOV_RM_R, RSI, RBP);
+    Op(a, OP64, MOV_RM_R, RDX, RAX);
+    OpMem(a, OP64, MOV_R_RM, R14, RBP, -1, 0, offsetof(JitFrame, count));
+    OpMem(a, OP64, MOV_R_RM, R15, RBP, -1, 0, offsetof(JitFrame, max));
+    OpMem(a, 0, MOV_R_RM, RCX, RBP, -1, 0, offsetof(JitFrame, nzp));
+    for (int i = 0; i < 8; i++) {
+        OpMem(a, 0, MOVZX16, host[i], RBX, -1, 0, r_off + 2 * i);
+    }
+    Op(a, 0, GROUP_FF, 4, RAX); // jmp rax
+
+    // exit: PC in eax
+    jit->exit = a->p;
+    OpMem(a, OP16, MOV_RM_R, RAX, RBX, -1, 0, offsetof(MachineState, PC));
+    for (int i = 0; i < 8; i++) {
+        OpMem(a, OP16, MOV_RM_R, host[i], RBX, -1, 0, r_off + 2 * i);
+    }
+    OpMem(a, 0, MOV_RM_R, RCX, RBP, -1, 0, offsetof(JitFrame, nzp));
+    OpMem(a, OP64, MOV_RM_R, R14, RBP, -1, 0, offsetof(JitFrame, count));
+    for (int i = 5; i >= 0; i--) {
+        Pop(a, saved[i]);
+    }
+    Emit8(a, 0xC3); // ret
+
+    // dispatch: PC in eax, checked like block_end before going on to its code
+    jit->dispatch = a->p;
+    Op(a, OP64, CMP_RM_R, R15, R14); // cmp r14, r15
+    JumpIf(a, CC_AE, jit->exit);
+    OpMem(a, OP64, MOV_R_RM, RDX, RBP, -1, 0, offsetof(JitFrame, stop));
+    OpMem(a, 0, GROUP_IMM8, 7, RDX, -1, 0, 0); // cmp dword [rdx], 0
+    Emit8(a, 0);
+    JumpIf(a, CC_NE, jit->exit);
+    Op(a, 0, GROUP_IMM32, 7, RAX); // cmp eax, 0x80FF
+    Emit32(a, 0x80FF);
+    JumpIf(a, CC_E, jit->exit);
+    OpMem(a, OP64, MOV_R_RM, RDX, RBP, -1, 0, offsetof(JitFrame, native));
+    OpMem(a, OP64, MOV_R_RM, RDX, RDX, RAX, 3, 0);
+    Op(a, OP64, TEST_RM_R, RDX, RDX);
+    JumpIf(a, CC_E, jit->exit);
+    Op(a, 0, GROUP_FF, 4, RDX); // jmp rdx
+}
+
+static int SetsNZP(int form)
+{
+    switch (form) {
+        case FORM_NOP: case FORM_BR: case FORM_BRA: case FORM_STR: case FORM_RTI:
+        case FORM_JMP: case FORM_JMPR:
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * eax = R[rs] + imm, wrapped to 16 bits.
+ */
+static void EmitAddress(Asm* a, const DecodedInsn* d)
+{
+    Op(a, 0, MOV_RM_R, host[d->rs], RAX);
+    Op(a, 0, GROUP_IMM32, 0, RAX);
+    Emit32(a, (unsigned int)d->imm);
+    Op(a, 0, MOVZX16, RAX, RAX);
+}
+
+/*
+ * eax = R[rs] op R[rt] or op imm for the forms that write Rd. Returns 0 for
+ * a form that isn't one of them.
+ */
+static int EmitAlu(Asm* a, const DecodedInsn* d)
+{
+    int rs = host[d->rs];
+    int rt = host[d->rt];
+    switch (d->form) {
+        case FORM_ZERO:
+            Op(a, 0, XOR_RM_R, RAX, RAX);
+            return 1;
+        case FORM_DIV:
+        case FORM_MOD:
+        {
+            Op(a, 0, XOR_RM_R, RAX, RAX); // 0 when dividing by 0
+            Op(a, 0, TEST_RM_R, rt, rt);
+            unsigned char* zero = JumpForward(a, CC_E);
+            if (REGS_SIGNED) { // int division of the sign-extended values, which can't overflow
+                Push(a, RCX);
+                Op(a, 0, MOVSX16, RCX, rt);
+                Op(a, 0, MOVSX16, RAX, rs);
+                Emit8(a, 0x99); // cdq
+                Op(a, 0, GROUP_F7, 7, RCX);
+                Pop(a, RCX);
+            } else {
+                Op(a, 0, MOV_RM_R, rs, RAX);
+                Op(a, 0, XOR_RM_R, RDX, RDX);
+                Op(a, 0, GROUP_F7, 6, rt);
+            }
+            if (d->form == FORM_MOD) {
+                Op(a, 0, MOV_RM_R, RDX, RAX);
+            }
+            Land(a, zero);
+            return 1;
+        }
+        case FORM_SRA:
+            if (REGS_SIGNED) {
+                Op(a, 0, MOVSX16, RAX, rs);
+                Op(a, 0, SHIFT_IMM8, 7, RAX);
+            } else {
+                Op(a, 0, MOV_RM_R, rs, RAX);
+                Op(a, 0, SHIFT_IMM8, 5, RAX);
+            }
+            Emit8(a, d->imm);
+            return 1;
+        case FORM_ADD: case FORM_MUL: case FORM_SUB: case FORM_AND: case FORM_OR: case FORM_XOR:
+        case FORM_NOT: case FORM_SLL: case FORM_SRL:
+            break;
+        default:
+            return 0;
+    }
+    Op(a, 0, MOV_RM_R, rs, RAX);
+    switch (d->form) {
+        case FORM_ADD: Op(a, 0, ADD_RM_R, rt, RAX); break;
+        case FORM_MUL: Op(a, 0, IMUL_R_RM, RAX, rt); break;
+        case FORM_SUB: Op(a, 0, SUB_RM_R, rt, RAX); break;
+        case FORM_AND: Op(a, 0, AND_RM_R, rt, RAX); break;
+        case FORM_OR: Op(a, 0, OR_RM_R, rt, RAX); break;
+        case FORM_XOR: Op(a, 0, XOR_RM_R, rt, RAX); break;
+        case FORM_NOT: Op(a, 0, GROUP_F7, 2, RAX); break;
+        case FORM_SLL: Op(a, 0, SHIFT_IMM8, 4, RAX); Emit8(a, d->imm); break;
+        default: Op(a, 0, SHIFT_IMM8, 5, RAX); Emit8(a, d->imm); break; // SRL, eax is zero-extended
+    }
+    return 1;
+}
+
+/*
+ * Compile b into the arena. The ops mirror the block engine exactly, and
+ * an op's NZP result only goes to ecx when something can still see it: a
+ * branch, the end of the block or the exit taken by a store into code.
+ * Returns the code, or NULL for a block that starts with TRAP or RTI.
+ */
+static unsigned char* CompileBlock(JitCache* jit, const Block* b)
+{
+    int length = b->length;
+    int last = b->ops[length - 1].d.form;
+    int body = (last == FORM_TRAP || last == FORM_RTI) ? length - 1 : length; // those two go back to the interpreter
+    if (body == 0) {
+        return NULL;
+    }
+    unsigned char keep_nzp[BLOCK_MAX_OPS];
+    int needed = 1;
+    for (int i = body - 1; i >= 0; i--) {
+        keep_nzp[i] = 0;
+        if (SetsNZP(b->ops[i].d.form)) {
+            keep_nzp[i] = needed;
+            needed = 0;
+        }
+        if (b->ops[i].d.form == FORM_STR) {
+            needed = 1;
+        }
+    }
+
+    Asm asm_ = { jit->arena + jit->arena_used };
+    Asm* a = &asm_;
+    unsigned char* code = a->p;
+    int mem_off = offsetof(MachineState, memory);
+    for (int i = 0; i < body; i++) {
+        const BlockOp* op = &b->ops[i];
+        const DecodedInsn* d = &op->d;
+        int rd = host[d->rd];
+        unsigned short next = op->pc + 1;
+        if (EmitAlu(a, d)) {
+            Op(a, 0, MOVZX16, rd, RAX);
+            if (keep_nzp[i]) {
+                Op(a, 0, MOVSX16, RCX, RAX);
+            }
+            continue;
+        }
+        switch (d->form) {
+            case FORM_CMP: case FORM_CMPU: case FORM_CMPI: case FORM_CMPIU:
+                if (keep_nzp[i]) { // all four come down to the low 16 bits of the difference
+                    Op(a, 0, MOV_RM_R, host[d->rs], RCX);
+                    if (d->form == FORM_CMP || d->form == FORM_CMPU) {
+                        Op(a, 0, SUB_RM_R, host[d->rt], RCX);
+                    } else {
+                        Op(a, 0, GROUP_IMM32, 5, RCX);
+                        Emit32(a, (unsigned int)d->imm);
+                    }
+                    Op(a, 0, MOVSX16, RCX, RCX);
+                }
+                break;
+            case FORM_CONST:
+                MovImm(a, rd, (unsigned short)d->imm);
+                if (keep_nzp[i]) {
+                    MovImm(a, RCX, (unsigned int)(int)(short)d->imm);
+                }
+                break;
+            case FORM_HICONST:
+                Op(a, 0, GROUP_IMM32, 4, rd);
+                Emit32(a, 0x00FF);
+                Op(a, 0, GROUP_IMM32, 1, rd);
+                Emit32(a, (unsigned short)(d->imm << 8));
+                if (keep_nzp[i]) {
+                    Op(a, 0, MOVSX16, RCX, rd);
+                }
+                break;
+            case FORM_LDR:
+                EmitAddress(a, d);
+                OpMem(a, 0, MOVZX16, rd, RBX, RAX, 1, mem_off);
+                if (keep_nzp[i]) {
+                    Op(a, 0, MOVSX16, RCX, rd);
+                }
+                break;
+            case FORM_STR:
+            {
+                EmitAddress(a, d);
+                OpMem(a, OP16, MOV_RM_R, rd, RBX, RAX, 1, mem_off);
+                OpMem(a, OP64, MOV_R_RM, RDX, RBP, -1, 0, offsetof(JitFrame, covered));
+                OpMem(a, OP16, GROUP_IMM8, 7, RDX, RAX, 1, 0); // cmp word [rdx + rax * 2], 0
+                Emit8(a, 0);
+                unsigned char* plain = JumpForward(a, CC_E);
+                // wrote into translated code: leave, the interpreter drops what it covers
+                OpMem(a, 0, MOV_RM_R, RAX, RBP, -1, 0, offsetof(JitFrame, store));
+                MovImm(a, RAX, next);
+                Op(a, OP64, GROUP_IMM32, 0, R14);
+                Emit32(a, i + 1);
+                Jump(a, jit->exit);
+                Land(a, plain);
+                Op(a, 0, SHIFT_IMM8, 5, RAX);
+                Emit8(a, PAGE_SHIFT);
+                OpMem(a, OP64, MOV_R_RM, RDX, RBP, -1, 0, offsetof(JitFrame, dirty));
+                OpMem(a, 0, MOV_RM_IMM8, 0, RDX, RAX, 0, 0);
+                Emit8(a, 1);
+                break;
+            }
+            case FORM_JSR:
+            case FORM_JSRR:
+                MovImm(a, host[7], next);
+                if (keep_nzp[i]) {
+                    MovImm(a, RCX, (unsigned int)(int)(short)next);
+                }
+                if (d->form == FORM_JSR) {
+                    MovImm(a, RAX, (unsigned short)(next + d->imm));
+                } else {
+                    EmitAddress(a, d); // reads R7 after the link write, like JSROp
+                }
+                break;
+            case FORM_JMPR:
+                EmitAddress(a, d);
+                break;
+            case FORM_BRA:
+            case FORM_JMP:
+                MovImm(a, RAX, (unsigned short)(next + d->imm));
+                break;
+        }
+    }
+
+    // leave the block
+    Op(a, OP64, GROUP_IMM32, 0, R14);
+    Emit32(a, body);
+    const BlockOp* end = &b->ops[body - 1];
+    switch (body < length ? FORM_TRAP : end->d.form) {
+        case FORM_TRAP: // TRAP or RTI, not run here
+            MovImm(a, RAX, b->ops[body].pc);
+            Jump(a, jit->exit);
+            break;
+        case FORM_BR:
+        {
+            static const int taken_if[8] = { -1, CC_G, CC_E, CC_GE, CC_L, CC_NE, CC_LE, -2 }; // by NZP mask
+            int cc = taken_if[end->d.rd & 7];
+            unsigned short next = end->pc + 1;
+            unsigned short target = next + end->d.imm;
+            if (cc == -2) {
+                next = target;
+            } else if (cc != -1) {
+                Op(a, 0, TEST_RM_R, RCX, RCX);
+                unsigned char* fall = JumpForward(a, cc ^ 1);
+                MovImm(a, RAX, target);
+                Jump(a, jit->dispatch);
+                Land(a, fall);
+            }
+            MovImm(a, RAX, next);
+            Jump(a, jit->dispatch);
+            break;
+        }
+        case FORM_BRA: case FORM_JMP: case FORM_JSR: case FORM_JSRR: case FORM_JMPR: // eax is set
+            Jump(a, jit->dispatch);
+            break;
+        default: // fell through
+            MovImm(a, RAX, b->ops[length].pc);
+            Jump(a, jit->dispatch);
+            break;
+    }
+    jit->arena_used = a->p - jit->arena;
+    return code;
+}
+
+#endif
+
+/*
+ * Set up the JIT over blocks, which it doesn't own.
+ */
+void JitCacheInit(JitCache* jit, BlockCache* blocks)
+{
+    memset(jit->native, 0, sizeof(jit->native));
+    memset(jit->hits, 0, sizeof(jit->hits));
+    jit->blocks = blocks;
+    jit->num_compiled = 0;
+    jit->arena = NULL;
+    jit->arena_used = jit->stub_bytes = 0;
+    jit->block_flushes = blocks->flushes;
+    jit->compiles = jit->invalidated = jit->flushes = 0;
+#if defined(__x86_64__)
+    // never writable and executable at once: written here and in JitCompile, run in between
+    void* arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) { // interpret everything
+        return;
+    }
+    jit->arena = arena;
+    Asm a = { jit->arena };
+    EmitStubs(jit, &a);
+    jit->arena_used = jit->stub_bytes = a.p - jit->arena;
+    if (mprotect(jit->arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC) != 0) { // no executable memory here
+        JitCacheFree(jit);
+    }
+#endif
+}
+
+void JitCacheFree(JitCache* jit)
+{
+    if (jit->arena != NULL) {
+        munmap(jit->arena, JIT_ARENA_SIZE);
+        jit->arena = NULL;
+    }
+}
+
+/*
+ * Drop all native code, keeping the stubs. Also needed after the blocks
+ * were reset.
+ */
+void JitCacheClear(JitCache* jit)
+{
+    memset(jit->native, 0, sizeof(jit->native));
+    memset(jit->hits, 0, sizeof(jit->hits));
+    jit->num_compiled = 0;
+    jit->arena_used = jit->stub_bytes;
+    jit->block_flushes = jit->blocks->flushes;
+    jit->flushes++;
+}
+
+/*
+ * Compile the translated block starting at pc. Returns 1 if it now has
+ * native code.
+ */
+int JitCompile(JitCache* jit, unsigned short pc)
+{
+#if defined(__x86_64__)
+    BlockCache* bc = jit->blocks;
+    if (jit->arena == NULL) {
+        return 0;
+    }
+    if (bc->map[pc] == NULL) { // not translated again yet since it was dropped, try next time
+        jit->hits[pc] = JIT_HOT - 1;
+        return 0;
+    }
+    if (jit->block_flushes != bc->flushes || jit->num_compiled == JIT_MAX_BLOCKS ||
+        JIT_ARENA_SIZE - jit->arena_used < JIT_BLOCK_BYTES) {
+        JitCacheClear(jit);
+    }
+    if (mprotect(jit->arena, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        return 0;
+    }
+    unsigned char* code = CompileBlock(jit, bc->map[pc]);
+    if (mprotect(jit->arena, JIT_ARENA_SIZE, PROT_READ | PROT_EXEC) != 0) { // none of it can run now
+        JitCacheClear(jit);
+        JitCacheFree(jit);
+        return 0;
+    }
+    if (code == NULL) {
+        return 0;
+    }
+    jit->compiled[jit->num_compiled].start = pc;
+    jit->compiled[jit->num_compiled].length = bc->map[pc]->length;
+    jit->num_compiled++;
+    jit->native[pc] = code;
+    jit->compiles++;
+    return 1;
+#else
+    (void)jit;
+    (void)pc;
+    return 0;
+#endif
+}
+
+/*
+ * A store hit translated code: drop the native code of every block
+ * containing address, as BlockInvalidate does for the blocks themselves.
+ */
+void JitInvalidate(JitCache* jit, unsigned short address)
+{
+    for (int i = 0; i < jit->num_compiled; i++) {
+        JitBlock* c = &jit->compiled[i];
+        if (c->length == 0 || (unsigned short)(address - c->start) >= c->length) {
+            continue;
+        }
+        jit->native[c->start] = NULL;
+        jit->hits[c->start] = 0;
+        c->length = 0;
+        jit->invalidated++;
+    }
+}
+
+/*
+ * Run native code from CPU->PC, which has some, until it returns. The PSR
+ * has to be current. count is updated. Returns 0 without running anything
+ * if the PSR doesn't hold exactly one NZP bit (after RTI or a reset, say)
+ * or the blocks were flushed since the code was compiled.
+ */
+int JitRun(JitCache* jit, MachineState* CPU, const RunLimit* limit, unsigned long* count)
+{
+    static const volatile int never = 0;
+    BlockCache* bc = jit->blocks;
+    int nzp = CPU->PSR & 7;
+    if (nzp != 1 && nzp != 2 && nzp != 4) {
+        return 0;
+    }
+    if (jit->block_flushes != bc->flushes) { // native code may cover words nothing guards anymore
+        JitCacheClear(jit);
+        return 0;
+    }
+    JitFrame frame;
+    frame.stop = limit != NULL ? &limit->stop : &never;
+    frame.nzp = nzp == 4 ? -1 : nzp == 2 ? 0 : 1;
+    frame.store = -1;
+    frame.count = *count;
+    frame.max = (limit != NULL && limit->max_insns != 0) ? limit->max_insns : ULONG_MAX;
+    frame.covered = bc->covered;
+    frame.dirty = bc->dirty;
+    frame.native = jit->native;
+    jit->enter(CPU, &frame, jit->native[CPU->PC]);
+
+    *count = frame.count;
+    SetPSRNZP(CPU, frame.nzp);
+    if (frame.store >= 0) {
+        bc->dirty[frame.store >> PAGE_SHIFT] = 1;
+        BlockInvalidate(bc, frame.store);
+        JitInvalidate(jit, frame.store);
+    }
+    return 1;
+}
+
+#define BLOCK_FN RunJit
+#define BLOCK_JIT 1
+#include "block_core.h"
+#undef BLOCK_FN
+#undef BLOCK_JIT
@@ -0,0 +1,57 @@
+/*
+ * jit.h: Compiles hot basic blocks to x86-64 on top of the block engine
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "block.h"
+
+#define JIT_HOT 32                  // times a block is entered before it gets compiled
+#define JIT_ARENA_SIZE (4 << 20)    // bytes of executable memory, flushed when full
+#define JIT_BLOCK_BYTES 4096        // most code one block can compile to
+#define JIT_MAX_BLOCKS 8192         // compiled blocks held before everything is flushed
+
+typedef struct {
+    unsigned short start;
+    unsigned short length; // 0 once invalidated
+} JitBlock;
+
+/*
+ * Native code for the hottest blocks of a BlockCache. The interpreter counts
+ * how often each block starts and compiles one the JIT_HOT'th time; compiled
+ * blocks then jump to each other through native without coming back. They
+ * hold R0-R7 and the last NZP result in host registers, and return to the
+ * interpreter on TRAP, RTI, a store into translated code, an address that
+ * isn't compiled, the end of the program or the limit. Each covers exactly
+ * the words of the block it came from, so the covered counts of the
+ * BlockCache also catch stores into native code.
+ *
+ * Only built for x86-64 hosts; elsewhere, or if no executable memory can be
+ * had, arena stays NULL and RunJit is just the block engine.
+ */
+typedef struct {
+    BlockCache* blocks;             // the interpreter underneath
+    void* native[65536];            // compiled code for the block starting at each address, NULL if none
+    unsigned short hits[65536];     // times each address started a block, until it is compiled
+    JitBlock compiled[JIT_MAX_BLOCKS];
+    int num_compiled;
+    unsigned char* arena;           // mmap'd, executable except while JitCompile writes it, NULL if the JIT is off
+    size_t arena_used;
+    size_t stub_bytes;              // the shared entry, dispatch and exit code at the start of arena
+    void (*enter)(MachineState* CPU, void* frame, void* code);
+    unsigned char* dispatch;        // continue at the PC in eax
+    unsigned char* exit;            // write everything back and return with the PC in eax
+    unsigned long block_flushes;    // blocks->flushes when native was last cleared for it
+    unsigned long compiles, invalidated, flushes;
+} JitCache;
+
+void JitCacheInit(JitCache* jit, BlockCache* blocks);
+void JitCacheFree(JitCache* jit);
+void JitCacheClear(JitCache* jit);
+int JitCompile(JitCache* jit, unsigned short pc);
+void JitInvalidate(JitCache* jit, unsigned short address);
+int JitRun(JitCache* jit, MachineState* CPU, const RunLimit* limit, unsigned long* count);
+unsigned long RunJit(MachineState* CPU, JitCache* jit, const RunLimit* limit);
+
+#endif
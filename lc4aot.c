@@ -0,0 +1,341 @@
+/*
+ * lc4aot.c: main() for compiling the code of object files to C ahead of time
+ */
+
+#include "loader.h"
+#include "debuginfo.h"
+#include "disasm.h"
+
+#define MAX_ENTRIES 64
+
+MachineState CPU_STATE;
+MachineState* CPU = &CPU_STATE;
+DebugInfo DEBUG_INFO;
+DebugInfo* DEBUG = &DEBUG_INFO;
+unsigned char CODE[65536];   // words reached from an entry point, compiled
+unsigned char LEADER[65536]; // words a block starts at
+unsigned short WORK[65536];  // leaders still to follow
+int work_len;
+
+static void AddLeader(unsigned short pc)
+{
+    if (!LEADER[pc]) {
+        LEADER[pc] = 1;
+        WORK[work_len++] = pc;
+    }
+}
+
+static int EndsBlock(int form)
+{
+    switch (form) {
+        case FORM_BR: case FORM_BRA: case FORM_JSR: case FORM_JSRR:
+        case FORM_JMP: case FORM_JMPR: case FORM_RTI: case FORM_TRAP:
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Mark everything reachable from the leaders given so far, following
+ * branches, calls, traps and the returns after them. JMPR, JSRR and RTI
+ * targets aren't known here and go through the dispatch switch instead.
+ * Zero words stop the search: programs run off the end of their code into
+ * them, and compiling all of memory would make every store look like one
+ * into code.
+ */
+static void FindCode(void)
+{
+    while (work_len > 0) {
+        unsigned short pc = WORK[--work_len];
+        while (pc != 0x80FF && CPU->memory[pc] != 0) { // empty memory is left to the interpreter
+            if (CODE[pc]) { // ran into code found earlier, which has to start a block of its own
+                LEADER[pc] = 1;
+                break;
+            }
+            DecodedInsn d;
+            DecodeInstruction(CPU->memory[pc], &d);
+            CODE[pc] = 1;
+            unsigned short next = pc + 1;
+            unsigned short target = next + d.imm;
+            switch (d.form) {
+                case FORM_BR:
+                case FORM_JSR:
+                    AddLeader(target);
+                    AddLeader(next);
+                    break;
+                case FORM_BRA:
+                case FORM_JMP:
+                    AddLeader(target);
+                    break;
+                case FORM_JSRR:
+                    AddLeader(next);
+                    break;
+                case FORM_TRAP:
+                    AddLeader(0x8000 | d.imm);
+                    AddLeader(next);
+                    break;
+            }
+            if (EndsBlock(d.form)) {
+                break;
+            }
+            pc = next;
+        }
+    }
+}
+
+static const char* Reg(int r)
+{
+    static const char* names[8] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7" };
+    return names[r & 7];
+}
+
+/*
+ * Code to carry on at target once a block has counted its instructions.
+ */
+static void EmitGoto(FILE* out, const char* indent, unsigned short target)
+{
+    if (target != 0x80FF && CODE[target]) {
+        fprintf(out, "%sAOT_GOTO(0x%04X, L%04X);\n", indent, target, target);
+    } else {
+        fprintf(out, "%sAOT_LEAVE(0x%04X);\n", indent, target);
+    }
+}
+
+/*
+ * One instruction, written the way block_core.h executes it. n is its
+ * position in the block, counting from 1.
+ */
+static void EmitInsn(FILE* out, unsigned short pc, int n)
+{
+    DecodedInsn d;
+    char text[DISASM_MAX];
+    DecodeInstruction(CPU->memory[pc], &d);
+    Disassemble(pc, CPU->memory[pc], text);
+    fprintf(out, "    // %04X %s\n", pc, text);
+
+    const char* rd = Reg(d.rd);
+    const char* rs = Reg(d.rs);
+    const char* rt = Reg(d.rt);
+    unsigned short next = pc + 1;
+    unsigned short target = next + d.imm;
+    switch (d.form) {
+        case FORM_ADD: fprintf(out, "    rv = %s + %s;\n", rs, rt); break;
+        case FORM_MUL: fprintf(out, "    rv = %s * %s;\n", rs, rt); break;
+        case FORM_SUB: fprintf(out, "    rv = %s - %s;\n", rs, rt); break;
+        case FORM_DIV: fprintf(out, "    rv = (%s != 0) ? %s / %s : 0;\n", rt, rs, rt); break;
+        case FORM_MOD: fprintf(out, "    rv = (%s != 0) ? %s %% %s : 0;\n", rt, rs, rt); break;
+        case FORM_ZERO: fprintf(out, "    rv = 0;\n"); break;
+        case FORM_AND: fprintf(out, "    rv = %s & %s;\n", rs, rt); break;
+        case FORM_NOT: fprintf(out, "    rv = ~%s;\n", rs); break;
+        case FORM_OR: fprintf(out, "    rv = %s | %s;\n", rs, rt); break;
+        case FORM_XOR: fprintf(out, "    rv = %s ^ %s;\n", rs, rt); break;
+        case FORM_SLL: fprintf(out, "    rv = %s << %d;\n", rs, d.imm); break;
+        case FORM_SRA: fprintf(out, "    rv = %s >> %d;\n", rs, d.imm); break;
+        case FORM_SRL: fprintf(out, "    rv = (short)((unsigned short)%s >> %d);\n", rs, d.imm); break;
+        case FORM_CMP: fprintf(out, "    nzp = (short)(%s - %s);\n", rs, rt); return;
+        case FORM_CMPU: fprintf(out, "    nzp = (short)((unsigned short)%s - (unsigned short)%s);\n", rs, rt); return;
+        case FORM_CMPI: fprintf(out, "    nzp = (short)(%s - (%d));\n", rs, d.imm); return;
+        case FORM_CMPIU: fprintf(out, "    nzp = (short)((unsigned short)%s - %u);\n", rs, (unsigned short)d.imm); return;
+        case FORM_CONST:
+            fprintf(out, "    %s = %d;\n    nzp = (short)%s;\n", rd, d.imm, rd);
+            return;
+        case FORM_HICONST:
+            fprintf(out, "    %s = (%s & 0x00FF) | (%d << 8);\n    nzp = (short)%s;\n", rd, rd, d.imm, rd);
+            return;
+        case FORM_LDR:
+            fprintf(out, "    %s = M[(unsigned short)(%s + %d)];\n    nzp = (short)%s;\n", rd, rs, d.imm, rd);
+            return;
+        case FORM_STR:
+            fprintf(out, "    AOT_STORE(%s + %d, %s, 0x%04X, %d);\n", rs, d.imm, rd, next, n);
+            return;
+        case FORM_BR:
+            fprintf(out, "    count += %d;\n    AOT_SYNC();\n    if (psr & %d) {\n", n, d.rd);
+            EmitGoto(out, "        ", target);
+            fprintf(out, "    }\n");
+            EmitGoto(out, "    ", next);
+            return;
+        case FORM_BRA:
+        case FORM_JMP:
+            fprintf(out, "    count += %d;\n", n);
+            EmitGoto(out, "    ", target);
+            return;
+        case FORM_JSR:
+        case FORM_JSRR:
+            fprintf(out, "    R7 = 0x%04X;\n    nzp = (short)R7;\n    count += %d;\n", next, n);
+            if (d.form == FORM_JSR) {
+                EmitGoto(out, "    ", target);
+            } else {
+                fprintf(out, "    AOT_JUMP((unsigned short)(%s + %d)); // reads R7 after the link write, like JSROp\n", rs, d.imm);
+            }
+            return;
+        case FORM_JMPR:
+            fprintf(out, "    count += %d;\n    AOT_JUMP((unsigned short)(%s + %d));\n", n, rs, d.imm);
+            return;
+        case FORM_RTI:
+            fprintf(out, "    nzp = NZP_SYNCED; // the whole PSR is overwritten\n    psr = 0;\n");
+            fprintf(out, "    count += %d;\n    AOT_JUMP(R7);\n", n);
+            return;
+        case FORM_TRAP:
+            fprintf(out, "    psr = 1;\n    R7 = 0x%04X;\n    nzp = (short)R7;\n    count += %d;\n", next, n);
+            EmitGoto(out, "    ", 0x8000 | d.imm);
+            return;
+        default: // NOP
+            return;
+    }
+    fprintf(out, "    %s = rv;\n    nzp = rv;\n", rd);
+}
+
+/*
+ * The memory image, the map of compiled words and AotRun.
+ */
+static void EmitProgram(FILE* out, int num_objs, char** objs)
+{
+    fprintf(out, "/*\n * Generated by lc4aot from");
+    for (int i = 0; i < num_objs; i++) {
+        fprintf(out, " %s", objs[i]);
+    }
+    fprintf(out, ", do not edit\n */\n\n#include \"aot.h\"\n\n");
+
+    fprintf(out, "static const unsigned short image[65536] = {\n");
+    for (int a = 0; a < 65536; a++) {
+        if (CPU->memory[a] == 0) {
+            continue;
+        }
+        if (a == 0 || CPU->memory[a - 1] == 0 || a % 8 == 0) {
+            fprintf(out, "%s    [0x%04X] =", a == 0 ? "" : "\n", a);
+        }
+        fprintf(out, " 0x%04X,", CPU->memory[a]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const unsigned char code_bits[65536 / 8] = {\n");
+    for (int i = 0; i < 65536 / 8; i++) {
+        unsigned char bits = 0;
+        for (int j = 0; j < 8; j++) {
+            bits |= CODE[i * 8 + j] << j;
+        }
+        if (bits != 0) {
+            fprintf(out, "    [0x%04X] = 0x%02X,\n", i, bits);
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "void AotLoadImage(MachineState* CPU)\n{\n");
+    fprintf(out, "    for (int a = 0; a < 65536; a++) {\n        CPU->memory[a] = image[a];\n    }\n}\n\n");
+    fprintf(out, "int AotTranslated(unsigned short address)\n{\n");
+    fprintf(out, "    return (code_bits[address >> 3] >> (address & 7)) & 1;\n}\n\n");
+
+    fprintf(out, "unsigned long AotRun(MachineState* CPU, const RunLimit* limit, unsigned char* dirty, int* wrote_code)\n{\n");
+    fprintf(out, "    static const volatile int never = 0;\n");
+    fprintf(out, "    const volatile int* stop = limit != NULL ? &limit->stop : &never;\n");
+    fprintf(out, "    unsigned long max = (limit != NULL && limit->max_insns != 0) ? limit->max_insns : ULONG_MAX;\n");
+    fprintf(out, "    unsigned long count = 0;\n");
+    fprintf(out, "    __typeof__(CPU->memory[0])* M = CPU->memory;\n");
+    for (int r = 0; r < 8; r++) {
+        fprintf(out, "    __typeof__(CPU->R[0]) R%d = CPU->R[%d];\n", r, r);
+    }
+    fprintf(out, "    unsigned short psr = CPU->PSR;\n");
+    fprintf(out, "    unsigned short pc = CPU->PC;\n");
+    fprintf(out, "    int nzp = NZP_SYNCED; // NZP is set lazily, see SyncNZP\n");
+    fprintf(out, "    short rv;\n\n");
+
+    fprintf(out, "    goto dispatch;\n\ndispatch:\n    switch (pc) {\n");
+    for (int a = 0; a < 65536; a++) {
+        if (LEADER[a] && CODE[a]) {
+            fprintf(out, "        case 0x%04X: goto L%04X;\n", a, a);
+        }
+    }
+    fprintf(out, "        default: goto leave;\n    }\n");
+
+    for (int a = 0; a < 65536; a++) {
+        if (!LEADER[a] || !CODE[a]) {
+            continue;
+        }
+        fprintf(out, "\nL%04X:\n", a);
+        unsigned short pc = a;
+        int n = 0;
+        while (1) {
+            n++;
+            EmitInsn(out, pc, n);
+            DecodedInsn d;
+            DecodeInstruction(CPU->memory[pc], &d);
+            if (EndsBlock(d.form)) {
+                break;
+            }
+            pc++;
+            if (pc == 0x80FF || !CODE[pc] || LEADER[pc]) { // falls through
+                fprintf(out, "    count += %d;\n", n);
+                EmitGoto(out, "    ", pc);
+                break;
+            }
+        }
+    }
+
+    fprintf(out, "\nleave:\n    (void)rv;\n    (void)M;\n    (void)max;\n    (void)stop;\n    (void)dirty;\n    (void)wrote_code;\n    AOT_SYNC();\n");
+    fprintf(out, "    CPU->PC = pc;\n    CPU->PSR = psr;\n");
+    for (int r = 0; r < 8; r++) {
+        fprintf(out, "    CPU->R[%d] = R%d;\n", r, r);
+    }
+    fprintf(out, "    return count;\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    char* entries[MAX_ENTRIES]; // -a: more addresses or labels to compile from
+    int num_entries = 0;
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc && num_entries < MAX_ENTRIES) {
+            entries[num_entries++] = argv[arg + 1];
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (argc - arg < 2) {
+        printf("usage: %s [-a address]... output.c obj...\n", argv[0]);
+        printf("then: clang -O2 output.c aotrun.c and the simulator objects, see the Makefile\n");
+        return -1;
+    }
+
+    memset(CPU->memory, 0, sizeof(CPU->memory));
+    Reset(CPU);
+    DebugInfoInit(DEBUG);
+    for (int i = arg + 1; i < argc; i++) {
+        if (ReadObjectFileDebug(argv[i], CPU, DEBUG) != 0) {
+            printf("Error: Failed to read object file %s\n", argv[i]);
+            return -1;
+        }
+    }
+    DebugInfoFinish(DEBUG);
+
+    AddLeader(CPU->PC);
+    for (int i = 0; i < num_entries; i++) {
+        unsigned short address;
+        if (DebugParseAddress(DEBUG, entries[i], &address) != 0) {
+            printf("Error: bad address %s\n", entries[i]);
+            return -1;
+        }
+        AddLeader(address);
+    }
+    FindCode();
+
+    FILE* out = fopen(argv[arg], "w");
+    if (out == NULL) {
+        printf("Error: Cannot create output file %s\n", argv[arg]);
+        return -1;
+    }
+    EmitProgram(out, argc - arg - 1, argv + arg + 1);
+    int words = 0, blocks = 0;
+    for (int a = 0; a < 65536; a++) {
+        words += CODE[a];
+        blocks += LEADER[a] && CODE[a];
+    }
+    if (fclose(out) != 0) {
+        printf("Error: Cannot write output file %s\n", argv[arg]);
+        return -1;
+    }
+    printf("%d words in %d blocks compiled to %s\n", words, blocks, argv[arg]);
+    return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * lc4db.c: main() for a command-line debugger that can step forwards and backwards
+ */
+
+#include "loader.h"
+#include "debuginfo.h"
+#include "undo.h"
+
+MachineState CPU_STATE;
+MachineState* CPU = &CPU_STATE;
+DecodeCache DECODE_CACHE;
+DecodeCache* DECODE = &DECODE_CACHE;
+DebugInfo DEBUG_INFO;
+DebugInfo* DEBUG = &DEBUG_INFO;
+UndoLog UNDO_LOG;
+UndoLog* UNDO = &UNDO_LOG;
+unsigned char BREAKPOINTS[65536 / 8]; // bit per address
+
+static int IsBreakpoint(unsigned short pc)
+{
+    return BREAKPOINTS[pc >> 3] & (1 << (pc & 7));
+}
+
+/*
+ * One line with the instruction count, where the PC is and the registers.
+ */
+static void PrintState(void)
+{
+    unsigned short offset;
+    const char* label = DebugSymbolAt(DEBUG, CPU->PC, &offset);
+    printf("[%lu] PC %04X", UNDO->count, CPU->PC);
+    if (label != NULL) {
+        printf(" <%s+%u>", label, offset);
+    }
+    printf(" insn %04X PSR %04X", CPU->memory[CPU->PC], CPU->PSR);
+    for (int i = 0; i < 8; i++) {
+        printf(" R%d %04X", i, (unsigned short)CPU->R[i]);
+    }
+    printf("\n");
+}
+
+static void Usage(void)
+{
+    printf("s [n]      step n instructions\n");
+    printf("rs [n]     step back n instructions\n");
+    printf("c          continue to a breakpoint or the end\n");
+    printf("rc         go back to a breakpoint or the start\n");
+    printf("g n        go to the state after n instructions\n");
+    printf("b addr     set a breakpoint, addr in hex or a label\n");
+    printf("d addr     delete a breakpoint\n");
+    printf("p          print the state\n");
+    printf("x addr [n] print n memory words\n");
+    printf("q          quit\n");
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    unsigned long entries = 1 << 20; // -u: undo entries kept
+    unsigned long snapshot_every = 0; // -k: instructions between snapshots, 0 for one ring's worth
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-u") == 0 && arg + 1 < argc) {
+            entries = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc) {
+            snapshot_every = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (argc - arg < 1) {
+        printf("usage: %s [-u undo_entries] [-k snapshot_every] obj...\n", argv[0]);
+        return -1;
+    }
+
+    memset(CPU->memory, 0, sizeof(CPU->memory));
+    Reset(CPU);
+    ClearDecodeCache(DECODE);
+    DebugInfoInit(DEBUG);
+    for (int i = arg; i < argc; i++) {
+        if (ReadObjectFileDebug(argv[i], CPU, DEBUG) != 0) {
+            printf("Error: Failed to read object file %s\n", argv[i]);
+            return -1;
+        }
+    }
+    DebugInfoFinish(DEBUG);
+    if (UndoInit(UNDO, CPU, entries, snapshot_every) != 0) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+
+    char line[256];
+    char cmd[16];
+    char operand[128];
+    unsigned long n;
+    unsigned short address;
+    PrintState();
+    while (printf("(lc4db) "), fflush(stdout), fgets(line, sizeof(line), stdin) != NULL) {
+        int fields = sscanf(line, "%15s %127s %lu", cmd, operand, &n);
+        if (fields < 1) {
+            continue;
+        }
+        if (strcmp(cmd, "s") == 0 || strcmp(cmd, "rs") == 0) {
+            n = (fields >= 2) ? strtoul(operand, NULL, 0) : 1;
+            int back = cmd[0] == 'r';
+            for (unsigned long i = 0; i < n; i++) {
+                if (back ? UndoReverseStep(UNDO, CPU, DECODE) != 0 : UndoStep(UNDO, CPU, DECODE) != 0) {
+                    break;
+                }
+            }
+            PrintState();
+        } else if (strcmp(cmd, "c") == 0) {
+            while (UndoStep(UNDO, CPU, DECODE) == 0 && !IsBreakpoint(CPU->PC)) {
+            }
+            PrintState();
+        } else if (strcmp(cmd, "rc") == 0) {
+            while (UndoReverseStep(UNDO, CPU, DECODE) == 0 && !IsBreakpoint(CPU->PC)) {
+            }
+            PrintState();
+        } else if (strcmp(cmd, "g") == 0 && fields >= 2) {
+            if (UndoSeek(UNDO, CPU, DECODE, strtoul(operand, NULL, 0)) != 0) {
+                printf("program ended first\n");
+            }
+            PrintState();
+        } else if ((strcmp(cmd, "b") == 0 || strcmp(cmd, "d") == 0) && fields >= 2) {
+            if (DebugParseAddress(DEBUG, operand, &address) != 0) {
+                printf("Error: unknown address %s\n", operand);
+            } else if (cmd[0] == 'b') {
+                BREAKPOINTS[address >> 3] |= 1 << (address & 7);
+            } else {
+                BREAKPOINTS[address >> 3] &= ~(1 << (address & 7));
+            }
+        } else if (strcmp(cmd, "p") == 0) {
+            PrintState();
+        } else if (strcmp(cmd, "x") == 0 && fields >= 2) {
+            if (DebugParseAddress(DEBUG, operand, &address) != 0) {
+                printf("Error: unknown address %s\n", operand);
+                continue;
+            }
+            if (fields < 3) {
+                n = 1;
+            }
+            for (unsigned long i = 0; i < n; i++, address++) {
+                printf("%04X %04X\n", address, CPU->memory[address]);
+            }
+        } else if (strcmp(cmd, "q") == 0) {
+            break;
+        } else {
+            Usage();
+        }
+    }
+    UndoFree(UNDO);
+    DebugInfoFree(DEBUG);
+    return 0;
+}
@@ -3,10 +3,13 @@
  */
 
 #include "loader.h"
-
-// memory array location
-unsigned short memoryAddress;
-
+#include "debuginfo.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 unsigned short convert_endianness(unsigned short x) { //measure the endianness
    	unsigned short smaller_bits = (x & 0x00FF) << 8; 
@@ -15,146 +18,205 @@ unsigned short convert_endianness(unsigned short x) { //measure the endianness
     return complete_string;
 }
 
-/* 
- * Read an object file and modify the machine state as described in the writeup
+/*
+ * Byte-swap count big-endian words from the file straight into memory,
+ * wrapping at the top of the address space. A plain loop over whole words
+ * so the compiler can vectorize it.
  */
-int ReadObjectFile(char* filename, MachineState* CPU)
+static void CopySwapped(unsigned short* memory, unsigned short address, const unsigned char* src, unsigned int count)
 {
-  FILE* file = fopen(filename, "rb"); // opens the file
-	if (file == NULL) { // if no file, throw error
-			printf("error 1: no file \n");
-			return -1;
+	while (count > 0) {
+		unsigned int run = 65536 - address; // words before the address wraps
+		if (run > count) {
+			run = count;
+		}
+		unsigned short* dst = memory + address;
+		for (unsigned int i = 0; i < run; i++) {
+			dst[i] = (unsigned short)((src[2 * i] << 8) | src[2 * i + 1]);
+		}
+		src += 2 * run;
+		count -= run;
+		address = 0;
 	}
-	printf("File opened successfully: %s\n", filename);
+}
 
-	unsigned short section_type, address, count, data; // variables for reading file sections
+/*
+ * Read one big-endian header word at *pos, advancing pos. Returns -1 if the
+ * file ends first.
+ */
+static int ReadWord(const unsigned char* data, size_t size, size_t* pos, unsigned short* value)
+{
+	if (size - *pos < 2) {
+		return -1;
+	}
+	*value = (unsigned short)((data[*pos] << 8) | data[*pos + 1]);
+	*pos += 2;
+	return 0;
+}
 
-	while (fread(&section_type, sizeof(unsigned short), 1, file) == 1) { // parse the various file headers:
+/*
+ * Walk the sections of an object file that is already in memory. Symbols,
+ * file names and line numbers go to debug when it isn't NULL.
+ */
+static int ParseObjectFile(const unsigned char* data, size_t size, MachineState* CPU, DebugInfo* debug)
+{
+	size_t pos = 0;
+	unsigned short section_type, address, count; // variables for reading file sections
+
+	while (size - pos >= 2) { // parse the various file headers:
 	// 0xCADE, 0xDADA, 0xC3B7, 0xF17E, 0x715E
-			//printf("Read section type: 0x%04X (before endianness)\n", section_type);
-			//section_type = convert_endianness(section_type);
-			printf("Section type after conversion: 0x%04X\n", section_type);
-			section_type = convert_endianness(section_type); // set endianness for header
+			unsigned short raw_type;
+			memcpy(&raw_type, data + pos, 2); // as fread would have seen it
+			printf("Section type after conversion: 0x%04X\n", raw_type);
+			ReadWord(data, size, &pos, &section_type); // set endianness for header
 
 			switch (section_type) { // case/break for header, loop through each section
 			case 0xCADE: // CODE
+			case 0xDADA: // DATA
 			{
-				if (fread(&address, sizeof(unsigned short), 1, file) != 1) { // read addr where code should be loaded
-						fclose(file);
-						printf("error 2: code adddr not loaded \n");
+				int is_code = section_type == 0xCADE;
+				if (ReadWord(data, size, &pos, &address) != 0) { // read addr where the section should be loaded
+						printf(is_code ? "error 2: code adddr not loaded \n" : "error 5: data addr not loaded \n");
 						return -1;
 				}
-				address = convert_endianness(address); // addr in obj file w/ correct endianness
-
-				if (fread(&count, sizeof(unsigned short), 1, file) != 1) { // get number of instrs
-						fclose(file);
-						printf("error 3: code instructions not loaded \n");
+				if (ReadWord(data, size, &pos, &count) != 0) { // get number of words
+						printf(is_code ? "error 3: code instructions not loaded \n" : "error 6: data values not loaded \n");
 						return -1;
 				}
-				count = convert_endianness(count); // our number of instrs
-
-				
-				for (int i = 0; i < count; i++) { //get each instr and store in CPU mem
-						if (fread(&data, sizeof(unsigned short), 1, file) != 1) {
-								fclose(file);
-								printf("error 4: instruction %d of %d in code section \n", i+1, count);
-								return -1;
-						}
-
-						CPU->memory[address + i] = convert_endianness(data); // populate mem with the CODE data at the given addr
-				}
-				//printf("Processing %s section at address 0x%04X with %d items\n", 
-       	//section_type == 0xCADE ? "CODE" : "DATA", address, count);
-				break;
-			}
-
-			case 0xDADA: // DATA
-			{
-				if (fread(&address, sizeof(unsigned short), 1, file) != 1) { // read addr where data should be loaded
-					fclose(file);
-					printf("error 5: data addr not loaded \n");
-					return -1;
-				}
-				address = convert_endianness(address); // addr in obj file w/ correct endianness
-
-				if (fread(&count, sizeof(unsigned short), 1, file) != 1) { // get number of data values
-					fclose(file);
-					printf("error 6: data values not loaded \n");
-					return -1;
-				}
-				count = convert_endianness(count); // our number of data values
 
-				for (int i = 0; i < count; i++) { //get each data value and store in CPU mem
-					if (fread(&data, sizeof(unsigned short), 1, file) != 1) {
-						fclose(file);
-						printf("error 7: data value %d of %d in data section \n", i+1, count);
+				size_t available = (size - pos) / 2; // whole words left in the file
+				if (available < count) {
+						printf(is_code ? "error 4: instruction %d of %d in code section \n" : "error 7: data value %d of %d in data section \n",
+						       (int)available + 1, count);
 						return -1;
-					}
-					CPU->memory[address + i] = convert_endianness(data); // populate mem with the DATA values at the given addr
 				}
-				//printf("Processing %s section at address 0x%04X with %d items\n", 
-       	//section_type == 0xDADA ? "CODE" : "DATA", address, count);
+				CopySwapped(CPU->memory, address, data + pos, count); // populate mem with the whole block at once
+				pos += 2 * (size_t)count;
 				break;
 			}
 
 			case 0xC3B7: // SYMBOL
 			{
-				if (fread(&address, sizeof(unsigned short), 1, file) != 1) { // read addr (part of header but not used)
-					fclose(file);
+				if (ReadWord(data, size, &pos, &address) != 0) { // read addr (part of header but not used)
 					printf("error 8: symbol addr not loaded \n");
 					return -1;
 				}
-				address = convert_endianness(address);
-
-				if (fread(&count, sizeof(unsigned short), 1, file) != 1) { // get length of symbol string
-					fclose(file);
+				if (ReadWord(data, size, &pos, &count) != 0) { // get length of symbol string
 					printf("error 9: symbol string length not loaded \n");
 					return -1;
 				}
-				count = convert_endianness(count); // our symbol string length
-
-				fseek(file, count, SEEK_CUR);
-
+				if (debug != NULL && size - pos >= count) { // keep the label for lookups
+					DebugInfoAddSymbol(debug, address, (const char*)data + pos, count);
+				}
+				pos = (size - pos < count) ? size : pos + count; // skip the string
 				break;
 			}
 
 			case 0xF17E: // FILENAME
 			{
-				if (fread(&count, sizeof(unsigned short), 1, file) != 1) { // get length of filename string
-					fclose(file);
+				if (ReadWord(data, size, &pos, &count) != 0) { // get length of filename string
 					printf("error 10: filename string length not loaded \n");
 					return -1;
 				}
-				count = convert_endianness(count); // our filename string length
-
-				fseek(file, count, SEEK_CUR);
+				if (debug != NULL && size - pos >= count) {
+					DebugInfoAddFile(debug, (const char*)data + pos, count);
+				}
+				pos = (size - pos < count) ? size : pos + count; // skip the string
 				break;
 			}
 
 			case 0x715E: // LINE NUMBER
 			{
-				unsigned short line_num, file_index; // read rest of header (addr, line number, file index)
-				if (fread(&address, sizeof(unsigned short), 1, file) != 1 ||
-				    fread(&line_num, sizeof(unsigned short), 1, file) != 1 ||
-				    fread(&file_index, sizeof(unsigned short), 1, file) != 1) {
-					fclose(file);
+				if (size - pos < 6) { // rest of header (addr, line number, file index)
 					printf("error 11: line number header not loaded \n");
 					return -1;
 				}
-				 address = convert_endianness(address);
-				 line_num = convert_endianness(line_num);
-				 file_index = convert_endianness(file_index);
-				
+				unsigned short line_num = 0, file_index = 0;
+				ReadWord(data, size, &pos, &address);
+				ReadWord(data, size, &pos, &line_num);
+				ReadWord(data, size, &pos, &file_index);
+				if (debug != NULL) {
+					DebugInfoAddLine(debug, address, line_num, file_index);
+				}
 				break;
 			}
 
 			default:
-				fclose(file); // we're in an unknown section
-				printf("error 12: unknown section type 0x%04X \n", section_type);
+				printf("error 12: unknown section type 0x%04X \n", section_type); // we're in an unknown section
 				return -1;
 		}
 	}
+	return 0; // no errors thrown
+}
 
-	fclose(file);
-  return 0; // no errors thrown
+/* 
+ * Read an object file and modify the machine state as described in the writeup
+ */
+int ReadObjectFile(char* filename, MachineState* CPU)
+{
+	return ReadObjectFileDebug(filename, CPU, NULL);
+}
+
+/*
+ * ReadObjectFile that also keeps the debug sections in debug (may be NULL).
+ * The file is mapped once and walked in place; if it can't be mapped (a pipe,
+ * say) it is read into a buffer instead.
+ */
+int ReadObjectFileDebug(char* filename, MachineState* CPU, DebugInfo* debug)
+{
+	int fd = open(filename, O_RDONLY); // opens the file
+	if (fd < 0) { // if no file, throw error
+			printf("error 1: no file \n");
+			return -1;
+	}
+	printf("File opened successfully: %s\n", filename);
+
+	struct stat st;
+	unsigned char* data = NULL;
+	size_t size = 0;
+	int mapped = 0;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		size = st.st_size;
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			data = NULL;
+		} else {
+			mapped = 1;
+		}
+	}
+	if (!mapped) { // read the whole thing instead
+		size_t capacity = 0;
+		ssize_t got;
+		size = 0;
+		do {
+			if (size == capacity) {
+				capacity = capacity ? 2 * capacity : 65536;
+				unsigned char* bigger = realloc(data, capacity);
+				if (bigger == NULL) {
+					free(data);
+					close(fd);
+					printf("error 1: no file \n");
+					return -1;
+				}
+				data = bigger;
+			}
+			got = read(fd, data + size, capacity - size);
+			if (got > 0) {
+				size += got;
+			}
+		} while (got > 0);
+	}
+	close(fd);
+
+	if (debug != NULL) {
+		DebugInfoBeginObject(debug); // line records index this file's names
+	}
+	int result = ParseObjectFile(data, size, CPU, debug);
+
+	if (mapped) {
+		munmap(data, size);
+	} else {
+		free(data);
+	}
+	return result;
 }
@@ -0,0 +1,145 @@
+/*
+ * lockbench.c: main() for timing the lockstep engine against running each machine on its own
+ */
+
+#include "loader.h"
+#include "engine.h"
+#include "lockstep.h"
+#include <stdlib.h>
+#include <time.h>
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Give lane its own inputs: the loaded image with R0 = base + lane and,
+ * with spread set, R1-R6 filled from a per-lane seed too.
+ */
+static void SetInputs(MachineState* CPU, MachineState* image, int lane, int base, int spread)
+{
+    memcpy(CPU, image, sizeof(MachineState));
+    CPU->R[0] = base + lane;
+    unsigned int seed = 2654435761u * (lane + 1);
+    for (int i = 1; i < 7 && spread; i++) {
+        seed = seed * 1103515245u + 12345u;
+        CPU->R[i] = seed >> 16;
+    }
+}
+
+/*
+ * Whether two runs ended in the same architectural state.
+ */
+static int SameState(MachineState* a, MachineState* b)
+{
+    return a->PC == b->PC && a->PSR == b->PSR && memcmp(a->R, b->R, sizeof(a->R)) == 0 &&
+           memcmp(a->memory, b->memory, sizeof(a->memory)) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    int num_lanes = 32;             // -n: machines per run
+    int reps = 10;                  // -r: times each way is timed
+    int base = 0;                   // -i: R0 of lane 0, lane l gets base + l
+    int spread = 0;                 // -s: also vary R1-R6 between lanes
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            num_lanes = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            reps = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-i") == 0 && arg + 1 < argc) {
+            base = strtol(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-s") == 0) {
+            spread = 1;
+            arg++;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if (argc - arg < 1 || num_lanes < 1 || reps < 1) {
+        printf("usage: %s [-n lanes] [-r reps] [-i R0] [-s] obj...\n", argv[0]);
+        return -1;
+    }
+
+    MachineState* image = malloc(sizeof(MachineState));
+    MachineState* machines = malloc(num_lanes * sizeof(MachineState));
+    MachineState* expected = malloc(num_lanes * sizeof(MachineState));
+    MachineState** lanes = malloc(num_lanes * sizeof(MachineState*));
+    unsigned long* counts = malloc(num_lanes * sizeof(unsigned long));
+    DecodeCache* cache = malloc(sizeof(DecodeCache));
+    FILE* null_output = fopen("/dev/null", "w");
+    if (image == NULL || machines == NULL || expected == NULL || lanes == NULL || counts == NULL || cache == NULL || null_output == NULL) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    memset(image->memory, 0, sizeof(image->memory));
+    Reset(image);
+    for (int i = arg; i < argc; i++) {
+        if (ReadObjectFile(argv[i], image) != 0) {
+            printf("Error: Failed to read object file %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    // scalar reference: UpdateMachineState once per machine, trace thrown away
+    unsigned long ref_insns = 0;
+    double t = Now();
+    for (int r = 0; r < reps; r++) {
+        for (int l = 0; l < num_lanes; l++) {
+            SetInputs(&machines[l], image, l, base, spread);
+            do {
+                ref_insns++;
+            } while (UpdateMachineState(&machines[l], null_output) == 0);
+        }
+    }
+    double ref_time = Now() - t;
+
+    // the fastest scalar engine, once per machine
+    unsigned long threaded_insns = 0;
+    t = Now();
+    for (int r = 0; r < reps; r++) {
+        for (int l = 0; l < num_lanes; l++) {
+            SetInputs(&expected[l], image, l, base, spread);
+            ClearDecodeCache(cache);
+            threaded_insns += RunThreadedNoTrace(&expected[l], cache, NULL, NULL);
+        }
+    }
+    double threaded_time = Now() - t;
+
+    // all machines at once
+    unsigned long lock_insns = 0;
+    t = Now();
+    for (int r = 0; r < reps; r++) {
+        for (int l = 0; l < num_lanes; l++) {
+            SetInputs(&machines[l], image, l, base, spread);
+            lanes[l] = &machines[l];
+        }
+        lock_insns += RunLockstep(lanes, num_lanes, cache, NULL, counts);
+    }
+    double lock_time = Now() - t;
+
+    int mismatches = 0;
+    for (int l = 0; l < num_lanes; l++) {
+        if (!SameState(&machines[l], &expected[l])) {
+            printf("lane %d: lockstep state differs from the threaded engine\n", l);
+            mismatches++;
+        }
+    }
+
+    printf("%d lanes x %d reps, %lu instructions per rep\n", num_lanes, reps, threaded_insns / reps);
+    printf("UpdateMachineState %10.3fs %10.1f MIPS\n", ref_time, ref_insns / ref_time / 1e6);
+    printf("RunThreadedNoTrace %10.3fs %10.1f MIPS\n", threaded_time, threaded_insns / threaded_time / 1e6);
+    printf("RunLockstep        %10.3fs %10.1f MIPS  %.2fx threaded, %.2fx reference\n", lock_time,
+           lock_insns / lock_time / 1e6, threaded_time / lock_time * lock_insns / threaded_insns,
+           ref_time / lock_time * lock_insns / ref_insns);
+    fclose(null_output);
+    return mismatches ? 1 : 0;
+}
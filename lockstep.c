@@ -0,0 +1,307 @@
+/*
+ * lockstep.c: Runs machines together in groups of LOCKSTEP_LANES, one vector op per instruction
+ */
+
+#include "lockstep.h"
+#include <string.h>
+
+// registers keep whatever type LC4.h gives them, so vector ops wrap and
+// shift exactly like the scalar engines
+typedef __typeof__(((MachineState*)0)->R[0]) RegWord;
+typedef RegWord RegVec __attribute__((vector_size(LOCKSTEP_LANES * sizeof(RegWord))));
+typedef unsigned short WordVec __attribute__((vector_size(LOCKSTEP_LANES * sizeof(unsigned short))));
+typedef short MaskVec __attribute__((vector_size(LOCKSTEP_LANES * sizeof(short)))); // -1 in each selected lane
+
+// a where m is set, b elsewhere
+#define BLEND(m, a, b) ((((a) & (__typeof__(b))(m)) | ((b) & ~(__typeof__(b))(m))))
+// x in every lane
+#define SPLAT(type, x) ((type){ 0 } + (x))
+
+// NZP bits of a result in every lane, as SetPSRNZP computes them
+#define NZP_BITS(result) ({ \
+        MaskVec s_ = (MaskVec)(result); \
+        MaskVec pos_ = s_ > 0; \
+        MaskVec zero_ = s_ == 0; \
+        (WordVec)((pos_ & 1) | (zero_ & 2) | (~(pos_ | zero_) & 4)); \
+    })
+
+/*
+ * Run the machines in lanes[0..num_lanes), at most LOCKSTEP_LANES of them,
+ * as one vector group to 0x80FF, each ending in the same state
+ * RunThreadedNoTrace would leave it in. limit applies to each machine on
+ * its own and, as in the threaded engine, is only looked at on control
+ * transfers. Machines at the same PC execute together: one vector op for
+ * all of them while they agree on the instruction, with loads, stores and
+ * division done lane by lane. When branches split them up, the machines
+ * at the lowest PC go first and the others wait until it catches up with
+ * them. cache is scratch space for decoding code that every lane has the
+ * same copy of. Returns the instructions the group executed; per-lane
+ * counts go to counts.
+ */
+static unsigned long RunGroup(MachineState** lanes, int num_lanes, DecodeCache* cache, const RunLimit* limit, unsigned long* counts)
+{
+    RegVec R[8];
+    WordVec PC, PSR;
+    unsigned short* memory[LOCKSTEP_LANES];
+    unsigned char page_same[NUM_PAGES]; // every lane holds the same words here
+    MaskVec active;                     // lanes still running
+    MaskVec mask;                       // lanes at lead, executing together
+    int full;                           // mask is every active lane, so no blending
+    int split;                          // some lanes at lead have a different instruction
+    unsigned short lead = 0;            // PC of the lanes in mask
+    unsigned short stop;                // lead value at which the group has to be rebuilt
+    unsigned long steps = 0;            // instructions the group ran since it formed
+    unsigned long total = 0;
+    DecodedInsn local;
+    const DecodedInsn* d;
+    RegVec v;
+
+    memset(R, 0, sizeof(R));
+    memset(&PC, 0, sizeof(PC));
+    memset(&PSR, 0, sizeof(PSR));
+    memset(&active, 0, sizeof(active));
+    memset(&mask, 0, sizeof(mask));
+    for (int l = 0; l < LOCKSTEP_LANES; l++) {
+        memory[l] = lanes[l < num_lanes ? l : 0]->memory;
+        if (l < num_lanes) {
+            for (int i = 0; i < 8; i++) {
+                R[i][l] = lanes[l]->R[i];
+            }
+            PC[l] = lanes[l]->PC;
+            PSR[l] = lanes[l]->PSR;
+            active[l] = -1;
+            counts[l] = 0;
+        }
+    }
+    for (int page = 0; page < NUM_PAGES; page++) {
+        int first = page << PAGE_SHIFT;
+        page_same[page] = 1;
+        for (int l = 1; l < num_lanes && page_same[page]; l++) {
+            page_same[page] = memcmp(&memory[0][first], &memory[l][first], PAGE_WORDS * sizeof(unsigned short)) == 0;
+        }
+    }
+    ClearDecodeCache(cache);
+
+regroup:
+    for (int l = 0; l < num_lanes; l++) {
+        if (mask[l]) {
+            counts[l] += steps;
+            total += steps;
+        }
+        if (active[l] && ((PC[l] == 0x80FF && counts[l] > 0) || LimitReached(limit, counts[l]))) { // done or stopped, hand the lane back
+            for (int i = 0; i < 8; i++) {
+                lanes[l]->R[i] = R[i][l];
+            }
+            lanes[l]->PC = PC[l];
+            lanes[l]->PSR = PSR[l];
+            active[l] = 0;
+        }
+    }
+    steps = 0;
+
+    // lowest PC goes next; the first lane above it is where the group stops
+    int found = 0;
+    for (int l = 0; l < num_lanes; l++) {
+        if (active[l] && (!found || PC[l] < lead)) {
+            lead = PC[l];
+            found = 1;
+        }
+    }
+    if (!found) {
+        return total;
+    }
+    stop = 0x80FF; // where lanes finish, unless a waiting lane comes first
+    int stop_ahead = lead < 0x80FF;
+    full = 1;
+    for (int l = 0; l < LOCKSTEP_LANES; l++) {
+        mask[l] = (active[l] && PC[l] == lead) ? -1 : 0;
+        if (active[l] && PC[l] != lead) {
+            full = 0;
+            if (!stop_ahead || PC[l] < stop) {
+                stop = PC[l];
+                stop_ahead = 1;
+            }
+        }
+    }
+
+fetch:
+    split = 0;
+    if (page_same[lead >> PAGE_SHIFT]) {
+        d = FetchDecoded(cache, lanes[0], lead);
+    } else { // lanes may disagree, run the ones matching the first lane
+        int first = 0;
+        while (!mask[first]) {
+            first++;
+        }
+        unsigned short word = memory[first][lead];
+        for (int l = first + 1; l < num_lanes; l++) {
+            if (mask[l] && memory[l][lead] != word) {
+                mask[l] = 0;
+                split = 1;
+            }
+        }
+        if (split) {
+            full = 0;
+        }
+        DecodeInstruction(word, &local);
+        d = &local;
+    }
+    steps++;
+
+// write a register or the NZP bits in the lanes of the group
+#define WRITE(dst, val) ((dst) = full ? (val) : BLEND(mask, (val), (dst)))
+#define WRITE_NZP(bits) WRITE(PSR, (PSR & 0xFFF8) | (bits))
+
+    switch (d->form) {
+        case FORM_NOP:
+            goto straight;
+        case FORM_ADD:
+            v = R[d->rs] + R[d->rt];
+            goto write_rd;
+        case FORM_MUL:
+            v = R[d->rs] * R[d->rt];
+            goto write_rd;
+        case FORM_SUB:
+            v = R[d->rs] - R[d->rt];
+            goto write_rd;
+        case FORM_DIV:
+        case FORM_MOD:
+            v = R[d->rd];
+            for (int l = 0; l < num_lanes; l++) {
+                if (mask[l]) {
+                    RegWord a = R[d->rs][l];
+                    RegWord b = R[d->rt][l];
+                    v[l] = (b != 0) ? (d->form == FORM_DIV ? a / b : a % b) : 0;
+                }
+            }
+            goto write_rd;
+        case FORM_ZERO:
+            v = SPLAT(RegVec, 0);
+            goto write_rd;
+        case FORM_AND:
+            v = R[d->rs] & R[d->rt];
+            goto write_rd;
+        case FORM_NOT:
+            v = ~R[d->rs];
+            goto write_rd;
+        case FORM_OR:
+            v = R[d->rs] | R[d->rt];
+            goto write_rd;
+        case FORM_XOR:
+            v = R[d->rs] ^ R[d->rt];
+            goto write_rd;
+        case FORM_SLL:
+            v = (RegVec)((WordVec)R[d->rs] << d->imm);
+            goto write_rd;
+        case FORM_SRA:
+            v = R[d->rs] >> d->imm;
+            goto write_rd;
+        case FORM_SRL:
+            v = (RegVec)((WordVec)R[d->rs] >> d->imm);
+            goto write_rd;
+        case FORM_CONST:
+            v = SPLAT(RegVec, (RegWord)d->imm);
+            goto write_rd;
+        case FORM_HICONST:
+            v = (R[d->rd] & 0x00FF) | (RegWord)(d->imm << 8); // keep low 8 bits, set high 8 bits
+            goto write_rd;
+        case FORM_CMP:
+        case FORM_CMPU:
+            v = R[d->rs] - R[d->rt];
+            WRITE_NZP(NZP_BITS(v));
+            goto straight;
+        case FORM_CMPI:
+        case FORM_CMPIU:
+            v = R[d->rs] - (RegWord)d->imm;
+            WRITE_NZP(NZP_BITS(v));
+            goto straight;
+        case FORM_LDR:
+            v = R[d->rd];
+            for (int l = 0; l < num_lanes; l++) {
+                if (mask[l]) {
+                    v[l] = memory[l][(unsigned short)(R[d->rs][l] + d->imm)];
+                }
+            }
+            goto write_rd;
+        case FORM_STR:
+            for (int l = 0; l < num_lanes; l++) {
+                if (mask[l]) {
+                    unsigned short addr = R[d->rs][l] + d->imm;
+                    memory[l][addr] = R[d->rd][l];
+                    page_same[addr >> PAGE_SHIFT] = 0; // fetched lane by lane from now on
+                }
+            }
+            goto straight;
+
+        // control transfers end the group
+        case FORM_BR: {
+            MaskVec taken = (MaskVec)(PSR & d->rd) != 0;
+            WordVec next = SPLAT(WordVec, (unsigned short)(lead + 1));
+            PC = BLEND(mask, BLEND(taken, next + (unsigned short)d->imm, next), PC);
+            goto regroup;
+        }
+        case FORM_BRA:
+        case FORM_JMP: {
+            PC = BLEND(mask, SPLAT(WordVec, (unsigned short)(lead + 1 + d->imm)), PC);
+            goto regroup;
+        }
+        case FORM_JSR:
+        case FORM_JSRR:
+        case FORM_TRAP: {
+            v = SPLAT(RegVec, (RegWord)(lead + 1));
+            WRITE(R[7], v);
+            if (d->form == FORM_TRAP) {
+                WRITE(PSR, NZP_BITS(v)); // PSR = 1, then only the NZP bits survive SetNZP
+            } else {
+                WRITE_NZP(NZP_BITS(v));
+            }
+            WordVec next;
+            if (d->form == FORM_JSR) {
+                next = SPLAT(WordVec, (unsigned short)(lead + 1 + d->imm));
+            } else if (d->form == FORM_JSRR) {
+                next = (WordVec)R[d->rs] + (unsigned short)d->imm; // reads R7 after the link write, like JSROp
+            } else {
+                next = SPLAT(WordVec, (unsigned short)(0x8000 | d->imm)); // jump to trap vector
+            }
+            PC = BLEND(mask, next, PC);
+            goto regroup;
+        }
+        case FORM_JMPR:
+            PC = BLEND(mask, (WordVec)R[d->rs] + (unsigned short)d->imm, PC);
+            goto regroup;
+        case FORM_RTI:
+            WRITE(PSR, SPLAT(WordVec, 0));
+            PC = BLEND(mask, (WordVec)R[7], PC);
+            goto regroup;
+        default: // FORM_UNDECODED and FORM_EXIT never come out of DecodeInstruction
+            goto straight;
+    }
+
+write_rd:
+    WRITE(R[d->rd], v);
+    WRITE_NZP(NZP_BITS(v));
+straight:
+    lead++;
+    if (split || lead == stop) { // lanes that waited or finished need sorting out
+        PC = BLEND(mask, SPLAT(WordVec, lead), PC);
+        goto regroup;
+    }
+    goto fetch;
+
+#undef WRITE
+#undef WRITE_NZP
+}
+
+/*
+ * Run any number of machines, LOCKSTEP_LANES at a time, with RunGroup.
+ * Returns the total instructions executed; per-lane counts go to counts.
+ */
+unsigned long RunLockstep(MachineState** lanes, int num_lanes, DecodeCache* cache, const RunLimit* limit, unsigned long* counts)
+{
+    unsigned long total = 0;
+    for (int first = 0; first < num_lanes; first += LOCKSTEP_LANES) {
+        int group = num_lanes - first < LOCKSTEP_LANES ? num_lanes - first : LOCKSTEP_LANES;
+        total += RunGroup(lanes + first, group, cache, limit, counts + first);
+    }
+    return total;
+}
@@ -0,0 +1,20 @@
+/*
+ * lockstep.h: Runs several machines on the same program at once, registers held in vector lanes
+ */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "decode.h"
+#include "engine.h"
+
+// machines per vector group: one vector register of 16-bit words; RunLockstep takes any number
+#ifdef __AVX2__
+#define LOCKSTEP_LANES 16
+#else
+#define LOCKSTEP_LANES 8
+#endif
+
+unsigned long RunLockstep(MachineState** lanes, int num_lanes, DecodeCache* cache, const RunLimit* limit, unsigned long* counts);
+
+#endif
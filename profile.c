@@ -0,0 +1,243 @@
+/*
+ * profile.c: Collects call edges and writes the profile report at exit
+ */
+
+#include "profile.h"
+#include "decode.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define REPORT_TOP 20 // rows per ranked table
+
+static const char* form_names[FORM_COUNT] = {
+    [FORM_UNDECODED] = "?", [FORM_NOP] = "NOP", [FORM_BR] = "BR", [FORM_BRA] = "BRnzp",
+    [FORM_ADD] = "ADD", [FORM_MUL] = "MUL", [FORM_SUB] = "SUB", [FORM_DIV] = "DIV",
+    [FORM_ZERO] = "ARTH/LOG imm", [FORM_CMP] = "CMP", [FORM_CMPU] = "CMPU", [FORM_CMPI] = "CMPI",
+    [FORM_CMPIU] = "CMPIU", [FORM_JSR] = "JSR", [FORM_JSRR] = "JSRR", [FORM_AND] = "AND",
+    [FORM_NOT] = "NOT", [FORM_OR] = "OR", [FORM_XOR] = "XOR", [FORM_LDR] = "LDR",
+    [FORM_STR] = "STR", [FORM_RTI] = "RTI", [FORM_CONST] = "CONST", [FORM_SLL] = "SLL",
+    [FORM_SRA] = "SRA", [FORM_SRL] = "SRL", [FORM_MOD] = "MOD", [FORM_JMP] = "JMP",
+    [FORM_JMPR] = "JMPR", [FORM_HICONST] = "HICONST", [FORM_TRAP] = "TRAP", [FORM_EXIT] = "EXIT",
+};
+
+typedef struct {
+    unsigned short start;
+    unsigned int length;
+    unsigned long count; // executions of the block
+} Block;
+
+/*
+ * Clear all counters.
+ */
+void ProfileInit(Profile* prof)
+{
+    memset(prof, 0, sizeof(*prof));
+}
+
+// count one edge, probing from a hash of its ends
+static void CountEdge(Profile* prof, unsigned short site, unsigned short target, int ret)
+{
+    unsigned int slot = ((site * 31u) ^ target ^ (ret << 11)) & (PROFILE_CALL_SLOTS - 1);
+    for (int probe = 0; probe < PROFILE_CALL_SLOTS; probe++) {
+        CallEdge* edge = &prof->calls[slot];
+        if (edge->count == 0) {
+            edge->site = site;
+            edge->target = target;
+            edge->ret = ret;
+        }
+        if (edge->site == site && edge->target == target && edge->ret == ret) {
+            edge->count++;
+            return;
+        }
+        slot = (slot + 1) & (PROFILE_CALL_SLOTS - 1);
+    }
+    prof->calls_dropped++;
+}
+
+/*
+ * Count one JSR, JSRR or TRAP from site to target. Only runs on calls, so a hash
+ * probe here doesn't show up in the per-cycle cost.
+ */
+void ProfileCall(Profile* prof, unsigned short site, unsigned short target)
+{
+    CountEdge(prof, site, target, 0);
+}
+
+/*
+ * Count one JMPR R7 or RTI at from going back to to. The link register
+ * holds the address after the JSR, JSRR or TRAP, so the edge is keyed by
+ * the call site to - 1 without keeping a stack of calls.
+ */
+void ProfileReturn(Profile* prof, unsigned short from, unsigned short to)
+{
+    CountEdge(prof, to - 1, from, 1);
+}
+
+/*
+ * Write "LABEL+off file:line" for address into buf, empty without debug info.
+ */
+const char* ProfileLabel(DebugInfo* debug, unsigned short address, char* buf, size_t size)
+{
+    unsigned short offset;
+    const char* file;
+    int line;
+    const char* name = (debug != NULL) ? DebugSymbolAt(debug, address, &offset) : NULL;
+    int n = 0;
+
+    buf[0] = '\0';
+    if (name != NULL) {
+        n = snprintf(buf, size, offset ? "%s+%d" : "%s", name, offset);
+    }
+    if (debug != NULL && DebugLineAt(debug, address, &file, &line) == 0 && n >= 0 && (size_t)n < size) {
+        snprintf(buf + n, size - n, "%s%s:%d", n ? " " : "", file, line);
+    }
+    return buf;
+}
+
+static int IsControlFlow(int form)
+{
+    switch (form) {
+        case FORM_BR: case FORM_BRA: case FORM_JSR: case FORM_JSRR:
+        case FORM_JMP: case FORM_JMPR: case FORM_RTI: case FORM_TRAP:
+            return 1;
+    }
+    return 0;
+}
+
+static int CompareBlocks(const void* a, const void* b)
+{
+    const Block* x = a;
+    const Block* y = b;
+    unsigned long wx = x->count * x->length;
+    unsigned long wy = y->count * y->length;
+    return (wx < wy) - (wx > wy); // heaviest first
+}
+
+static int CompareEdges(const void* a, const void* b)
+{
+    const CallEdge* x = a;
+    const CallEdge* y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/*
+ * Write the profile: totals, hottest basic blocks, instruction mix, branch
+ * outcomes, and call and return edges. Forms come from decoding memory as
+ * it is at exit, so code rewritten during the run is reported in its last
+ * shape.
+ */
+void ProfileReport(Profile* prof, MachineState* CPU, DebugInfo* debug, FILE* output)
+{
+    unsigned long total = 0;
+    unsigned long form_count[FORM_COUNT] = { 0 };
+    int distinct = 0;
+    int num_blocks = 0;
+    Block* blocks = malloc(65536 * sizeof(Block));
+    unsigned char forms[65536];
+    char label[128], label2[128];
+
+    // instruction mix and basic blocks in one pass over the address space
+    int open_block = 0;
+    for (int a = 0; a < 65536; a++) {
+        unsigned long n = prof->pc_count[a];
+        DecodedInsn d;
+        DecodeInstruction(CPU->memory[a], &d);
+        forms[a] = d.form;
+        if (n == 0) {
+            open_block = 0;
+            continue;
+        }
+        total += n;
+        distinct++;
+        form_count[d.form] += n;
+        if (blocks != NULL) {
+            // a block continues while counts match and the previous word fell through
+            if (!open_block || blocks[num_blocks - 1].count != n) {
+                blocks[num_blocks].start = a;
+                blocks[num_blocks].length = 0;
+                blocks[num_blocks].count = n;
+                num_blocks++;
+            }
+            blocks[num_blocks - 1].length++;
+        }
+        open_block = !IsControlFlow(d.form);
+    }
+
+    fprintf(output, "== summary ==\n");
+    fprintf(output, "instructions %lu\n", total);
+    fprintf(output, "distinct PCs %d\n", distinct);
+    fprintf(output, "basic blocks %d\n", num_blocks);
+
+    fprintf(output, "\n== hot basic blocks ==\n");
+    fprintf(output, "start end   length executions  instructions   share  label\n");
+    if (blocks != NULL) {
+        qsort(blocks, num_blocks, sizeof(Block), CompareBlocks);
+        for (int i = 0; i < num_blocks && i < REPORT_TOP; i++) {
+            unsigned long weight = blocks[i].count * blocks[i].length;
+            fprintf(output, "%04X  %04X  %6u %10lu %13lu %6.2f%%  %s\n", blocks[i].start,
+                    (blocks[i].start + blocks[i].length - 1) & 0xFFFF, blocks[i].length, blocks[i].count,
+                    weight, total ? 100.0 * weight / total : 0.0, ProfileLabel(debug, blocks[i].start, label, sizeof(label)));
+        }
+        free(blocks);
+    }
+
+    fprintf(output, "\n== instruction mix ==\n");
+    for (int f = 0; f < FORM_COUNT; f++) {
+        if (form_count[f] != 0) {
+            fprintf(output, "%-13s %13lu %6.2f%%\n", form_names[f], form_count[f], 100.0 * form_count[f] / total);
+        }
+    }
+
+    // branches ranked by how often they ran, reusing a block array for sorting
+    fprintf(output, "\n== branches ==\n");
+    fprintf(output, "pc        executions        taken    not taken  label\n");
+    Block* branches = malloc(65536 * sizeof(Block));
+    int num_branches = 0;
+    for (int a = 0; a < 65536 && branches != NULL; a++) {
+        if (prof->pc_count[a] != 0 && forms[a] == FORM_BR) {
+            branches[num_branches].start = a;
+            branches[num_branches].length = 1;
+            branches[num_branches].count = prof->pc_count[a];
+            num_branches++;
+        }
+    }
+    if (branches != NULL) {
+        qsort(branches, num_branches, sizeof(Block), CompareBlocks);
+        for (int i = 0; i < num_branches && i < REPORT_TOP; i++) {
+            unsigned short a = branches[i].start;
+            fprintf(output, "%04X %15lu %12lu %12lu  %s\n", a, prof->pc_count[a], prof->taken[a],
+                    prof->pc_count[a] - prof->taken[a], ProfileLabel(debug, a, label, sizeof(label)));
+        }
+        free(branches);
+    }
+
+    fprintf(output, "\n== call graph ==\n");
+    fprintf(output, "site -> target      calls  caller -> callee\n");
+    CallEdge edges[PROFILE_CALL_SLOTS];
+    int num_edges = 0;
+    for (int i = 0; i < PROFILE_CALL_SLOTS; i++) {
+        if (prof->calls[i].count != 0) {
+            edges[num_edges++] = prof->calls[i];
+        }
+    }
+    qsort(edges, num_edges, sizeof(CallEdge), CompareEdges);
+    for (int ret = 0; ret < 2; ret++) {
+        if (ret) {
+            fprintf(output, "\n== returns ==\n");
+            fprintf(output, "site <- return    returns  caller <- callee\n");
+        }
+        int shown = 0;
+        for (int i = 0; i < num_edges && shown < REPORT_TOP; i++) {
+            if (edges[i].ret != ret) {
+                continue;
+            }
+            fprintf(output, "%04X %s %04X %12lu  %s %s %s\n", edges[i].site, ret ? "<-" : "->", edges[i].target, edges[i].count,
+                    ProfileLabel(debug, edges[i].site, label, sizeof(label)), ret ? "<-" : "->",
+                    ProfileLabel(debug, edges[i].target, label2, sizeof(label2)));
+            shown++;
+        }
+    }
+    if (prof->calls_dropped != 0) {
+        fprintf(output, "(%lu calls and returns on edges past the first %d not shown)\n", prof->calls_dropped, PROFILE_CALL_SLOTS);
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ * profile.h: Per-PC execution counters and the hot spot report built from them
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "LC4.h"
+#include "debuginfo.h"
+#include <stdio.h>
+
+#define PROFILE_CALL_SLOTS 4096 // distinct call and return edges kept, more land in calls_dropped
+
+typedef struct {
+    unsigned short site;   // address of the JSR/JSRR/TRAP, or of the call a return went back past
+    unsigned short target; // where a call went, or the JMPR R7/RTI that returned
+    int ret;               // 1 for a return edge
+    unsigned long count;   // 0 for an empty slot
+} CallEdge;
+
+typedef struct {
+    unsigned long pc_count[65536]; // times each address was executed
+    unsigned long taken[65536];    // times a conditional branch at each address was taken
+    CallEdge calls[PROFILE_CALL_SLOTS];
+    unsigned long calls_dropped;
+} Profile;
+
+void ProfileInit(Profile* prof);
+void ProfileCall(Profile* prof, unsigned short site, unsigned short target);
+void ProfileReturn(Profile* prof, unsigned short from, unsigned short to);
+void ProfileReport(Profile* prof, MachineState* CPU, DebugInfo* debug, FILE* output);
+const char* ProfileLabel(DebugInfo* debug, unsigned short address, char* buf, size_t size);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * snapshot.c: Takes machine snapshots and resets machines to them page by page
+ */
+
+#include "snapshot.h"
+#include <string.h>
+
+/*
+ * Record CPU as it is now. cache must be CPU's and up to date with its
+ * memory (cleared after loading, say); its dirty pages start over from here.
+ */
+void SnapshotTake(Snapshot* snap, MachineState* CPU, DecodeCache* cache)
+{
+    memcpy(&snap->state, CPU, sizeof(MachineState));
+    memset(cache->dirty, 0, sizeof(cache->dirty));
+}
+
+/*
+ * Put a machine started from snap back the way the snapshot has it. Only
+ * pages marked dirty since the snapshot or last restore are copied; decoded
+ * entries on clean pages stay valid for the next run. Memory written
+ * without going through the engines (loading more files, say) isn't
+ * tracked; call SnapshotMarkChanged after it.
+ */
+void SnapshotRestore(Snapshot* snap, MachineState* CPU, DecodeCache* cache)
+{
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (cache->dirty[page]) {
+            int first = page << PAGE_SHIFT;
+            memcpy(&CPU->memory[first], &snap->state.memory[first], PAGE_WORDS * sizeof(CPU->memory[0]));
+            memset(&cache->insn[first], 0, PAGE_WORDS * sizeof(DecodedInsn));
+            cache->dirty[page] = 0;
+        }
+    }
+    CPU->PC = snap->state.PC;
+    CPU->PSR = snap->state.PSR;
+    memcpy(CPU->R, snap->state.R, sizeof(CPU->R));
+    ClearSignals(CPU);
+}
+
+/*
+ * Mark dirty every page that differs from the snapshot, for memory changed
+ * behind the engines' back, such as an input file loaded over a restored
+ * machine.
+ */
+void SnapshotMarkChanged(Snapshot* snap, MachineState* CPU, DecodeCache* cache)
+{
+    for (int page = 0; page < NUM_PAGES; page++) {
+        int first = page << PAGE_SHIFT;
+        if (!cache->dirty[page] && memcmp(&CPU->memory[first], &snap->state.memory[first], PAGE_WORDS * sizeof(CPU->memory[0])) != 0) {
+            InvalidatePage(cache, page);
+        }
+    }
+}
@@ -0,0 +1,24 @@
+/*
+ * snapshot.h: Loaded machine images that runs can be reset to without reloading
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "LC4.h"
+#include "decode.h"
+
+/*
+ * A machine as it was right after loading. Machines started from it keep
+ * the decode cache's dirty pages as their copy-on-write record, so a reset
+ * only copies back the pages a run stored to.
+ */
+typedef struct {
+    MachineState state;
+} Snapshot;
+
+void SnapshotTake(Snapshot* snap, MachineState* CPU, DecodeCache* cache);
+void SnapshotRestore(Snapshot* snap, MachineState* CPU, DecodeCache* cache);
+void SnapshotMarkChanged(Snapshot* snap, MachineState* CPU, DecodeCache* cache);
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * timing.c: Pipeline stalls, branch predictors and caches behind the -t report
+ */
+
+#include "timing.h"
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PIPELINE_FILL 4  // cycles before the first instruction reaches W
+#define REPORT_TOP 20    // rows of stall hot spots
+#define NZP_BIT (1 << 8) // in the register masks below
+
+static const char* predictor_names[] = { "static", "bimodal", "gshare" };
+static const char* kind_names[TIMING_KINDS] = { "load-use", "mispredict", "indirect", "icache", "dcache" };
+
+static void CacheInit(TimingCache* c)
+{
+    c->lines = 0;
+    c->line_words = 4;
+    c->hit_cycles = 1;
+    c->miss_cycles = 10;
+}
+
+/*
+ * Defaults: static prediction, 1024 counters for the other predictors, a
+ * 2-cycle mispredict penalty, 1-cycle load-use stall, and caches that
+ * always hit.
+ */
+void TimingInit(Timing* t)
+{
+    memset(t, 0, sizeof(*t));
+    t->predictor = TIMING_STATIC;
+    t->table_bits = 10;
+    t->mispredict_penalty = 2;
+    t->load_use_penalty = 1;
+    CacheInit(&t->icache);
+    CacheInit(&t->dcache);
+    memset(t->counters, 1, sizeof(t->counters)); // weakly not taken
+}
+
+/*
+ * Set one machine parameter from the command line, "key=value":
+ * predictor=static|bimodal|gshare, bits, mispredict, load_use, and for
+ * the caches icache and dcache (lines, 0 for always hit), line (words,
+ * both caches), ihit, imiss, dhit and dmiss (cycles). Returns 0, or -1
+ * for an unknown key or a value out of range.
+ */
+int TimingParse(Timing* t, const char* spec)
+{
+    const char* equals = strchr(spec, '=');
+    if (equals == NULL) {
+        return -1;
+    }
+    size_t length = equals - spec;
+    const char* value = equals + 1;
+    if (length == 9 && strncmp(spec, "predictor", 9) == 0) {
+        for (int i = 0; i < 3; i++) {
+            if (strcmp(value, predictor_names[i]) == 0) {
+                t->predictor = i;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    struct {
+        const char* key;
+        int* field;
+        long min, max;
+    } keys[] = {
+        { "bits", &t->table_bits, 1, TIMING_MAX_TABLE_BITS },
+        { "mispredict", &t->mispredict_penalty, 0, 1000 },
+        { "load_use", &t->load_use_penalty, 0, 1000 },
+        { "icache", &t->icache.lines, 0, TIMING_MAX_LINES },
+        { "dcache", &t->dcache.lines, 0, TIMING_MAX_LINES },
+        { "line", &t->icache.line_words, 1, 65536 },
+        { "ihit", &t->icache.hit_cycles, 1, 1000 },
+        { "imiss", &t->icache.miss_cycles, 1, 1000 },
+        { "dhit", &t->dcache.hit_cycles, 1, 1000 },
+        { "dmiss", &t->dcache.miss_cycles, 1, 1000 },
+    };
+    char* end;
+    long number = strtol(value, &end, 0);
+    for (int i = 0; i < (int)(sizeof(keys) / sizeof(keys[0])); i++) {
+        if (strlen(keys[i].key) != length || strncmp(spec, keys[i].key, length) != 0) {
+            continue;
+        }
+        if (end == value || *end != '\0' || number < keys[i].min || number > keys[i].max) {
+            return -1;
+        }
+        *keys[i].field = number;
+        t->dcache.line_words = t->icache.line_words; // one line size for both
+        return 0;
+    }
+    return -1;
+}
+
+// extra cycles for one access, filling the line on a miss
+static int CacheAccess(TimingCache* c, unsigned short address)
+{
+    c->accesses++;
+    if (c->lines == 0) {
+        return c->hit_cycles - 1;
+    }
+    unsigned int line = address / c->line_words;
+    unsigned int* tag = &c->tags[line % c->lines];
+    if (*tag == line + 1) {
+        return c->hit_cycles - 1;
+    }
+    *tag = line + 1;
+    c->misses++;
+    return c->miss_cycles - 1;
+}
+
+// registers an instruction reads in decode or execute, as a mask
+static unsigned int Reads(const DecodedInsn* d)
+{
+    switch (d->form) {
+        case FORM_ADD: case FORM_MUL: case FORM_SUB: case FORM_DIV: case FORM_MOD:
+        case FORM_AND: case FORM_OR: case FORM_XOR: case FORM_CMP: case FORM_CMPU:
+            return (1 << d->rs) | (1 << d->rt);
+        case FORM_NOT: case FORM_SLL: case FORM_SRA: case FORM_SRL: case FORM_CMPI: case FORM_CMPIU:
+        case FORM_LDR: case FORM_JMPR:
+            return 1 << d->rs;
+        case FORM_STR: // the data only has to be there by M, where the load bypasses to it
+            return 1 << d->rs;
+        case FORM_JSRR: // R7 is the link written first
+            return d->rs == 7 ? 0 : 1 << d->rs;
+        case FORM_HICONST:
+            return 1 << d->rd;
+        case FORM_RTI:
+            return 1 << 7;
+        case FORM_BR:
+            return NZP_BIT;
+    }
+    return 0;
+}
+
+// guess a conditional branch, then train on what it did
+static int Predict(Timing* t, const DecodedInsn* d, unsigned short pc, int taken)
+{
+    unsigned int mask = (1u << t->table_bits) - 1;
+    unsigned char* counter = &t->counters[(t->predictor == TIMING_GSHARE ? pc ^ t->history : pc) & mask];
+    int guess = t->predictor == TIMING_STATIC ? d->imm < 0 : *counter >= 2;
+    if (taken && *counter < 3) {
+        (*counter)++;
+    } else if (!taken && *counter > 0) {
+        (*counter)--;
+    }
+    t->history = ((t->history << 1) | taken) & mask;
+    return guess;
+}
+
+static void Stall(Timing* t, unsigned short pc, int kind, int cycles)
+{
+    t->stalls[kind] += cycles;
+    t->pc_stalls[pc] += cycles;
+}
+
+/*
+ * Account for the instruction d at pc that just retired, going on to
+ * next_pc. address is the word an LDR or STR accessed.
+ */
+void TimingRetire(Timing* t, const DecodedInsn* d, unsigned short pc, unsigned short next_pc, unsigned short address)
+{
+    t->insns++;
+    t->pc_insns[pc]++;
+    Stall(t, pc, TIMING_ICACHE, CacheAccess(&t->icache, pc));
+    if (t->loaded & Reads(d)) {
+        Stall(t, pc, TIMING_LOAD_USE, t->load_use_penalty);
+    }
+    t->loaded = d->form == FORM_LDR ? (1u << d->rd) | NZP_BIT : 0;
+
+    switch (d->form) {
+        case FORM_BR:
+        {
+            int taken = next_pc != (unsigned short)(pc + 1);
+            t->branches++;
+            if (Predict(t, d, pc, taken) != taken) {
+                t->mispredicts++;
+                Stall(t, pc, TIMING_MISPREDICT, t->mispredict_penalty);
+            }
+            break;
+        }
+        case FORM_JMPR: case FORM_JSRR: case FORM_RTI:
+            Stall(t, pc, TIMING_INDIRECT, t->mispredict_penalty);
+            break;
+        case FORM_LDR: case FORM_STR:
+            Stall(t, pc, TIMING_DCACHE, CacheAccess(&t->dcache, address));
+            break;
+    }
+}
+
+typedef struct {
+    unsigned short pc;
+    unsigned long stalls;
+} HotSpot;
+
+static int CompareHotSpots(const void* a, const void* b)
+{
+    const HotSpot* x = a;
+    const HotSpot* y = b;
+    return (x->stalls < y->stalls) - (x->stalls > y->stalls);
+}
+
+static void CacheReport(const char* name, TimingCache* c, FILE* output)
+{
+    fprintf(output, "%s %6d %5d %4d %5d %13lu %12lu %8.2f%%\n", name, c->lines, c->line_words, c->hit_cycles,
+            c->miss_cycles, c->accesses, c->misses, c->accesses ? 100.0 * c->misses / c->accesses : 0.0);
+}
+
+/*
+ * Write the timing report: cycles and CPI, where the stalls came from,
+ * branch and cache behavior, and the addresses that stalled the most.
+ */
+void TimingReport(Timing* t, DebugInfo* debug, FILE* output)
+{
+    unsigned long stalled = 0;
+    for (int k = 0; k < TIMING_KINDS; k++) {
+        stalled += t->stalls[k];
+    }
+    unsigned long cycles = t->insns != 0 ? t->insns + PIPELINE_FILL + stalled : 0;
+    char label[128];
+
+    fprintf(output, "== timing ==\n");
+    fprintf(output, "predictor %s", predictor_names[t->predictor]);
+    if (t->predictor != TIMING_STATIC) {
+        fprintf(output, ", %d counters", 1 << t->table_bits);
+    }
+    fprintf(output, "\ninstructions %lu\n", t->insns);
+    fprintf(output, "cycles %lu\n", cycles);
+    fprintf(output, "CPI %.3f\n", t->insns ? (double)cycles / t->insns : 0.0);
+
+    fprintf(output, "\n== stalls ==\n");
+    fprintf(output, "kind              cycles  per insn   share\n");
+    for (int k = 0; k < TIMING_KINDS; k++) {
+        fprintf(output, "%-10s %13lu %9.3f %6.2f%%\n", kind_names[k], t->stalls[k],
+                t->insns ? (double)t->stalls[k] / t->insns : 0.0, cycles ? 100.0 * t->stalls[k] / cycles : 0.0);
+    }
+
+    fprintf(output, "\n== branches ==\n");
+    fprintf(output, "conditional %lu\n", t->branches);
+    fprintf(output, "mispredicted %lu (%.2f%%)\n", t->mispredicts, t->branches ? 100.0 * t->mispredicts / t->branches : 0.0);
+
+    fprintf(output, "\n== caches ==\n");
+    fprintf(output, "        lines words  hit  miss      accesses       misses  miss rate\n");
+    CacheReport("icache", &t->icache, output);
+    CacheReport("dcache", &t->dcache, output);
+
+    fprintf(output, "\n== stall hot spots ==\n");
+    fprintf(output, "pc        executions  stall cycles  per exec   share  label\n");
+    HotSpot* spots = malloc(65536 * sizeof(HotSpot));
+    int num_spots = 0;
+    for (int a = 0; a < 65536 && spots != NULL; a++) {
+        if (t->pc_stalls[a] != 0) {
+            spots[num_spots].pc = a;
+            spots[num_spots].stalls = t->pc_stalls[a];
+            num_spots++;
+        }
+    }
+    if (spots != NULL) {
+        qsort(spots, num_spots, sizeof(HotSpot), CompareHotSpots);
+        for (int i = 0; i < num_spots && i < REPORT_TOP; i++) {
+            unsigned short a = spots[i].pc;
+            fprintf(output, "%04X %15lu %13lu %9.3f %6.2f%%  %s\n", a, t->pc_insns[a], spots[i].stalls,
+                    (double)spots[i].stalls / t->pc_insns[a], 100.0 * spots[i].stalls / stalled,
+                    ProfileLabel(debug, a, label, sizeof(label)));
+        }
+        free(spots);
+    }
+}
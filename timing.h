@@ -0,0 +1,73 @@
+/*
+ * timing.h: Cycle counts for a run on a 5-stage LC4 pipeline
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "decode.h"
+#include "debuginfo.h"
+#include <stdio.h>
+
+#define TIMING_MAX_TABLE_BITS 16 // most predictor counters: 2^this
+#define TIMING_MAX_LINES 4096    // most lines per cache
+
+// branch predictors
+enum { TIMING_STATIC = 0, TIMING_BIMODAL, TIMING_GSHARE };
+
+// where the cycles beyond one per instruction go
+enum {
+    TIMING_LOAD_USE = 0, // the instruction right after an LDR needs what it loaded
+    TIMING_MISPREDICT,   // a conditional branch went the other way
+    TIMING_INDIRECT,     // JMPR, JSRR or RTI, whose target is only known in execute
+    TIMING_ICACHE,       // fetch took longer than a cycle
+    TIMING_DCACHE,       // LDR or STR took longer than a cycle
+    TIMING_KINDS
+};
+
+/*
+ * A direct-mapped cache of line_words-word lines. Every access takes
+ * hit_cycles or miss_cycles and the pipeline stalls for all but one of
+ * them; with no lines every access hits.
+ */
+typedef struct {
+    int lines;
+    int line_words;
+    int hit_cycles;
+    int miss_cycles;
+    unsigned int tags[TIMING_MAX_LINES]; // line number + 1, 0 for an empty line
+    unsigned long accesses, misses;
+} TimingCache;
+
+/*
+ * The pipeline is F D X M W with full bypassing, so the only data stall is
+ * a load followed by a use of what it loaded (NZP included). Branches
+ * resolve in execute: a wrong guess costs mispredict_penalty cycles, and
+ * so does every indirect jump. Direct jumps, calls and traps are taken as
+ * predicted, as with a BTB. Fed one retired instruction at a time by
+ * RunTimed, it never touches the machine itself.
+ */
+typedef struct {
+    int predictor;          // TIMING_STATIC (backward taken, forward not), TIMING_BIMODAL or TIMING_GSHARE
+    int table_bits;         // 2^this 2-bit counters, and the gshare history length
+    int mispredict_penalty;
+    int load_use_penalty;
+    TimingCache icache, dcache;
+
+    unsigned char counters[1 << TIMING_MAX_TABLE_BITS];
+    unsigned int history;   // last table_bits branch outcomes, newest in bit 0
+    unsigned int loaded;    // registers the previous instruction loaded, bit 8 for NZP, 0 if it wasn't an LDR
+
+    unsigned long insns;
+    unsigned long stalls[TIMING_KINDS];
+    unsigned long branches, mispredicts;
+    unsigned long pc_insns[65536];  // times each address retired
+    unsigned long pc_stalls[65536]; // stall cycles charged to each address
+} Timing;
+
+void TimingInit(Timing* t);
+int TimingParse(Timing* t, const char* spec);
+void TimingRetire(Timing* t, const DecodedInsn* d, unsigned short pc, unsigned short next_pc, unsigned short address);
+void TimingReport(Timing* t, DebugInfo* debug, FILE* output);
+
+#endif
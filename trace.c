@@ -3,40 +3,337 @@
  */
 
 #include "loader.h"
+#include "engine.h"
+#include "debuginfo.h"
+#include "checkpoint.h"
+#include "jit.h"
+#include "watch.h"
+#include "tracefilter.h"
+#include "traps.h"
+#include "devices.h"
+#include "timing.h"
+#include <stdlib.h>
 
 MachineState CPU_STATE;  // set machine state of CPU
 MachineState* CPU = &CPU_STATE;  // pointer holding machine state addr
+DecodeCache DECODE_CACHE;  // predecoded view of CPU memory
+DecodeCache* DECODE = &DECODE_CACHE;
+TraceWriter TRACE_WRITER;  // buffered trace output for the threaded engine
+TraceWriter* TRACE = &TRACE_WRITER;
+DebugInfo DEBUG_INFO;  // labels and source lines from the object files
+DebugInfo* DEBUG = &DEBUG_INFO;
+Profile PROFILE_DATA;  // per-PC counters, only filled with -p
+WatchSet WATCH_SET;  // -B, -R and -W
+TraceFilter TRACE_FILTER;  // -F
+TrapTable TRAP_TABLE;  // -T
+Devices DEVICES;  // -D, -K and -V
+Timing TIMING;  // -t and -m
+
+// instructions from count up to the next multiple of every, 0 if every is
+static unsigned long ToNextMultiple(unsigned long count, unsigned long every)
+{
+    return every != 0 ? every - count % every : 0;
+}
+
+/*
+ * Run the loaded program to the end like RunProgram, pausing every
+ * checkpoint_every instructions (never if 0) to save the machine and the
+ * trace position to checkpoint_file. It ends early after max_insns in all
+ * (0 for no limit) or when something in watch is hit. count is what runs
+ * before a restored checkpoint executed; returns it plus what this run
+ * executed. Vectors with a service in traps run on the host, and with
+ * devices the screen is also saved every frame_every instructions. A
+ * non-NULL timing times every instruction.
+ */
+static unsigned long RunCheckpointed(int engine, TraceWriter* trace, int trace_format, Profile* prof, unsigned long count,
+                                     unsigned long max_insns, WatchSet* watch, TrapTable* traps, Devices* devices,
+                                     unsigned long frame_every, Timing* timing, unsigned long checkpoint_every,
+                                     const char* checkpoint_file)
+{
+    RunLimit limit = { .watch = watch, .traps = traps, .devices = devices, .timing = timing };
+    BlockCache* blocks = NULL; // kept across pauses, RunProgram would translate everything again
+    JitCache* jit = NULL;
+    if ((engine == ENGINE_BLOCK || engine == ENGINE_JIT) && checkpoint_every != 0 && !Watching(&limit) && !HasDevices(&limit) && timing == NULL &&
+        (blocks = malloc(sizeof(BlockCache))) != NULL) {
+        BlockCacheInit(blocks);
+        if (engine == ENGINE_JIT && (jit = malloc(sizeof(JitCache))) != NULL) {
+            JitCacheInit(jit, blocks);
+        }
+    }
+    while (max_insns == 0 || count < max_insns) {
+        unsigned long to_checkpoint = ToNextMultiple(count, checkpoint_every);
+        unsigned long to_frame = devices != NULL ? ToNextMultiple(count, frame_every) : 0;
+        limit.max_insns = to_checkpoint;
+        if (to_frame != 0 && (limit.max_insns == 0 || to_frame < limit.max_insns)) {
+            limit.max_insns = to_frame;
+        }
+        if (max_insns != 0 && (limit.max_insns == 0 || max_insns - count < limit.max_insns)) {
+            limit.max_insns = max_insns - count;
+        }
+        unsigned long ran = jit != NULL ? RunJit(CPU, jit, &limit)
+                          : blocks != NULL ? RunBlocks(CPU, blocks, &limit) : RunProgram(engine, CPU, DECODE, trace, prof, &limit);
+        count += ran;
+        if (to_frame != 0 && ran >= to_frame && DeviceFrame(devices, CPU) < 0) {
+            printf("Error: Cannot write video frame %d\n", devices->frames);
+        }
+        if (CPU->PC == 0x80FF || !LimitReached(&limit, ran) || watch->hit != 0 || (max_insns != 0 && count >= max_insns)) {
+            break; // finished or stopped
+        }
+        if (to_checkpoint == 0 || ran < to_checkpoint) {
+            continue; // paused for a frame only
+        }
+        CheckpointInfo info;
+        info.count = count;
+        info.trace_format = trace != NULL ? trace_format : CHECKPOINT_NO_TRACE;
+        info.trace_offset = trace != NULL ? TraceWriterSync(trace) : 0;
+        if (CheckpointSave(checkpoint_file, CPU, &info) != 0) { // keep going, the run itself is fine
+            printf("Error: Cannot write checkpoint %s\n", checkpoint_file);
+        }
+    }
+    if (jit != NULL) {
+        JitCacheFree(jit);
+        free(jit);
+    }
+    free(blocks);
+    return count;
+}
 
 int main(int argc, char** argv)
 {
-    if (argc < 3) { // need at least 3 args: prog name, output file, and obj input file
+    int arg = 1; // first non-option argument
+    int engine = ENGINE_THREADED;
+    int no_trace = 0; // -n: skip the trace, output file gets the final state
+    char* state_file = NULL; // -s: also dump the final state here
+    int background_flush = 0; // -b: write trace chunks from a separate thread
+    int trace_format = TRACE_TEXT; // -f text|bin
+    char* profile_file = NULL; // -p: write a profile report here
+    unsigned long checkpoint_every = 0; // -c: save a checkpoint every this many instructions
+    char* checkpoint_file = NULL;
+    char* resume_file = NULL; // -r: carry on from this checkpoint
+    unsigned long max_insns = 0; // -l: stop after this many instructions
+    char* watch_specs[64]; // -B, -R, -W: breakpoints and watchpoints, parsed once labels are loaded
+    int watch_flags[64];
+    int num_watches = 0;
+    char* filter_specs[64]; // -F: trace filter terms, also parsed once labels are loaded
+    int num_filters = 0;
+    char* trap_specs[64]; // -T: services run on the host, vectors may be labels too
+    int num_traps = 0;
+    int use_devices = 0; // -D: memory-mapped console, keyboard and screen, also turned on by -K and -V
+    char* keyboard_file = NULL; // -K: the keys typed, one byte each
+    char* video_file = NULL; // -V: the screen as PPM, one numbered file per frame if it holds a %d
+    unsigned long frame_every = 0; // -v: take a frame every this many instructions, not just at the end
+    char* timing_file = NULL; // -t: time the run on the pipeline model and write the report here
+    char* machine_specs[64]; // -m: pipeline model parameters
+    int num_machine_specs = 0;
+    while (arg < argc && argv[arg][0] == '-') { // options come before the output file
+        if (strcmp(argv[arg], "-e") == 0 && arg + 1 < argc) { // -e ref|decode|threaded|block|jit
+            engine = ParseEngine(argv[arg + 1]);
+            if (engine < 0) {
+                printf("Error: unknown engine %s\n", argv[arg + 1]);
+                return -1;
+            }
+            arg += 2;
+        } else if (strcmp(argv[arg], "-n") == 0) {
+            no_trace = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "-b") == 0) {
+            background_flush = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "-f") == 0 && arg + 1 < argc) {
+            if (strcmp(argv[arg + 1], "text") == 0) {
+                trace_format = TRACE_TEXT;
+            } else if (strcmp(argv[arg + 1], "bin") == 0) {
+                trace_format = TRACE_BINARY;
+            } else {
+                printf("Error: unknown trace format %s\n", argv[arg + 1]);
+                return -1;
+            }
+            arg += 2;
+        } else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc) {
+            profile_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            state_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-c") == 0 && arg + 2 < argc) {
+            checkpoint_every = strtoul(argv[arg + 1], NULL, 0);
+            checkpoint_file = argv[arg + 2];
+            if (checkpoint_every == 0) {
+                printf("Error: bad checkpoint interval %s\n", argv[arg + 1]);
+                return -1;
+            }
+            arg += 3;
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            resume_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-F") == 0 && arg + 1 < argc && num_filters < 64) {
+            filter_specs[num_filters++] = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-T") == 0 && arg + 1 < argc && num_traps < 64) {
+            trap_specs[num_traps++] = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-D") == 0) {
+            use_devices = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "-K") == 0 && arg + 1 < argc) {
+            use_devices = 1;
+            keyboard_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-V") == 0 && arg + 1 < argc) {
+            use_devices = 1;
+            video_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-v") == 0 && arg + 1 < argc) {
+            frame_every = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            timing_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc && num_machine_specs < 64) {
+            machine_specs[num_machine_specs++] = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+            max_insns = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if ((strcmp(argv[arg], "-B") == 0 || strcmp(argv[arg], "-R") == 0 || strcmp(argv[arg], "-W") == 0) &&
+                   arg + 1 < argc && num_watches < 64) {
+            watch_flags[num_watches] = argv[arg][1] == 'B' ? WATCH_EXEC : argv[arg][1] == 'R' ? WATCH_READ : WATCH_WRITE;
+            watch_specs[num_watches++] = argv[arg + 1];
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+
+    if (no_trace && engine != ENGINE_THREADED && engine != ENGINE_BLOCK && engine != ENGINE_JIT) {
+        printf("Error: -n only runs on the threaded, block and JIT engines\n");
+        return -1;
+    }
+    if ((engine == ENGINE_BLOCK || engine == ENGINE_JIT) && (!no_trace || profile_file != NULL)) {
+        printf("Error: the %s engine needs -n and can't profile\n", engine == ENGINE_JIT ? "JIT" : "block");
+        return -1;
+    }
+    if (trace_format == TRACE_BINARY && engine != ENGINE_THREADED) {
+        printf("Error: -f bin only runs on the threaded engine\n");
+        return -1;
+    }
+    if (profile_file != NULL && engine != ENGINE_THREADED) {
+        printf("Error: -p only runs on the threaded engine\n");
+        return -1;
+    }
+    if (num_filters != 0 && (engine != ENGINE_THREADED || no_trace)) {
+        printf("Error: -F only filters traces of the threaded engine\n");
+        return -1;
+    }
+    if (num_traps != 0 && !no_trace) {
+        printf("Error: -T needs -n, traced runs always go through the OS\n");
+        return -1;
+    }
+    if (timing_file != NULL && (engine == ENGINE_BLOCK || engine == ENGINE_JIT || trace_format == TRACE_BINARY ||
+                                num_filters != 0 || profile_file != NULL || num_watches != 0 || num_traps != 0 || use_devices)) {
+        printf("Error: -t runs on the decoded engine, with a text trace or -n and without -F, -p, -T, devices or watches\n");
+        return -1;
+    }
+    if (timing_file != NULL && (checkpoint_every != 0 || resume_file != NULL)) { // the counters aren't in the checkpoint
+        printf("Error: -t can't take or carry on from checkpoints\n");
+        return -1;
+    }
+    TimingInit(&TIMING);
+    for (int i = 0; i < num_machine_specs; i++) {
+        if (TimingParse(&TIMING, machine_specs[i]) != 0) {
+            printf("Error: bad pipeline parameter %s\n", machine_specs[i]);
+            return -1;
+        }
+    }
+    if (video_file != NULL && DeviceVideoPath(video_file) < 0) {
+        printf("Error: -V %s can only number frames with one %%d\n", video_file);
+        return -1;
+    }
+    if (use_devices && !no_trace && engine != ENGINE_THREADED) {
+        printf("Error: devices only run on the threaded engine or with -n\n");
+        return -1;
+    }
+    if (profile_file != NULL && (num_watches != 0 || use_devices)) {
+        printf("Error: -p can't be combined with breakpoints, watchpoints or devices\n");
+        return -1;
+    }
+
+    if (argc - arg < (resume_file != NULL ? 1 : 2)) { // need at least an output file and obj input file
         printf("error1 : need prog name, output file and obj file \n");
         return -1;
     }
     
     memset(CPU->memory, 0, sizeof(CPU->memory)); // set CPU mem to 0
     Reset(CPU); // change PC to 0x8200 and empties reg vals
+    ClearDecodeCache(DECODE); // entries get decoded on first fetch
+    DebugInfoInit(DEBUG);
     
-    for (int i = 2; i < argc; i++) { // confirm all obj files are there
-        FILE* test_file = fopen(argv[i], "rb");
-        if (test_file == NULL) {
-            printf("Error: Cannot open file %s\n", argv[i]);
+    for (int i = arg + 1; i < argc; i++) { //put obj files in mEm, a missing file fails here
+        if (ReadObjectFileDebug(argv[i], CPU, DEBUG) != 0) {
+            printf("Error: Failed to read object file %s\n", argv[i]);
             return -1;
         }
-        fclose(test_file);
     }
-    
-    for (int i = 2; i < argc; i++) { //put obj files in mEm
-        if (ReadObjectFile(argv[i], CPU) != 0) {
-            printf("Error: Failed to read object file %s\n", argv[i]);
+    DebugInfoFinish(DEBUG); // sort and index what the loader kept
+
+    WatchInit(&WATCH_SET);
+    for (int i = 0; i < num_watches; i++) {
+        if (WatchParse(&WATCH_SET, watch_specs[i], watch_flags[i], DEBUG) != 0) {
+            printf("Error: bad breakpoint or watchpoint %s\n", watch_specs[i]);
+            return -1;
+        }
+    }
+    TraceFilterInit(&TRACE_FILTER);
+    for (int i = 0; i < num_filters; i++) {
+        if (TraceFilterParse(&TRACE_FILTER, filter_specs[i], DEBUG) != 0) {
+            printf("Error: bad trace filter %s\n", filter_specs[i]);
+            return -1;
+        }
+    }
+    if (use_devices && DevicesInit(&DEVICES, stdout, keyboard_file, video_file) != 0) {
+        printf("Error: Cannot open %s\n", keyboard_file != NULL && DEVICES.keyboard == NULL ? keyboard_file : video_file);
+        return -1;
+    }
+    TrapTableInit(&TRAP_TABLE, stdout, stdin);
+    TRAP_TABLE.devices = use_devices ? &DEVICES : NULL;
+    for (int i = 0; i < num_traps; i++) {
+        if (TrapParse(&TRAP_TABLE, trap_specs[i], DEBUG) != 0) {
+            printf("Error: bad trap service %s\n", trap_specs[i]);
             return -1;
         }
     }
     
+    CheckpointInfo resume = { 0, CHECKPOINT_NO_TRACE, 0 };
+    if (resume_file != NULL) { // obj files above only gave us debug info, memory comes from here
+        if (CheckpointLoad(resume_file, CPU, &resume) != 0) {
+            printf("Error: Failed to read checkpoint %s\n", resume_file);
+            return -1;
+        }
+        if (resume.trace_format != (no_trace ? CHECKPOINT_NO_TRACE : trace_format)) {
+            printf("Error: checkpoint %s was taken with a different trace format\n", resume_file);
+            return -1;
+        }
+        ClearDecodeCache(DECODE);
+        if (TRACE_FILTER.first != 0) { // the per-PC counts aren't in the checkpoint
+            printf("Error: -F first= can't carry on from a checkpoint\n");
+            return -1;
+        }
+        if (use_devices) { // nor are the keys read or the frames written
+            printf("Error: devices can't carry on from a checkpoint\n");
+            return -1;
+        }
+        TRACE_FILTER.index = resume.count; // sampling goes by instruction number
+    }
 
-    FILE* output_file = fopen(argv[1], "w"); // get output file
+    FILE* output_file;
+    if (resume_file != NULL && !no_trace) { // append to the trace the checkpointed run was writing
+        output_file = fopen(argv[arg], trace_format == TRACE_BINARY ? "r+b" : "r+");
+    } else {
+        output_file = fopen(argv[arg], trace_format == TRACE_BINARY ? "wb" : "w"); // get output file
+    }
     if (output_file == NULL) {
-        printf("Error: Cannot create output file %s\n", argv[1]);
+        printf("Error: Cannot create output file %s\n", argv[arg]);
         return -1;
     }
     
@@ -54,12 +351,71 @@ int main(int argc, char** argv)
 		// 	}
     // }
 
-		int result = 0;
-		while (result == 0) {
-				result = UpdateMachineState(CPU, output_file); //update machine statE until it's done
+		unsigned long count;
+		Profile* prof = NULL;
+		if (profile_file != NULL) {
+				prof = &PROFILE_DATA;
+				ProfileInit(prof);
+		}
+		if (no_trace) {
+				count = RunCheckpointed(engine, NULL, trace_format, prof, resume.count, max_insns, &WATCH_SET, &TRAP_TABLE, use_devices ? &DEVICES : NULL, frame_every, timing_file != NULL ? &TIMING : NULL, checkpoint_every, checkpoint_file); // no signals, no I/O until the end but the program's
+				fflush(TRAP_TABLE.console);
+				DumpMachineState(CPU, count, output_file);
+		} else {
+				if (resume_file == NULL) {
+						TraceWriterInit(TRACE, output_file, trace_format, background_flush);
+				} else if (TraceWriterResume(TRACE, output_file, trace_format, background_flush, resume.trace_offset) != 0) {
+						printf("Error: %s doesn't hold the trace checkpoint %s was taken with\n", argv[arg], resume_file);
+						return -1;
+				}
+				if (num_filters != 0) {
+						TRACE->filter = &TRACE_FILTER;
+				}
+				count = RunCheckpointed(engine, TRACE, trace_format, prof, resume.count, max_insns, &WATCH_SET, NULL, use_devices ? &DEVICES : NULL, frame_every, timing_file != NULL ? &TIMING : NULL, checkpoint_every, checkpoint_file); //update machine statE until it's done
+				TraceWriterClose(TRACE);
 		}
     
     fclose(output_file); // close the file
+    if (use_devices) {
+        if (DeviceFrame(&DEVICES, CPU) < 0) { // whatever changed since the last frame
+            printf("Error: Cannot write video frame %d\n", DEVICES.frames);
+        }
+        DevicesClose(&DEVICES);
+    }
+    WatchReport(&WATCH_SET, DEBUG, count, stdout);
+    if (WATCH_SET.hit == 0 && CPU->PC != 0x80FF) {
+        printf("stopped at PC %04X after %lu instructions\n", CPU->PC, count);
+    }
+
+    if (state_file != NULL) {
+        FILE* state_output = fopen(state_file, "w");
+        if (state_output == NULL) {
+            printf("Error: Cannot create state file %s\n", state_file);
+            return -1;
+        }
+        DumpMachineState(CPU, count, state_output);
+        fclose(state_output);
+    }
+
+    if (timing_file != NULL) {
+        FILE* timing_output = fopen(timing_file, "w");
+        if (timing_output == NULL) {
+            printf("Error: Cannot create timing report %s\n", timing_file);
+            return -1;
+        }
+        TimingReport(&TIMING, DEBUG, timing_output);
+        fclose(timing_output);
+    }
+
+    if (prof != NULL) {
+        FILE* profile_output = fopen(profile_file, "w");
+        if (profile_output == NULL) {
+            printf("Error: Cannot create profile file %s\n", profile_file);
+            return -1;
+        }
+        ProfileReport(prof, CPU, DEBUG, profile_output);
+        fclose(profile_output);
+    }
     
     return 0;
 }
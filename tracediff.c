@@ -0,0 +1,528 @@
+/*
+ * tracediff.c: main() for comparing two traces record by record in constant memory
+ */
+
+#include "bintrace.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define READ_BUF_SIZE (1 << 20) // bytes of text buffered per trace, longer lines are an error
+#define CONTEXT_MAX 16          // records kept for -c
+#define SUMMARY_MAGIC "LC4 trace summary"
+
+static const char* field_names[10] = {
+    "PC", "instruction", "regFile_WE", "rdMux_CTL", "regInputVal",
+    "NZP_WE", "NZPVal", "DATA_WE", "dmemAddr", "dmemValue",
+};
+
+/*
+ * One trace line as numbers, in line order: PC, instruction, then the
+ * control signals. Text and binary traces of the same run read the same.
+ */
+typedef struct {
+    unsigned int field[10];
+} TraceRecord;
+
+/*
+ * Reads records from a text or binary trace. Text goes through buf, which
+ * also lets two text traces be compared a buffer at a time.
+ */
+typedef struct {
+    FILE* input;
+    const char* name;
+    int binary;
+    BinTraceState* bin;   // binary only: decoder delta state
+    MachineState* state;  // binary only: where a decoded record lands
+    char* buf;            // text only
+    size_t start, end;    // unread bytes are buf[start..end)
+    int eof;              // nothing more to read from input
+    unsigned long records; // records read so far
+} TraceReader;
+
+/*
+ * Open a trace and work out its format from the binary header.
+ * Returns 0, or -1 after printing why not.
+ */
+static int ReaderOpen(TraceReader* r, const char* name)
+{
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->input = fopen(name, "rb");
+    if (r->input == NULL) {
+        printf("Error: Cannot open file %s\n", name);
+        return -1;
+    }
+    r->binary = BinTraceCheckHeader(r->input) == 0;
+    if (r->binary) {
+        r->bin = malloc(sizeof(BinTraceState));
+        r->state = malloc(sizeof(MachineState));
+        if (r->bin == NULL || r->state == NULL) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+        BinTraceReset(r->bin);
+        memset(r->state, 0, sizeof(MachineState));
+    } else {
+        rewind(r->input);
+        r->buf = malloc(READ_BUF_SIZE);
+        if (r->buf == NULL) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void ReaderClose(TraceReader* r)
+{
+    if (r->input != NULL) {
+        fclose(r->input);
+    }
+    free(r->bin);
+    free(r->state);
+    free(r->buf);
+}
+
+/*
+ * Move what is left to the front of the buffer and read more behind it.
+ * Returns the number of unread bytes.
+ */
+static size_t Fill(TraceReader* r)
+{
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (!r->eof && r->end < READ_BUF_SIZE) {
+        size_t got = fread(r->buf + r->end, 1, READ_BUF_SIZE - r->end, r->input);
+        r->end += got;
+        if (got == 0) {
+            r->eof = 1;
+        }
+    }
+    return r->end - r->start;
+}
+
+/*
+ * Point *line at the next text line and set *len to its length without
+ * the newline. Returns 1 for a line, 0 at the end of the file and -1 for a
+ * line too long to buffer.
+ */
+static int NextLine(TraceReader* r, char** line, long* len)
+{
+    char* nl;
+    while ((nl = memchr(r->buf + r->start, '\n', r->end - r->start)) == NULL) {
+        if (r->end - r->start == READ_BUF_SIZE) {
+            return -1;
+        }
+        if (r->eof) { // a last line without a newline, or nothing
+            if (r->end == r->start) {
+                return 0;
+            }
+            *line = r->buf + r->start;
+            *len = r->end - r->start;
+            r->start = r->end;
+            return 1;
+        }
+        Fill(r);
+    }
+    *line = r->buf + r->start;
+    *len = nl - *line;
+    r->start += *len + 1;
+    return 1;
+}
+
+/*
+ * Parse a text trace line: hex PC, the instruction in binary, then the
+ * signals, decimal or hex as WriteOut prints them. Returns 0, or -1 if
+ * the line doesn't have that shape.
+ */
+static int ParseLine(const char* line, long len, TraceRecord* rec)
+{
+    static const int base[10] = { 16, 2, 10, 10, 16, 10, 10, 10, 16, 16 };
+    char text[128];
+    if (len >= (long)sizeof(text)) {
+        return -1;
+    }
+    memcpy(text, line, len);
+    text[len] = '\0';
+    char* p = text;
+    for (int i = 0; i < 10; i++) {
+        char* end;
+        rec->field[i] = strtoul(p, &end, base[i]);
+        if (end == p || (*end != ' ' && *end != '\0' && *end != '\r')) {
+            return -1;
+        }
+        p = end;
+    }
+    return (*p == '\0' || *p == '\r') ? 0 : -1;
+}
+
+/*
+ * Read the next record. Returns 1 for a record, 0 at the end and -1 on
+ * something that isn't a trace record.
+ */
+static int ReadRecord(TraceReader* r, TraceRecord* rec)
+{
+    if (r->binary) {
+        int result = BinTraceDecode(r->bin, r->input, r->state);
+        if (result != 1) {
+            return result;
+        }
+        MachineState* s = r->state;
+        unsigned int values[10] = { s->PC, s->memory[s->PC], s->regFile_WE, s->rdMux_CTL, s->regInputVal,
+                                    s->NZP_WE, s->NZPVal, s->DATA_WE, s->dmemAddr, s->dmemValue };
+        memcpy(rec->field, values, sizeof(values));
+    } else {
+        char* line;
+        long len;
+        int result = NextLine(r, &line, &len);
+        if (result != 1) {
+            return result;
+        }
+        if (ParseLine(line, len, rec) != 0) {
+            return -1;
+        }
+    }
+    r->records++;
+    return 1;
+}
+
+/*
+ * Write rec the way WriteOut prints it.
+ */
+static void PrintRecord(const TraceRecord* rec, FILE* output)
+{
+    const unsigned int* f = rec->field;
+    fprintf(output, "%04X ", f[0]);
+    for (int i = 15; i >= 0; i--) {
+        fputc('0' + ((f[1] >> i) & 1), output);
+    }
+    fprintf(output, " %u %u %04X %u %u %u %04X %04X\n", f[2], f[3], f[4], f[5], f[6], f[7], f[8], f[9]);
+}
+
+/*
+ * Skip the identical full lines at the front of two text traces a buffer
+ * at a time, counting them. The last lines skipped go into the context
+ * ring so a mismatch right after still gets its context.
+ */
+static void SkipEqualText(TraceReader* a, TraceReader* b, TraceRecord* ring, int context)
+{
+    while (1) {
+        size_t na = a->end - a->start;
+        size_t nb = b->end - b->start;
+        if (na < READ_BUF_SIZE / 2 && !a->eof) {
+            na = Fill(a);
+        }
+        if (nb < READ_BUF_SIZE / 2 && !b->eof) {
+            nb = Fill(b);
+        }
+        char* pa = a->buf + a->start;
+        char* pb = b->buf + b->start;
+        size_t n = na < nb ? na : nb;
+        size_t same = 0;
+        while (same < n) { // memcmp in blocks to find roughly where they part
+            size_t block = n - same < 4096 ? n - same : 4096;
+            if (memcmp(pa + same, pb + same, block) != 0) {
+                while (pa[same] == pb[same]) {
+                    same++;
+                }
+                break;
+            }
+            same += block;
+        }
+        char* last = pa + same; // end of the last whole line they share
+        while (last > pa && last[-1] != '\n') {
+            last--;
+        }
+        if (last == pa) {
+            return;
+        }
+        last--;
+        size_t skip = last - pa + 1;
+        unsigned long lines = 0;
+        for (char* p = pa; (p = memchr(p, '\n', pa + skip - p)) != NULL; p++) {
+            lines++;
+        }
+        // the last few skipped lines become context
+        char* line_end = last;
+        for (int i = 0; i < context && (unsigned long)i < lines; i++) {
+            char* line_start = line_end;
+            while (line_start > pa && line_start[-1] != '\n') {
+                line_start--;
+            }
+            unsigned long index = a->records + lines - 1 - i;
+            if (ParseLine(line_start, line_end - line_start, &ring[index % CONTEXT_MAX]) != 0) {
+                memset(&ring[index % CONTEXT_MAX], 0, sizeof(TraceRecord));
+            }
+            line_end = line_start - 1;
+        }
+        a->start += skip;
+        b->start += skip;
+        a->records += lines;
+        b->records += lines;
+        if (skip < n || n == 0) { // they differ, or one of them ran out
+            return;
+        }
+    }
+}
+
+/*
+ * Hash chunk_records records at a time and write one line per chunk: the
+ * line number it starts at, its record count and an FNV-1a hash of the
+ * records' fields, so a text and a binary trace of one run hash the same.
+ */
+static int Summarize(const char* name, unsigned long chunk_records, FILE* output)
+{
+    TraceReader r;
+    if (ReaderOpen(&r, name) != 0) {
+        ReaderClose(&r);
+        return -1;
+    }
+    fprintf(output, "%s %lu\n", SUMMARY_MAGIC, chunk_records);
+    TraceRecord rec;
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+    unsigned long in_chunk = 0;
+    int result;
+    while ((result = ReadRecord(&r, &rec)) == 1) {
+        for (int i = 0; i < 10; i++) {
+            for (int byte = 0; byte < 4; byte++) {
+                hash = (hash ^ ((rec.field[i] >> (8 * byte)) & 0xFF)) * 0x100000001B3ULL;
+            }
+        }
+        if (++in_chunk == chunk_records) {
+            fprintf(output, "%lu %lu %016llX\n", r.records - in_chunk + 1, in_chunk, hash);
+            hash = 0xCBF29CE484222325ULL;
+            in_chunk = 0;
+        }
+    }
+    if (in_chunk != 0) {
+        fprintf(output, "%lu %lu %016llX\n", r.records - in_chunk + 1, in_chunk, hash);
+    }
+    ReaderClose(&r);
+    if (result < 0) {
+        printf("Error: %s: bad record at line %lu\n", name, r.records + 1);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const char* name;
+    unsigned long chunk_records;
+    int result;
+} SummaryJob;
+
+static void* SummaryThread(void* arg)
+{
+    SummaryJob* job = arg;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.sum", job->name);
+    FILE* output = fopen(path, "w");
+    if (output == NULL) {
+        printf("Error: Cannot create output file %s\n", path);
+        job->result = -1;
+        return NULL;
+    }
+    job->result = Summarize(job->name, job->chunk_records, output);
+    fclose(output);
+    return NULL;
+}
+
+/*
+ * If both files are summaries, compare them chunk by chunk and report the
+ * first chunk that differs. Returns -2 if they aren't both summaries,
+ * otherwise 0 for a match, 1 for a difference and -1 on an error.
+ */
+static int CompareSummaries(const char* name_a, const char* name_b)
+{
+    FILE* a = fopen(name_a, "r");
+    FILE* b = fopen(name_b, "r");
+    char line_a[128], line_b[128];
+    int result = -2;
+    if (a != NULL && b != NULL && fgets(line_a, sizeof(line_a), a) != NULL && fgets(line_b, sizeof(line_b), b) != NULL &&
+        strncmp(line_a, SUMMARY_MAGIC, strlen(SUMMARY_MAGIC)) == 0 && strncmp(line_b, SUMMARY_MAGIC, strlen(SUMMARY_MAGIC)) == 0) {
+        if (strcmp(line_a, line_b) != 0) {
+            printf("Error: the summaries use different chunk sizes\n");
+            result = -1;
+        } else {
+            result = 0;
+            unsigned long chunks = 0;
+            while (1) {
+                char* got_a = fgets(line_a, sizeof(line_a), a);
+                char* got_b = fgets(line_b, sizeof(line_b), b);
+                if (got_a == NULL && got_b == NULL) {
+                    printf("traces match, %lu chunks\n", chunks);
+                    break;
+                }
+                if (got_a == NULL || got_b == NULL || strcmp(line_a, line_b) != 0) {
+                    unsigned long first = strtoul(got_a != NULL ? line_a : line_b, NULL, 10);
+                    printf("chunk %lu differs, from line %lu; compare the traces with -k %lu\n", chunks + 1, first, first);
+                    result = 1;
+                    break;
+                }
+                chunks++;
+            }
+        }
+    }
+    if (a != NULL) {
+        fclose(a);
+    }
+    if (b != NULL) {
+        fclose(b);
+    }
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int arg = 1;
+    unsigned long max_mismatches = 10; // -n: mismatches printed, 0 for none
+    int keep_going = 0;                // -a: count every mismatch instead of stopping after -n
+    int context = 2;                   // -c: matching records shown before a mismatch
+    unsigned long skip = 0;            // -k: start comparing at this line
+    unsigned long chunk_records = 0;   // -s: write chunk summaries instead of comparing
+    while (arg < argc && argv[arg][0] == '-') {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            max_mismatches = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-a") == 0) {
+            keep_going = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc) {
+            context = atoi(argv[arg + 1]);
+            context = context < 0 ? 0 : context > CONTEXT_MAX ? CONTEXT_MAX : context;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc) {
+            skip = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            chunk_records = strtoul(argv[arg + 1], NULL, 0);
+            arg += 2;
+        } else {
+            printf("Error: unknown option %s\n", argv[arg]);
+            return -1;
+        }
+    }
+    if ((chunk_records == 0 && argc - arg != 2) || (chunk_records != 0 && argc - arg < 1)) {
+        printf("usage: %s [-n max_mismatches] [-a] [-c context] [-k first_line] trace_a trace_b\n", argv[0]);
+        printf("       %s -s chunk_records trace...   write trace.sum for each, in parallel\n", argv[0]);
+        printf("       %s a.sum b.sum                 find the first chunk that differs\n", argv[0]);
+        return -1;
+    }
+
+    if (chunk_records != 0) {
+        int jobs = argc - arg;
+        SummaryJob* job = calloc(jobs, sizeof(SummaryJob));
+        pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+        if (job == NULL || threads == NULL) {
+            printf("Error: out of memory\n");
+            return -1;
+        }
+        for (int i = 0; i < jobs; i++) {
+            job[i].name = argv[arg + i];
+            job[i].chunk_records = chunk_records;
+            if (pthread_create(&threads[i], NULL, SummaryThread, &job[i]) != 0) {
+                SummaryThread(&job[i]); // no thread, do it here
+                threads[i] = 0;
+            }
+        }
+        int result = 0;
+        for (int i = 0; i < jobs; i++) {
+            if (threads[i] != 0) {
+                pthread_join(threads[i], NULL);
+            }
+            result |= job[i].result;
+        }
+        free(job);
+        free(threads);
+        return result;
+    }
+
+    int summaries = CompareSummaries(argv[arg], argv[arg + 1]);
+    if (summaries != -2) {
+        return summaries;
+    }
+
+    static TraceReader a, b;
+    if (ReaderOpen(&a, argv[arg]) != 0 || ReaderOpen(&b, argv[arg + 1]) != 0) {
+        return -1;
+    }
+    TraceRecord ring[CONTEXT_MAX]; // last records of a, by index modulo CONTEXT_MAX
+    TraceRecord ra, rb;
+    unsigned long mismatches = 0, first_mismatch = 0;
+    unsigned long first_line = skip > 1 ? skip : 1;
+    int result_a = 1, result_b = 1;
+    while (skip > 1 && a.records < skip - 1 && (result_a = ReadRecord(&a, &ra)) == 1) {
+    }
+    while (skip > 1 && b.records < skip - 1 && (result_b = ReadRecord(&b, &rb)) == 1) {
+    }
+    while (result_a == 1 && result_b == 1) {
+        if (!a.binary && !b.binary && a.records == b.records) {
+            SkipEqualText(&a, &b, ring, context);
+        }
+        result_a = ReadRecord(&a, &ra);
+        result_b = ReadRecord(&b, &rb);
+        if (result_a != 1 || result_b != 1) {
+            break;
+        }
+        unsigned long line = a.records;
+        if (memcmp(&ra, &rb, sizeof(ra)) != 0) {
+            if (mismatches == 0) {
+                first_mismatch = line;
+            }
+            if (mismatches < max_mismatches) {
+                printf("line %lu, PC %04X:", line, ra.field[0]);
+                for (int i = 0; i < 10; i++) {
+                    if (ra.field[i] != rb.field[i]) {
+                        printf(" %s", field_names[i]);
+                    }
+                }
+                printf("\n");
+                unsigned long from = line > (unsigned long)context ? line - context : 1;
+                if (from < first_line) {
+                    from = first_line;
+                }
+                for (unsigned long l = from; l < line; l++) { // context, the same in both
+                    printf("      ");
+                    PrintRecord(&ring[(l - 1) % CONTEXT_MAX], stdout);
+                }
+                printf("    < ");
+                PrintRecord(&ra, stdout);
+                printf("    > ");
+                PrintRecord(&rb, stdout);
+            }
+            mismatches++;
+            if (!keep_going && mismatches >= max_mismatches) {
+                break;
+            }
+        }
+        ring[(line - 1) % CONTEXT_MAX] = ra;
+    }
+
+    int status = mismatches != 0;
+    if (result_a < 0 || result_b < 0) {
+        TraceReader* bad = result_a < 0 ? &a : &b;
+        printf("Error: %s: bad record at line %lu\n", bad->name, bad->records + 1);
+        status = -1;
+    } else if (result_a != result_b) {
+        TraceReader* longer = result_a == 1 ? &a : &b;
+        printf("%s ends after %lu records, %s goes on\n", longer == &a ? b.name : a.name,
+               longer == &a ? b.records : a.records, longer->name);
+        status = 1;
+    }
+    if (mismatches != 0) {
+        if (result_a != 1 || result_b != 1) { // compared all the way
+            printf("%lu of %lu records differ, the first at line %lu\n", mismatches, a.records, first_mismatch);
+        } else {
+            printf("stopped after %lu differing records, the first at line %lu\n", mismatches, first_mismatch);
+        }
+    } else if (status == 0) {
+        printf("traces match, %lu records\n", a.records);
+    }
+    ReaderClose(&a);
+    ReaderClose(&b);
+    return status;
+}
@@ -0,0 +1,58 @@
+/*
+ * tracedump.c: main() for turning a binary trace back into the text trace
+ */
+
+#include "tracewriter.h"
+#include <string.h>
+
+MachineState DUMP_STATE;  // just enough state for one trace line at a time
+MachineState* CPU = &DUMP_STATE;
+TraceWriter DUMP_WRITER;  // text writer, same formatting as the simulator
+TraceWriter* TRACE = &DUMP_WRITER;
+BinTraceState DUMP_BIN;   // delta state mirroring the encoder's
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) { // need binary trace and text output
+        printf("usage: %s binary_trace text_output\n", argv[0]);
+        return -1;
+    }
+
+    FILE* input = fopen(argv[1], "rb");
+    if (input == NULL) {
+        printf("Error: Cannot open file %s\n", argv[1]);
+        return -1;
+    }
+    if (BinTraceCheckHeader(input) != 0) {
+        printf("Error: %s is not a binary trace\n", argv[1]);
+        fclose(input);
+        return -1;
+    }
+
+    FILE* output = fopen(argv[2], "w");
+    if (output == NULL) {
+        printf("Error: Cannot create output file %s\n", argv[2]);
+        fclose(input);
+        return -1;
+    }
+
+    memset(CPU, 0, sizeof(*CPU));
+    BinTraceReset(&DUMP_BIN);
+    TraceWriterInit(TRACE, output, TRACE_TEXT, 0);
+
+    unsigned long records = 0;
+    int result;
+    while ((result = BinTraceDecode(&DUMP_BIN, input, CPU)) == 1) {
+        TraceWriterLine(TRACE, CPU);
+        records++;
+    }
+    TraceWriterClose(TRACE);
+    fclose(output);
+    fclose(input);
+
+    if (result < 0) {
+        printf("Error: bad record after %lu records\n", records);
+        return -1;
+    }
+    return 0;
+}
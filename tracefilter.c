@@ -0,0 +1,143 @@
+/*
+ * tracefilter.c: Builds trace filters from command-line specs
+ */
+
+#include "tracefilter.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Start with a filter that keeps every line.
+ */
+void TraceFilterInit(TraceFilter* f)
+{
+    memset(f, 0, sizeof(*f));
+    memset(f->pcs, 0xFF, sizeof(f->pcs));
+    f->ops = 0xFFFF;
+}
+
+/*
+ * Add first..last to the PC set, dropping the "every PC" default on the
+ * first range.
+ */
+static void AddRange(TraceFilter* f, unsigned short first, unsigned short last)
+{
+    if (!f->pcs_given) {
+        memset(f->pcs, 0, sizeof(f->pcs));
+        f->pcs_given = 1;
+    }
+    for (unsigned int pc = first; pc <= last; pc++) {
+        f->pcs[pc >> 3] |= 1 << (pc & 7);
+    }
+}
+
+/*
+ * Parse a count or signal value: decimal, 0x hex or x-prefixed hex.
+ * Returns 0, or -1 if text isn't a number.
+ */
+static int ParseNumber(const char* text, unsigned long* value)
+{
+    char* end;
+    if (text[0] == 'x' || text[0] == 'X') {
+        *value = strtoul(text + 1, &end, 16);
+    } else {
+        *value = strtoul(text, &end, 0);
+    }
+    return (end != text && *end == '\0') ? 0 : -1;
+}
+
+/*
+ * Add one key=value term to the filter:
+ *   pc=A or pc=A-B  PCs A to B, addresses in hex or labels
+ *   sym=NAME        PCs from label NAME up to the next label
+ *   op=NAME,...     opcodes BR ARITH CMP JSR LOGIC LDR STR RTI CONST SHIFT JMP HICONST TRAP
+ *   SIGNAL=V        a signal as named in the trace, e.g. DATA_WE=1 or rdMux_CTL=7
+ *   every=N         only lines of every Nth instruction
+ *   random=N        each instruction's line with chance 1/N, seed=S picks the draw
+ *   first=K         at most K lines per PC
+ * Ranges and opcodes add up, signals all have to match. Returns 0, or -1 if
+ * spec doesn't parse.
+ */
+int TraceFilterParse(TraceFilter* f, const char* spec, DebugInfo* debug)
+{
+    static const char* op_names[16] = {
+        "BR", "ARITH", "CMP", NULL, "JSR", "LOGIC", "LDR", "STR",
+        "RTI", "CONST", "SHIFT", NULL, "JMP", "HICONST", NULL, "TRAP",
+    };
+    static const char* signal_names[] = {
+        "regFile_WE", "rdMux_CTL", "regInputVal", "NZP_WE", "NZPVal", "DATA_WE", "dmemAddr", "dmemValue",
+    };
+    char key[32];
+    char value[128];
+    size_t len = strcspn(spec, "=");
+    if (len == 0 || len >= sizeof(key) || spec[len] != '=' || strlen(spec + len + 1) >= sizeof(value)) {
+        return -1;
+    }
+    memcpy(key, spec, len);
+    key[len] = '\0';
+    strcpy(value, spec + len + 1);
+
+    unsigned long n;
+    if (strcmp(key, "pc") == 0) {
+        unsigned short first, last;
+        char* dash = strchr(value, '-');
+        if (dash != NULL) {
+            *dash = '\0';
+        }
+        if (DebugParseAddress(debug, value, &first) != 0 ||
+            DebugParseAddress(debug, dash != NULL ? dash + 1 : value, &last) != 0 || last < first) {
+            return -1;
+        }
+        AddRange(f, first, last);
+    } else if (strcmp(key, "sym") == 0) {
+        unsigned short first, next;
+        if (DebugLookupName(debug, value, &first) != 0) {
+            return -1;
+        }
+        AddRange(f, first, DebugNextSymbol(debug, first, &next) == 0 ? next - 1 : 0xFFFF);
+    } else if (strcmp(key, "op") == 0) {
+        if (f->ops == 0xFFFF) {
+            f->ops = 0;
+        }
+        for (char* name = strtok(value, ","); name != NULL; name = strtok(NULL, ",")) {
+            int op;
+            for (op = 0; op < 16; op++) {
+                if (op_names[op] != NULL && strcmp(op_names[op], name) == 0) {
+                    break;
+                }
+            }
+            if (op == 16) {
+                return -1;
+            }
+            f->ops |= 1 << op;
+        }
+    } else if (strcmp(key, "every") == 0 || strcmp(key, "random") == 0) {
+        if (ParseNumber(value, &n) != 0 || n == 0) {
+            return -1;
+        }
+        f->sample = key[0] == 'e' ? TRACE_SAMPLE_EVERY : TRACE_SAMPLE_RANDOM;
+        f->every = n;
+    } else if (strcmp(key, "seed") == 0) {
+        if (ParseNumber(value, &f->seed) != 0) {
+            return -1;
+        }
+    } else if (strcmp(key, "first") == 0) {
+        if (ParseNumber(value, &f->first) != 0 || f->first == 0) {
+            return -1;
+        }
+    } else {
+        int signal;
+        for (signal = 0; signal < 8; signal++) {
+            if (strcmp(signal_names[signal], key) == 0) {
+                break;
+            }
+        }
+        if (signal == 8 || f->num_signals == TRACE_FILTER_SIGNALS || ParseNumber(value, &n) != 0 || n > 0xFFFF) {
+            return -1;
+        }
+        f->signal[f->num_signals] = signal;
+        f->value[f->num_signals] = n;
+        f->num_signals++;
+    }
+    return 0;
+}
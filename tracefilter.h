@@ -0,0 +1,100 @@
+/*
+ * tracefilter.h: Picks which trace lines get written, before they are formatted
+ */
+
+#ifndef TRACEFILTER_H
+#define TRACEFILTER_H
+
+#include "LC4.h"
+#include "debuginfo.h"
+
+#define TRACE_FILTER_SIGNALS 8 // signal conditions per filter
+
+// sampling of the lines that pass the predicates
+enum {
+    TRACE_SAMPLE_ALL = 0,
+    TRACE_SAMPLE_EVERY,  // lines of every Nth instruction
+    TRACE_SAMPLE_RANDOM  // each instruction's line with chance 1/N, by a hash of its index
+};
+
+// signals a line can be selected on, in trace line order
+enum {
+    SIG_REGFILE_WE = 0, SIG_RDMUX_CTL, SIG_REGINPUTVAL, SIG_NZP_WE,
+    SIG_NZPVAL, SIG_DATA_WE, SIG_DMEMADDR, SIG_DMEMVALUE
+};
+
+/*
+ * The predicates look at the fields of the line as it would be printed: the
+ * PC, the instruction word at it and the signals. A line is kept if its PC
+ * is in the PC set, the opcode of that word is in ops and every signal
+ * condition holds; sampling then thins out what passed.
+ */
+typedef struct {
+    unsigned char pcs[65536 / 8];   // bit per PC, all set until a range is given
+    int pcs_given;
+    unsigned short ops;             // bit per opcode, top 4 bits of the instruction
+    int num_signals;
+    unsigned char signal[TRACE_FILTER_SIGNALS]; // SIG_*
+    unsigned short value[TRACE_FILTER_SIGNALS];
+    int sample;                     // TRACE_SAMPLE_*
+    unsigned long every;            // N for TRACE_SAMPLE_EVERY and TRACE_SAMPLE_RANDOM
+    unsigned long seed;
+    unsigned long first;            // keep at most this many lines per PC, 0 for no limit
+    unsigned int kept_at[65536];    // lines kept at each PC, only counted with first
+    unsigned long index;            // lines offered so far, one per instruction
+} TraceFilter;
+
+void TraceFilterInit(TraceFilter* f);
+int TraceFilterParse(TraceFilter* f, const char* spec, DebugInfo* debug);
+
+static inline unsigned short TraceSignal(MachineState* CPU, int signal)
+{
+    switch (signal) {
+        case SIG_REGFILE_WE: return CPU->regFile_WE;
+        case SIG_RDMUX_CTL: return CPU->rdMux_CTL;
+        case SIG_REGINPUTVAL: return CPU->regInputVal;
+        case SIG_NZP_WE: return CPU->NZP_WE;
+        case SIG_NZPVAL: return CPU->NZPVal;
+        case SIG_DATA_WE: return CPU->DATA_WE;
+        case SIG_DMEMADDR: return CPU->dmemAddr;
+        default: return CPU->dmemValue;
+    }
+}
+
+/*
+ * Whether the line for CPU's current state is written. Called once per
+ * instruction, so the cheap PC and opcode tests come first.
+ */
+static inline int TraceFilterKeep(TraceFilter* f, MachineState* CPU)
+{
+    unsigned long index = f->index++;
+    unsigned short pc = CPU->PC;
+    if (!(f->pcs[pc >> 3] & (1 << (pc & 7))) || !(f->ops & (1 << (CPU->memory[pc] >> 12)))) {
+        return 0;
+    }
+    for (int i = 0; i < f->num_signals; i++) {
+        if (TraceSignal(CPU, f->signal[i]) != f->value[i]) {
+            return 0;
+        }
+    }
+    if (f->sample == TRACE_SAMPLE_EVERY && index % f->every != 0) {
+        return 0;
+    }
+    if (f->sample == TRACE_SAMPLE_RANDOM) {
+        unsigned long x = (index + f->seed) * 0x9E3779B97F4A7C15UL; // splitmix64 finalizer
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+        if ((x ^ (x >> 31)) % f->every != 0) {
+            return 0;
+        }
+    }
+    if (f->first != 0) {
+        if (f->kept_at[pc] >= f->first) {
+            return 0;
+        }
+        f->kept_at[pc]++;
+    }
+    return 1;
+}
+
+#endif
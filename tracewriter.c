@@ -0,0 +1,275 @@
+/*
+ * tracewriter.c: Formats trace lines into a large buffer and writes it out in chunks
+ */
+
+#include "tracewriter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char bit_string[256][8]; // "00000000".."11111111" for each byte
+static char hex_pair[256][2];   // "00".."FF" for each byte
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Fill the byte lookup tables the first time a writer is created, from
+ * whichever thread gets there first.
+ */
+static void BuildTables(void)
+{
+    const char* digits = "0123456789ABCDEF";
+    for (int b = 0; b < 256; b++) {
+        for (int i = 0; i < 8; i++) {
+            bit_string[b][i] = '0' + ((b >> (7 - i)) & 1); // MSB first
+        }
+        hex_pair[b][0] = digits[b >> 4];
+        hex_pair[b][1] = digits[b & 0xF];
+    }
+}
+
+/*
+ * Same characters as "%04X": at least four upper-case hex digits.
+ */
+static inline char* PutHex(char* p, unsigned int v)
+{
+    if (v > 0xFFFF) { // wider than a word, fall back to printf rules
+        return p + sprintf(p, "%04X", v);
+    }
+    memcpy(p, hex_pair[v >> 8], 2);
+    memcpy(p + 2, hex_pair[v & 0xFF], 2);
+    return p + 4;
+}
+
+/*
+ * Same characters as "%d".
+ */
+static inline char* PutDec(char* p, int v)
+{
+    if (v >= 0 && v < 10) { // every control signal lands here
+        *p++ = '0' + v;
+        return p;
+    }
+    return p + sprintf(p, "%d", v);
+}
+
+/*
+ * Hand the filled buffer to the flush thread and switch to the other one.
+ */
+static void HandOff(TraceWriter* tw)
+{
+    pthread_mutex_lock(&tw->lock);
+    while (tw->pending != NULL) { // previous chunk still being written
+        pthread_cond_wait(&tw->cond, &tw->lock);
+    }
+    tw->pending = tw->buf;
+    tw->pending_len = tw->len;
+    pthread_cond_broadcast(&tw->cond);
+    pthread_mutex_unlock(&tw->lock);
+
+    tw->buf = (tw->buf == tw->bufs[0]) ? tw->bufs[1] : tw->bufs[0];
+    tw->len = 0;
+}
+
+/*
+ * Flush thread: write out each chunk handed over until the writer closes.
+ */
+static void* FlushThread(void* arg)
+{
+    TraceWriter* tw = arg;
+    pthread_mutex_lock(&tw->lock);
+    while (1) {
+        while (tw->pending == NULL && !tw->closing) {
+            pthread_cond_wait(&tw->cond, &tw->lock);
+        }
+        if (tw->pending == NULL) { // closing with nothing left
+            break;
+        }
+        char* chunk = tw->pending;
+        size_t len = tw->pending_len;
+        pthread_mutex_unlock(&tw->lock);
+        fwrite(chunk, 1, len, tw->output);
+        pthread_mutex_lock(&tw->lock);
+        tw->pending = NULL;
+        pthread_cond_broadcast(&tw->cond);
+    }
+    pthread_mutex_unlock(&tw->lock);
+    return NULL;
+}
+
+/*
+ * Everything Init and Resume share: empty buffers and the flush thread.
+ */
+static void Setup(TraceWriter* tw, FILE* output, int format, int background)
+{
+    pthread_once(&tables_once, BuildTables);
+    tw->output = output;
+    tw->format = format;
+    tw->filter = NULL;
+    tw->buf = tw->bufs[0];
+    tw->len = 0;
+    tw->background = 0;
+    tw->pending = NULL;
+    tw->pending_len = 0;
+    tw->closing = 0;
+
+    if (background) {
+        pthread_mutex_init(&tw->lock, NULL);
+        pthread_cond_init(&tw->cond, NULL);
+        if (pthread_create(&tw->thread, NULL, FlushThread, tw) == 0) {
+            tw->background = 1;
+        } else { // no thread, flush in the foreground instead
+            pthread_mutex_destroy(&tw->lock);
+            pthread_cond_destroy(&tw->cond);
+        }
+    }
+}
+
+/*
+ * Set up a writer on an open file. With background set, fwrite calls run
+ * on their own thread while the simulator fills the other buffer.
+ */
+void TraceWriterInit(TraceWriter* tw, FILE* output, int format, int background)
+{
+    Setup(tw, output, format, background);
+    if (format == TRACE_BINARY) {
+        BinTraceReset(&tw->bin);
+        BinTraceHeader((unsigned char*)tw->buf);
+        tw->len = BINTRACE_HEADER_SIZE;
+    }
+}
+
+/*
+ * Set up a writer that carries on a trace whose first offset bytes an
+ * earlier run wrote, as TraceWriterSync reported them. output has to be
+ * open for reading and writing; anything past offset is cut off. A binary
+ * trace is read back up to offset first, to get the encoder's delta state
+ * to where the earlier run left it.
+ * Returns 0, or -1 if the file doesn't hold a trace of that length.
+ */
+int TraceWriterResume(TraceWriter* tw, FILE* output, int format, int background, long offset)
+{
+    if (fseek(output, 0, SEEK_END) != 0 || ftell(output) < offset) {
+        return -1;
+    }
+    if (format == TRACE_BINARY) {
+        MachineState* scratch = malloc(sizeof(MachineState)); // decoded lines go nowhere
+        if (scratch == NULL) {
+            return -1;
+        }
+        rewind(output);
+        BinTraceReset(&tw->bin);
+        int result = BinTraceCheckHeader(output);
+        while (result == 0 && ftell(output) < offset) {
+            result = BinTraceDecode(&tw->bin, output, scratch) == 1 ? 0 : -1;
+        }
+        free(scratch);
+        if (result != 0 || ftell(output) != offset) { // offset isn't on a record boundary
+            return -1;
+        }
+    }
+    fflush(output);
+    if (ftruncate(fileno(output), offset) != 0 || fseek(output, offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    Setup(tw, output, format, background);
+    return 0;
+}
+
+/*
+ * Append the current state of the CPU, byte-for-byte what WriteOut prints,
+ * or the binary record for it, unless the writer's filter drops the line.
+ */
+void TraceWriterLine(TraceWriter* tw, MachineState* CPU)
+{
+    if (tw->filter != NULL && !TraceFilterKeep(tw->filter, CPU)) { // before any formatting
+        return;
+    }
+    if (tw->len + TRACE_LINE_MAX > TRACE_BUF_SIZE) {
+        TraceWriterFlush(tw);
+    }
+    if (tw->format == TRACE_BINARY) {
+        tw->len += BinTraceEncode(&tw->bin, CPU, (unsigned char*)tw->buf + tw->len);
+        return;
+    }
+
+    char* p = tw->buf + tw->len;
+    unsigned short instr = CPU->memory[CPU->PC]; // get instruction
+
+    p = PutHex(p, CPU->PC);
+    *p++ = ' ';
+    memcpy(p, bit_string[instr >> 8], 8); // print bin instr
+    memcpy(p + 8, bit_string[instr & 0xFF], 8);
+    p += 16;
+    *p++ = ' ';
+
+    p = PutDec(p, CPU->regFile_WE);
+    *p++ = ' ';
+    p = PutDec(p, CPU->rdMux_CTL);
+    *p++ = ' ';
+    p = PutHex(p, CPU->regInputVal);
+    *p++ = ' ';
+    p = PutDec(p, CPU->NZP_WE);
+    *p++ = ' ';
+    p = PutDec(p, CPU->NZPVal);
+    *p++ = ' ';
+    p = PutDec(p, CPU->DATA_WE);
+    *p++ = ' ';
+    p = PutHex(p, CPU->dmemAddr);
+    *p++ = ' ';
+    p = PutHex(p, CPU->dmemValue);
+    *p++ = '\n';
+
+    tw->len = p - tw->buf;
+}
+
+/*
+ * Push everything buffered so far towards the file.
+ */
+void TraceWriterFlush(TraceWriter* tw)
+{
+    if (tw->len == 0) {
+        return;
+    }
+    if (tw->background) {
+        HandOff(tw);
+    } else {
+        fwrite(tw->buf, 1, tw->len, tw->output);
+        tw->len = 0;
+    }
+}
+
+/*
+ * Get everything buffered so far into the file, waiting for the flush
+ * thread if there is one. Returns the file offset the next line goes to.
+ */
+long TraceWriterSync(TraceWriter* tw)
+{
+    TraceWriterFlush(tw);
+    if (tw->background) {
+        pthread_mutex_lock(&tw->lock);
+        while (tw->pending != NULL) {
+            pthread_cond_wait(&tw->cond, &tw->lock);
+        }
+        pthread_mutex_unlock(&tw->lock);
+    }
+    fflush(tw->output);
+    return ftell(tw->output);
+}
+
+/*
+ * Flush the last chunk and stop the flush thread. The file stays open.
+ */
+void TraceWriterClose(TraceWriter* tw)
+{
+    TraceWriterFlush(tw);
+    if (tw->background) {
+        pthread_mutex_lock(&tw->lock);
+        tw->closing = 1;
+        pthread_cond_broadcast(&tw->cond);
+        pthread_mutex_unlock(&tw->lock);
+        pthread_join(tw->thread, NULL);
+        pthread_mutex_destroy(&tw->lock);
+        pthread_cond_destroy(&tw->cond);
+        tw->background = 0;
+    }
+}
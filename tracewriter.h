@@ -0,0 +1,47 @@
+/*
+ * tracewriter.h: Buffered trace output, same lines as WriteOut without per-field fprintf
+ */
+
+#ifndef TRACEWRITER_H
+#define TRACEWRITER_H
+
+#include "LC4.h"
+#include "bintrace.h"
+#include "tracefilter.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define TRACE_BUF_SIZE (1 << 20) // bytes per buffer before a flush
+#define TRACE_LINE_MAX 128       // room reserved for one formatted line or record
+
+// output formats, picked with -f on the command line
+enum {
+    TRACE_TEXT = 0, // what WriteOut prints
+    TRACE_BINARY    // bintrace.h records, tracedump turns them back into text
+};
+
+typedef struct {
+    FILE* output;
+    int format;                      // TRACE_TEXT or TRACE_BINARY
+    BinTraceState bin;               // delta state for TRACE_BINARY
+    TraceFilter* filter;             // lines to keep, NULL for all
+    char* buf;                       // buffer currently being filled, one of bufs[]
+    size_t len;
+    char bufs[2][TRACE_BUF_SIZE];    // second buffer only used by the flush thread
+    int background;                  // 1 if a separate thread does the fwrite calls
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char* pending;                   // buffer handed to the flush thread, NULL when idle
+    size_t pending_len;
+    int closing;
+} TraceWriter;
+
+void TraceWriterInit(TraceWriter* tw, FILE* output, int format, int background);
+int TraceWriterResume(TraceWriter* tw, FILE* output, int format, int background, long offset);
+void TraceWriterLine(TraceWriter* tw, MachineState* CPU);
+void TraceWriterFlush(TraceWriter* tw);
+long TraceWriterSync(TraceWriter* tw);
+void TraceWriterClose(TraceWriter* tw);
+
+#endif
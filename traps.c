@@ -0,0 +1,153 @@
+/*
+ * traps.c: Host versions of the OS services, bound to TRAP vectors from the command line
+ */
+
+#include "traps.h"
+#include <string.h>
+
+// a character for the console, held back with the device output if there are devices
+static void ConsolePutc(TrapTable* t, int c)
+{
+    if (t->devices != NULL) {
+        DevicePutc(t->devices, c);
+    } else {
+        fputc(c, t->console);
+    }
+}
+
+// R0: the next byte typed, 0 once the keyboard runs dry
+static void TrapGetc(TrapTable* t, MachineState* CPU)
+{
+    if (t->devices != NULL) {
+        CPU->R[0] = DeviceGetc(t->devices);
+        return;
+    }
+    int c = fgetc(t->keyboard);
+    CPU->R[0] = (c == EOF) ? 0 : c;
+}
+
+// the low byte of R0 goes to the console
+static void TrapPutc(TrapTable* t, MachineState* CPU)
+{
+    ConsolePutc(t, CPU->R[0] & 0xFF);
+}
+
+// one character per word from R0 up to a zero word
+static void TrapPuts(TrapTable* t, MachineState* CPU)
+{
+    unsigned short address = CPU->R[0];
+    for (int i = 0; i < 65536 && CPU->memory[address] != 0; i++, address++) {
+        ConsolePutc(t, CPU->memory[address] & 0xFF);
+    }
+}
+
+// R2 is the color of the pixel at column R0, row R1; off the screen draws nothing
+static void TrapDrawPixel(TrapTable* t, MachineState* CPU)
+{
+    unsigned short col = CPU->R[0];
+    unsigned short row = CPU->R[1];
+    if (col < VIDEO_COLS && row < VIDEO_ROWS) {
+        TrapStore(t, CPU, VIDEO_BASE + row * VIDEO_COLS + col, CPU->R[2]);
+    }
+}
+
+// fill R2 columns by R3 rows from column R0, row R1 with R4, clipped to the screen
+static void TrapDrawRect(TrapTable* t, MachineState* CPU)
+{
+    int col = (short)CPU->R[0];
+    int row = (short)CPU->R[1];
+    int last_col = col + (short)CPU->R[2];
+    int last_row = row + (short)CPU->R[3];
+    col = col < 0 ? 0 : col;
+    row = row < 0 ? 0 : row;
+    last_col = last_col > VIDEO_COLS ? VIDEO_COLS : last_col;
+    last_row = last_row > VIDEO_ROWS ? VIDEO_ROWS : last_row;
+    for (int y = row; y < last_row; y++) {
+        for (int x = col; x < last_col; x++) {
+            TrapStore(t, CPU, VIDEO_BASE + y * VIDEO_COLS + x, CPU->R[4]);
+        }
+    }
+}
+
+// what -T accepts, with the vector each service has in the course OS
+static const struct {
+    const char* name;
+    TrapService service;
+    int vector;
+} services[] = {
+    { "getc", TrapGetc, 0x00 },
+    { "putc", TrapPutc, 0x01 },
+    { "puts", TrapPuts, 0x03 },
+    { "draw_pixel", TrapDrawPixel, 0x08 },
+    { "draw_rect", TrapDrawRect, 0x09 },
+};
+#define NUM_SERVICES (int)(sizeof(services) / sizeof(services[0]))
+
+void TrapTableInit(TrapTable* t, FILE* console, FILE* keyboard)
+{
+    memset(t, 0, sizeof(*t));
+    t->console = console;
+    t->keyboard = keyboard;
+}
+
+/*
+ * Enable a service from the command line: "name" binds it to its usual
+ * vector, "name=vector" to another one, given as a vector (x21), the
+ * address of its vector table entry (x8021) or a label there (TRAP_PUTC).
+ * "all" binds every service to its usual vector. Returns 0, or -1 for an
+ * unknown service or a bad vector.
+ */
+int TrapParse(TrapTable* t, const char* spec, DebugInfo* debug)
+{
+    if (strcmp(spec, "all") == 0) {
+        for (int i = 0; i < NUM_SERVICES; i++) {
+            t->service[services[i].vector] = services[i].service;
+        }
+        return 0;
+    }
+    const char* equals = strchr(spec, '=');
+    size_t length = equals != NULL ? (size_t)(equals - spec) : strlen(spec);
+    for (int i = 0; i < NUM_SERVICES; i++) {
+        if (strlen(services[i].name) != length || strncmp(spec, services[i].name, length) != 0) {
+            continue;
+        }
+        int vector = services[i].vector;
+        if (equals != NULL) {
+            unsigned short address;
+            if (DebugParseAddress(debug, equals + 1, &address) != 0 || (address > 0xFF && (address & 0xFF00) != 0x8000)) {
+                return -1;
+            }
+            vector = address & 0xFF;
+        }
+        t->service[vector] = services[i].service;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Memory writes from a service, which the engine has to see in case the
+ * word was decoded or translated.
+ */
+void TrapStore(TrapTable* t, MachineState* CPU, unsigned short address, unsigned short value)
+{
+    CPU->memory[address] = value;
+    t->dirty[address >> PAGE_SHIFT] = 1;
+    t->wrote = 1;
+    DeviceWrite(t->devices, CPU, address);
+}
+
+/*
+ * Drop the decoded entries of every page services stored to and start
+ * over with no dirty pages.
+ */
+void TrapInvalidate(TrapTable* t, DecodeCache* cache)
+{
+    for (int page = 0; page < NUM_PAGES; page++) {
+        if (t->dirty[page]) {
+            InvalidatePage(cache, page);
+            t->dirty[page] = 0;
+        }
+    }
+    t->wrote = 0;
+}
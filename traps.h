@@ -0,0 +1,54 @@
+/*
+ * traps.h: Host functions standing in for the OS routines behind TRAP vectors
+ */
+
+#ifndef TRAPS_H
+#define TRAPS_H
+
+#include "decode.h"
+#include "debuginfo.h"
+#include "devices.h"
+#include <stdio.h>
+
+#define TRAP_VECTORS 256
+
+typedef struct TrapTable TrapTable;
+typedef void (*TrapService)(TrapTable* t, MachineState* CPU);
+
+/*
+ * Services the no-trace engines run on the host instead of jumping into
+ * the simulated OS, one per enabled vector. A hosted TRAP counts as one
+ * instruction and leaves no trace of the OS routine, so runs that have to
+ * match the reference trace keep every vector NULL.
+ */
+struct TrapTable {
+    TrapService service[TRAP_VECTORS]; // NULL: the TRAP runs the OS routine as usual
+    FILE* console;                     // where PUTC and PUTS write
+    FILE* keyboard;                    // where GETC reads from
+    Devices* devices;                  // NULL, or the console, keyboard and screen used instead
+    unsigned char dirty[NUM_PAGES];    // pages services stored to since the engine last looked
+    int wrote;                         // any dirty page
+    unsigned long calls;
+};
+
+void TrapTableInit(TrapTable* t, FILE* console, FILE* keyboard);
+int TrapParse(TrapTable* t, const char* spec, DebugInfo* debug);
+void TrapStore(TrapTable* t, MachineState* CPU, unsigned short address, unsigned short value);
+void TrapInvalidate(TrapTable* t, DecodeCache* cache);
+
+/*
+ * Run the service for vector in place of TRAP, the OS routine and its RTI:
+ * R7 gets the return address as TRAP sets it, the service runs in OS
+ * mode, then PSR = 0 and PC = R7 as RTI leaves them.
+ */
+static inline void TrapCall(TrapTable* t, MachineState* CPU, unsigned short pc, int vector)
+{
+    CPU->R[7] = pc + 1;
+    CPU->PSR = 1;
+    t->service[vector](t, CPU);
+    t->calls++;
+    CPU->PSR = 0;
+    CPU->PC = CPU->R[7];
+}
+
+#endif
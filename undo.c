@@ -0,0 +1,168 @@
+/*
+ * undo.c: Records what each instruction overwrites and plays it back in reverse
+ */
+
+#include "undo.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The i-th oldest snapshot in the ring, i < snap_num.
+ */
+static UndoSnapshot* RecentSnapshot(UndoLog* log, int i)
+{
+    return &log->snaps[1 + (log->snap_first + i) % UNDO_SNAPSHOTS];
+}
+
+/*
+ * Forget snapshots taken after the current instruction; stepping forward
+ * again takes them anew.
+ */
+static void DropNewerSnapshots(UndoLog* log)
+{
+    while (log->snap_num > 0 && RecentSnapshot(log, log->snap_num - 1)->count > log->count) {
+        log->snap_num--;
+    }
+}
+
+/*
+ * Start a log for CPU as it is now, normally right after loading. The ring
+ * holds entries rounded up to a power of 2; snapshot_every 0 means as many
+ * as the ring holds. Returns 0, or -1 if there is no room for the log.
+ */
+int UndoInit(UndoLog* log, MachineState* CPU, unsigned long entries, unsigned long snapshot_every)
+{
+    unsigned long size = 64;
+    while (size < entries) {
+        size <<= 1;
+    }
+    log->entries = malloc(size * sizeof(UndoEntry));
+    log->to_memory = calloc(size / 8, 1);
+    log->snaps = malloc((1 + UNDO_SNAPSHOTS) * sizeof(UndoSnapshot));
+    if (log->entries == NULL || log->to_memory == NULL || log->snaps == NULL) {
+        UndoFree(log);
+        return -1;
+    }
+    log->mask = size - 1;
+    log->count = 0;
+    log->oldest = 0;
+    log->snapshot_every = snapshot_every != 0 ? snapshot_every : size;
+    log->snaps[0].count = 0;
+    memcpy(&log->snaps[0].state, CPU, sizeof(MachineState));
+    log->snap_first = 0;
+    log->snap_num = 0;
+    log->output = NULL;
+    return 0;
+}
+
+void UndoFree(UndoLog* log)
+{
+    free(log->entries);
+    free(log->to_memory);
+    free(log->snaps);
+    log->entries = NULL;
+    log->to_memory = NULL;
+    log->snaps = NULL;
+}
+
+/*
+ * Execute one instruction with UpdateMachineStateDecoded, recording what
+ * it overwrites first. Returns 1 once the program has reached 0x80FF,
+ * without executing anything if it already had, else 0.
+ */
+int UndoStep(UndoLog* log, MachineState* CPU, DecodeCache* cache)
+{
+    if (CPU->PC == 0x80FF && log->count > 0) { // only the first instruction runs without the exit check
+        return 1;
+    }
+    const DecodedInsn* d = FetchDecoded(cache, CPU, CPU->PC);
+    unsigned long slot = log->count & log->mask;
+    UndoEntry* e = &log->entries[slot];
+    e->pc = CPU->PC;
+    e->psr = CPU->PSR;
+    if (d->form == FORM_STR) {
+        e->addr = (unsigned short)(CPU->R[d->rs] + d->imm);
+        e->old = CPU->memory[e->addr];
+        log->to_memory[slot >> 3] |= 1 << (slot & 7);
+    } else {
+        e->addr = (d->form == FORM_JSR || d->form == FORM_JSRR || d->form == FORM_TRAP) ? 7 : (d->rd & 7);
+        e->old = CPU->R[e->addr];
+        log->to_memory[slot >> 3] &= ~(1 << (slot & 7));
+    }
+
+    int done = UpdateMachineStateDecoded(CPU, cache, log->output);
+    log->count++;
+    if (log->count - log->oldest > log->mask + 1) { // ring full, the oldest entry was just overwritten
+        log->oldest++;
+    }
+    if (log->count % log->snapshot_every == 0) {
+        if (log->snap_num == UNDO_SNAPSHOTS) {
+            log->snap_first = (log->snap_first + 1) % UNDO_SNAPSHOTS;
+            log->snap_num--;
+        }
+        UndoSnapshot* snap = RecentSnapshot(log, log->snap_num++);
+        snap->count = log->count;
+        memcpy(&snap->state, CPU, sizeof(MachineState));
+    }
+    return done;
+}
+
+/*
+ * Take back the last instruction. Signals are cleared rather than restored,
+ * as after Reset. Returns 0, or -1 at the start of the program.
+ */
+int UndoReverseStep(UndoLog* log, MachineState* CPU, DecodeCache* cache)
+{
+    if (log->count == 0) {
+        return -1;
+    }
+    if (log->count == log->oldest) { // entry gone, go through a snapshot
+        return UndoSeek(log, CPU, cache, log->count - 1);
+    }
+    log->count--;
+    unsigned long slot = log->count & log->mask;
+    UndoEntry* e = &log->entries[slot];
+    if (log->to_memory[slot >> 3] & (1 << (slot & 7))) {
+        CPU->memory[e->addr] = e->old;
+        InvalidateDecoded(cache, e->addr); // the word may be code
+    } else {
+        CPU->R[e->addr] = e->old;
+    }
+    CPU->PSR = e->psr;
+    CPU->PC = e->pc;
+    ClearSignals(CPU);
+    DropNewerSnapshots(log);
+    return 0;
+}
+
+/*
+ * Move to the state after target instructions, backwards through the undo
+ * entries while they reach, else from the newest snapshot at or before
+ * target. Returns 0, or -1 if the program ends before target.
+ */
+int UndoSeek(UndoLog* log, MachineState* CPU, DecodeCache* cache, unsigned long target)
+{
+    if (target < log->oldest) {
+        UndoSnapshot* snap = &log->snaps[0];
+        for (int i = log->snap_num - 1; i >= 0; i--) {
+            if (RecentSnapshot(log, i)->count <= target) {
+                snap = RecentSnapshot(log, i);
+                break;
+            }
+        }
+        memcpy(CPU, &snap->state, sizeof(MachineState));
+        ClearDecodeCache(cache);
+        log->count = snap->count;
+        log->oldest = snap->count;
+        DropNewerSnapshots(log);
+    }
+    while (log->count > target) {
+        UndoReverseStep(log, CPU, cache);
+    }
+    while (log->count < target) {
+        if (UndoStep(log, CPU, cache) != 0 && log->count < target) {
+            return -1;
+        }
+    }
+    return 0;
+}
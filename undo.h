@@ -0,0 +1,55 @@
+/*
+ * undo.h: Undo log for stepping a machine backwards
+ */
+
+#ifndef UNDO_H
+#define UNDO_H
+
+#include "decode.h"
+
+#define UNDO_SNAPSHOTS 8 // recent full snapshots kept besides the starting state
+
+/*
+ * What one instruction overwrote. Every instruction gets an entry: one that
+ * writes no register records the register named in its Rd field, which it
+ * leaves alone, so undoing it puts back the value that is already there.
+ */
+typedef struct {
+    unsigned short pc;   // PC before the instruction
+    unsigned short psr;  // PSR before the instruction
+    unsigned short old;  // overwritten register or memory word
+    unsigned short addr; // register number, or memory address for a STR
+} UndoEntry;
+
+typedef struct {
+    unsigned long count; // instructions executed when it was taken
+    MachineState state;
+} UndoSnapshot;
+
+/*
+ * Execution history of one machine: a ring of undo entries for the latest
+ * instructions, 8 bytes and a bit each, and full snapshots every
+ * snapshot_every instructions. Going back past the ring means restoring
+ * the newest snapshot before the target and stepping forward again, so no
+ * seek replays more than snapshot_every instructions unless the snapshot
+ * ring has moved on too, in which case it replays from the start.
+ */
+typedef struct {
+    UndoEntry* entries;           // entry for instruction i at i & mask
+    unsigned char* to_memory;     // bit per entry: old goes to memory[addr], not R[addr]
+    unsigned long mask;           // ring size - 1
+    unsigned long count;          // instructions executed since the start
+    unsigned long oldest;         // first instruction that still has its entry
+    unsigned long snapshot_every;
+    UndoSnapshot* snaps;          // snaps[0] is the start, then a ring of UNDO_SNAPSHOTS
+    int snap_first, snap_num;     // oldest ring slot and how many are in use
+    FILE* output;                 // trace of executed instructions, NULL for none
+} UndoLog;
+
+int UndoInit(UndoLog* log, MachineState* CPU, unsigned long entries, unsigned long snapshot_every);
+void UndoFree(UndoLog* log);
+int UndoStep(UndoLog* log, MachineState* CPU, DecodeCache* cache);
+int UndoReverseStep(UndoLog* log, MachineState* CPU, DecodeCache* cache);
+int UndoSeek(UndoLog* log, MachineState* CPU, DecodeCache* cache, unsigned long target);
+
+#endif
@@ -0,0 +1,195 @@
+/*
+ * watch.c: Setting up breakpoints and watchpoints and deciding when one stops a run
+ */
+
+#include "watch.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Start with nothing watched.
+ */
+void WatchInit(WatchSet* w)
+{
+    memset(w, 0, sizeof(*w));
+}
+
+/*
+ * Redo the summary byte of the page holding address after its flags changed.
+ */
+static void UpdatePage(WatchSet* w, unsigned short address)
+{
+    int first = address & ~(PAGE_WORDS - 1);
+    unsigned char any = 0;
+    for (int a = first; a < first + PAGE_WORDS; a++) {
+        any |= w->flags[a];
+    }
+    w->pages[address >> PAGE_SHIFT] = any;
+}
+
+/*
+ * Set WATCH_EXEC, WATCH_READ and/or WATCH_WRITE on address.
+ */
+void WatchAdd(WatchSet* w, unsigned short address, int flags)
+{
+    if (w->flags[address] == 0 && flags != 0) {
+        w->active++;
+    }
+    w->flags[address] |= flags;
+    w->pages[address >> PAGE_SHIFT] |= flags;
+}
+
+/*
+ * Clear flags on address. Clearing WATCH_EXEC also drops the conditions
+ * attached to it.
+ */
+void WatchRemove(WatchSet* w, unsigned short address, int flags)
+{
+    if (flags & WATCH_EXEC) {
+        int kept = 0;
+        for (int i = 0; i < w->num_conds; i++) {
+            if (w->conds[i].pc != address) {
+                w->conds[kept++] = w->conds[i];
+            }
+        }
+        w->num_conds = kept;
+        flags |= WATCH_COND;
+    }
+    if (w->flags[address] != 0 && (w->flags[address] & ~flags) == 0) {
+        w->active--;
+    }
+    w->flags[address] &= ~flags;
+    UpdatePage(w, address);
+}
+
+/*
+ * Stop before the instruction at pc when register reg compares to value
+ * with op. Returns 0, or -1 when WATCH_MAX_CONDS are already set.
+ */
+int WatchAddCondition(WatchSet* w, unsigned short pc, int reg, int op, short value)
+{
+    if (w->num_conds == WATCH_MAX_CONDS) {
+        return -1;
+    }
+    w->conds[w->num_conds].pc = pc;
+    w->conds[w->num_conds].reg = reg & 7;
+    w->conds[w->num_conds].op = op;
+    w->conds[w->num_conds].value = value;
+    w->num_conds++;
+    WatchAdd(w, pc, WATCH_COND);
+    return 0;
+}
+
+/*
+ * Parse the address or label in front of the first ':' of text. Returns
+ * the character after it, or NULL.
+ */
+static const char* ParseAddress(const char* text, DebugInfo* debug, unsigned short* address)
+{
+    char name[128];
+    size_t len = strcspn(text, ":");
+    if (len >= sizeof(name)) {
+        return NULL;
+    }
+    memcpy(name, text, len);
+    name[len] = '\0';
+    return DebugParseAddress(debug, name, address) == 0 ? text + len : NULL;
+}
+
+/*
+ * Add a watch from the command line: an address or label, and for
+ * breakpoints optionally ":Rn<op>value" with op one of == != < <= > >=
+ * and value decimal or x-prefixed hex, e.g. "loop:R3==0" or "x4000".
+ * Returns 0, or -1 if spec doesn't parse.
+ */
+int WatchParse(WatchSet* w, const char* spec, int flags, DebugInfo* debug)
+{
+    static const char* ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+    static const int op_values[] = { WATCH_EQ, WATCH_NE, WATCH_LE, WATCH_GE, WATCH_LT, WATCH_GT };
+    unsigned short address;
+    const char* rest = ParseAddress(spec, debug, &address);
+    if (rest == NULL) {
+        return -1;
+    }
+    if (*rest == '\0') {
+        WatchAdd(w, address, flags);
+        return 0;
+    }
+    // a condition: Rn, comparison, value
+    rest++;
+    if (flags != WATCH_EXEC || (rest[0] != 'R' && rest[0] != 'r') || rest[1] < '0' || rest[1] > '7') {
+        return -1;
+    }
+    int reg = rest[1] - '0';
+    rest += 2;
+    int op = -1;
+    for (int i = 0; i < 6; i++) {
+        if (strncmp(rest, ops[i], strlen(ops[i])) == 0) {
+            op = op_values[i];
+            rest += strlen(ops[i]);
+            break;
+        }
+    }
+    char* end;
+    long value = (rest[0] == 'x' || rest[0] == 'X') ? strtol(rest + 1, &end, 16) : strtol(rest, &end, 10);
+    if (op < 0 || end == rest || *end != '\0' || value < -32768 || value > 0xFFFF) {
+        return -1;
+    }
+    return WatchAddCondition(w, address, reg, op, (short)value);
+}
+
+/*
+ * Called by the engines before running the instruction at PC when its page
+ * has a breakpoint. Returns 1 and records the hit if the run has to stop.
+ */
+int WatchBreakpoint(WatchSet* w, MachineState* CPU)
+{
+    unsigned short pc = CPU->PC;
+    int stop = (w->flags[pc] & WATCH_EXEC) != 0;
+    for (int i = 0; !stop && (w->flags[pc] & WATCH_COND) && i < w->num_conds; i++) {
+        const WatchCond* c = &w->conds[i];
+        if (c->pc != pc) {
+            continue;
+        }
+        short r = CPU->R[c->reg];
+        switch (c->op) {
+            case WATCH_EQ: stop = r == c->value; break;
+            case WATCH_NE: stop = r != c->value; break;
+            case WATCH_LT: stop = r < c->value; break;
+            case WATCH_LE: stop = r <= c->value; break;
+            case WATCH_GT: stop = r > c->value; break;
+            default: stop = r >= c->value; break;
+        }
+    }
+    if (stop) {
+        w->hit = WATCH_EXEC;
+        w->hit_pc = pc;
+        w->hit_addr = pc;
+    }
+    return stop;
+}
+
+/*
+ * Print why the last run stopped, nothing if no watch stopped it.
+ */
+void WatchReport(WatchSet* w, DebugInfo* debug, unsigned long count, FILE* output)
+{
+    unsigned short offset;
+    const char* label = debug != NULL ? DebugSymbolAt(debug, w->hit_pc, &offset) : NULL;
+    char where[160];
+    if (label != NULL) {
+        snprintf(where, sizeof(where), "%04X <%s+%u>", w->hit_pc, label, offset);
+    } else {
+        snprintf(where, sizeof(where), "%04X", w->hit_pc);
+    }
+    switch (w->hit) {
+        case WATCH_EXEC:
+            fprintf(output, "breakpoint at %s after %lu instructions\n", where, count);
+            break;
+        case WATCH_READ:
+        case WATCH_WRITE:
+            fprintf(output, "%s of %04X by %s after %lu instructions\n", w->hit == WATCH_READ ? "read" : "write",
+                    w->hit_addr, where, count);
+            break;
+    }
+}
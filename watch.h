@@ -0,0 +1,67 @@
+/*
+ * watch.h: Breakpoints, memory watchpoints and register conditions that stop a run
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "decode.h"
+#include "debuginfo.h"
+#include <stdio.h>
+
+// per-address flags
+#define WATCH_EXEC  1 // stop before the instruction at this address runs
+#define WATCH_READ  2 // stop after an LDR reads this word
+#define WATCH_WRITE 4 // stop after an STR writes this word
+#define WATCH_COND  8 // stop before this instruction if one of its conditions holds
+#define WATCH_STOP_PC (WATCH_EXEC | WATCH_COND)
+
+#define WATCH_MAX_CONDS 32
+
+// comparisons for register conditions, all signed
+enum { WATCH_EQ = 0, WATCH_NE, WATCH_LT, WATCH_LE, WATCH_GT, WATCH_GE };
+
+typedef struct {
+    unsigned short pc;
+    unsigned char reg;
+    unsigned char op; // WATCH_EQ ...
+    short value;
+} WatchCond;
+
+/*
+ * Where a run has to stop. The engines look at pages first, which stays in
+ * cache, and only touch flags for a page that has something set.
+ */
+typedef struct {
+    unsigned char flags[65536];     // WATCH_* bits per address
+    unsigned char pages[NUM_PAGES]; // the flags of each page ORed together
+    WatchCond conds[WATCH_MAX_CONDS];
+    int num_conds;
+    int active;                     // addresses with any flag set
+    int hit;                        // WATCH_EXEC, WATCH_READ or WATCH_WRITE that ended the last run, 0 if none
+    unsigned short hit_pc;          // instruction stopped before, or the LDR/STR that made the access
+    unsigned short hit_addr;        // word accessed, or hit_pc for a breakpoint
+} WatchSet;
+
+void WatchInit(WatchSet* w);
+void WatchAdd(WatchSet* w, unsigned short address, int flags);
+void WatchRemove(WatchSet* w, unsigned short address, int flags);
+int WatchAddCondition(WatchSet* w, unsigned short pc, int reg, int op, short value);
+int WatchParse(WatchSet* w, const char* spec, int flags, DebugInfo* debug);
+int WatchBreakpoint(WatchSet* w, MachineState* CPU);
+void WatchReport(WatchSet* w, DebugInfo* debug, unsigned long count, FILE* output);
+
+/*
+ * Record an LDR (WATCH_READ) or STR (WATCH_WRITE) at pc touching address
+ * if it is watched; the engine stops once the instruction retires.
+ */
+static inline void WatchAccess(WatchSet* w, unsigned short pc, unsigned short address, int kind)
+{
+    if ((w->pages[address >> PAGE_SHIFT] & kind) && (w->flags[address] & kind)) {
+        w->hit = kind;
+        w->hit_pc = pc;
+        w->hit_addr = address;
+    }
+}
+
+#endif